@@ -0,0 +1,70 @@
+// Benchmark-Latency:
+// Time from run() to the start of the task, with the default workers (that
+// park when idle) and with a latency group (spinning threads), sending one
+// task at a time with a pause in between, like network packets or audio
+// blocks. Reports the percentiles and the CPU used (process CPU time over
+// wall time, in cores).
+//
+// usage: px_sched_benchmark_latency [num_tasks] [pause_in_microseconds] [first_cpu]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static void bench(const char *name, bool latency_mode, uint32_t num_tasks,
+                  uint32_t pause_us, int32_t first_cpu) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  if (latency_mode) params.addLatencyGroup("Latency", 1, first_cpu);
+  px_sched::Scheduler schd;
+  schd.init(params);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  std::vector<double> latencies(num_tasks);
+  std::atomic<uint32_t> done = {0};
+  px_sched::TaskParams tp;
+  tp.low_latency = latency_mode;
+  const std::clock_t cpu0 = std::clock();
+  const Clock::time_point wall0 = Clock::now();
+  for(uint32_t i = 0; i < num_tasks; ++i) {
+    Clock::time_point sent = Clock::now();
+    schd.run([&latencies, &done, sent, i] {
+      latencies[i] = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+      done.fetch_add(1);
+    }, nullptr, tp);
+    while (done.load() <= i) PX_SCHED_CPU_PAUSE();
+    std::this_thread::sleep_for(std::chrono::microseconds(pause_us));
+  }
+  const double wall = std::chrono::duration<double>(Clock::now() - wall0).count();
+  const double cpu = static_cast<double>(std::clock() - cpu0)/CLOCKS_PER_SEC;
+  schd.stop();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    return latencies[static_cast<size_t>(p*static_cast<double>(latencies.size() - 1))]/1000.0;
+  };
+  printf("%-10s %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, percentile(0.5),
+    percentile(0.9), percentile(0.99), percentile(0.999), cpu/wall);
+}
+
+int main(int argc, char **argv) {
+  uint32_t num_tasks = 10000;
+  uint32_t pause_us = 100;
+  int32_t first_cpu = -1;
+  if (argc > 1) num_tasks = static_cast<uint32_t>(atoi(argv[1]));
+  if (argc > 2) pause_us = static_cast<uint32_t>(atoi(argv[2]));
+  if (argc > 3) first_cpu = atoi(argv[3]);
+
+  printf("run() to task start in us, %u tasks, %uus between tasks (%u hardware threads)\n",
+    num_tasks, pause_us, std::thread::hardware_concurrency());
+  printf("%-10s %10s %10s %10s %10s %10s\n", "mode", "p50", "p90", "p99", "p99.9", "cpu cores");
+  bench("default", false, num_tasks, pause_us, first_cpu);
+  bench("latency", true, num_tasks, pause_us, first_cpu);
+  return 0;
+}
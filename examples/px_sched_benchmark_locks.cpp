@@ -0,0 +1,68 @@
+// Benchmark-Locks:
+// Contention benchmark of the lock family (Spinlock, TTASLock, TicketLock,
+// MCSLock) against std::mutex. N threads increment a shared counter inside
+// a small critical section, the result is the average time per lock/unlock.
+//
+// usage: px_sched_benchmark_locks [iterations_per_thread]
+
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static const uint32_t kMaxThreads = 8;
+
+template<class L>
+static double bench(uint32_t num_threads, uint32_t iterations) {
+  L lock;
+  uint64_t counter = 0;
+  std::atomic<bool> start = {false};
+  std::thread threads[kMaxThreads];
+  for(uint32_t t = 0; t < num_threads; ++t) {
+    threads[t] = std::thread([&] {
+      while (!start.load()) std::this_thread::yield();
+      for(uint32_t i = 0; i < iterations; ++i) {
+        lock.lock();
+        counter++;
+        lock.unlock();
+      }
+    });
+  }
+  auto t0 = std::chrono::high_resolution_clock::now();
+  start.store(true);
+  for(uint32_t t = 0; t < num_threads; ++t) threads[t].join();
+  auto t1 = std::chrono::high_resolution_clock::now();
+  if (counter != uint64_t(num_threads)*iterations) {
+    printf("ERROR: counter mismatch\n");
+    exit(1);
+  }
+  double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count());
+  return ns/(static_cast<double>(num_threads)*iterations);
+}
+
+template<class L>
+static void row(const char *name, uint32_t iterations) {
+  printf("%-12s", name);
+  for(uint32_t n = 1; n <= kMaxThreads; n *= 2) {
+    printf(" %10.1f", bench<L>(n, iterations));
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  uint32_t iterations = 100000;
+  if (argc > 1) iterations = static_cast<uint32_t>(atoi(argv[1]));
+
+  printf("ns per lock/unlock, %u iterations per thread (%u hardware threads)\n",
+    iterations, std::thread::hardware_concurrency());
+  printf("%-12s", "threads");
+  for(uint32_t n = 1; n <= kMaxThreads; n *= 2) printf(" %10u", n);
+  printf("\n");
+  row<std::mutex>("std::mutex", iterations);
+  row<px_sched::Spinlock>("Spinlock", iterations);
+  row<px_sched::TTASLock>("TTASLock", iterations);
+  row<px_sched::TicketLock>("TicketLock", iterations);
+  row<px_sched::MCSLock>("MCSLock", iterations);
+  return 0;
+}
@@ -0,0 +1,55 @@
+// Example-10:
+// Asynchronous file reads, no worker is blocked while the data is loaded
+
+#include <cstdlib>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+#include "common/mem_check.h"
+
+int main(int, char **) {
+  atexit(mem_report);
+  px_sched::SchedulerParams params;
+  params.mem_callbacks.alloc_fn = mem_check_alloc;
+  params.mem_callbacks.free_fn = mem_check_free;
+  px_sched::Scheduler schd;
+  schd.init(params);
+  printf("Async IO: %s\n", schd.hasAsyncIO()? "io_uring" : "blocking tasks");
+
+  FILE *f = fopen(__FILE__, "rb");
+  if (!f) return 1;
+  fseek(f, 0, SEEK_END);
+  size_t size = static_cast<size_t>(ftell(f));
+  char *data = static_cast<char*>(malloc(size));
+
+  // read the file in 4 chunks, all of them attached to the same sync object
+  const size_t kChunks = 4;
+  int64_t results[kChunks] = {};
+  px_sched::Sync loaded;
+  for(size_t i = 0; i < kChunks; ++i) {
+    size_t begin = i*size/kChunks;
+    size_t end = (i+1)*size/kChunks;
+    schd.readAsync(fileno(f), begin, data+begin, end-begin, &loaded, &results[i]);
+  }
+
+  // process the file once all chunks are loaded
+  size_t lines = 0;
+  int64_t total = 0;
+  px_sched::Sync processed;
+  schd.runAfter(loaded, [&] {
+    for(size_t i = 0; i < kChunks; ++i) total += results[i];
+    for(size_t i = 0; i < size; ++i) {
+      if (data[i] == '\n') lines++;
+    }
+    printf("Processed from %s\n", px_sched::Scheduler::current_thread_name());
+  }, &processed);
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(processed);
+  printf("Waiting for tasks to finish...DONE \n");
+  printf("Read %lld of %zu bytes, %zu lines\n", static_cast<long long>(total), size, lines);
+
+  fclose(f);
+  free(data);
+  schd.stop();
+  return (total == static_cast<int64_t>(size))? 0 : 1;
+}
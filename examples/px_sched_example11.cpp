@@ -0,0 +1,45 @@
+// Example-11:
+// Delayed and periodic tasks, no thread is sleeping while waiting for them
+
+#include <cstdlib>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  px_sched::Scheduler schd;
+  schd.init();
+
+  const uint64_t start = px_sched::Scheduler::now();
+  std::atomic<uint32_t> errors = {0};
+
+  // (a) periodic task, re-armed after each execution until stopped
+  std::atomic<uint32_t> beats = {0};
+  px_sched::Timer heartbeat;
+  schd.runEvery(10000, [&beats, start] {
+    beats.fetch_add(1);
+    printf("Heartbeat at %llums\n",
+      static_cast<unsigned long long>((px_sched::Scheduler::now() - start)/1000));
+  }, &heartbeat);
+
+  // (b) delayed tasks, the sync object is pending until they are executed
+  px_sched::Sync s;
+  const uint64_t delays[] = { 1000, 30000, 150000, 5000, 80000 };
+  for(uint64_t delay : delays) {
+    schd.runAfterDelay(delay, [delay, start, &errors] {
+      uint64_t elapsed = px_sched::Scheduler::now() - start;
+      printf("Task delayed %llums executed at %llums from %s\n",
+        static_cast<unsigned long long>(delay/1000),
+        static_cast<unsigned long long>(elapsed/1000),
+        px_sched::Scheduler::current_thread_name());
+      if (elapsed < delay) errors.fetch_add(1);
+    }, &s);
+  }
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(s);
+  schd.stopTimer(heartbeat);
+  printf("Waiting for tasks to finish...DONE \n");
+  printf("%u heartbeats\n", beats.load());
+
+  return (errors.load() == 0 && beats.load() > 0)? 0 : 1;
+}
@@ -0,0 +1,46 @@
+// Example-12:
+// Cancellation tokens, drop queued work that is no longer needed (i.e. after
+// a camera cut) while keeping the sync objects consistent.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  px_sched::Scheduler schd;
+  schd.init();
+
+  // (a) tasks waiting to be executed are skipped once cancelled
+  std::atomic<uint32_t> streamed = {0};
+  px_sched::CancelToken streaming;
+  px_sched::TaskParams stream_params;
+  stream_params.cancel_token = &streaming;
+
+  px_sched::Sync gate;
+  schd.incrementSync(&gate);
+  px_sched::Sync done;
+  for(size_t i = 0; i < 100; ++i) {
+    schd.runAfter(gate, [&streamed] { streamed.fetch_add(1); }, &done, stream_params);
+  }
+  schd.cancel(streaming); // camera cut!
+  schd.decrementSync(&gate);
+  schd.waitFor(done);
+  printf("Streaming tasks executed %u, skipped %u\n",
+    streamed.load(), schd.num_tasks_cancelled());
+
+  // (b) running tasks can poll the token of the task to finish early
+  px_sched::CancelToken lod;
+  px_sched::TaskParams lod_params;
+  lod_params.cancel_token = &lod;
+  px_sched::Sync lod_done;
+  schd.run([] {
+    uint32_t steps = 0;
+    for(; steps < 100 && !px_sched::Scheduler::isCancelled(); ++steps) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    printf("LOD task stopped after %u steps\n", steps);
+  }, &lod_done, lod_params);
+  schd.run([&schd, lod] { schd.cancel(lod); });
+  schd.waitFor(lod_done);
+
+  return (streamed.load() == 0)? 0 : 1;
+}
@@ -0,0 +1,98 @@
+// Example-13:
+// Scratch memory per frame, allocated from the arena of a sync object and
+// released at once when the sync object is released. Jobs with big captures
+// can also be stored there (runArena).
+
+#include <memory>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+struct CullResult {
+  uint32_t visible;
+  uint32_t checksum;
+};
+
+int main(int, char **) {
+  px_sched::Scheduler schd;
+  schd.init();
+
+  const uint32_t kChunks = 64;
+  const uint32_t kObjects = 1024;
+  uint32_t errors = 0;
+  for(uint32_t frame = 0; frame < 4; ++frame) {
+    // the frame sync object is pending until the end of the frame, results
+    // can be allocated from it and read after the culling tasks finish
+    px_sched::Sync frame_sync;
+    schd.incrementSync(&frame_sync);
+    CullResult *results = static_cast<CullResult*>(
+      schd.arenaAlloc(frame_sync, sizeof(CullResult)*kChunks, alignof(CullResult)));
+
+    px_sched::Sync culled;
+    for(uint32_t i = 0; i < kChunks; ++i) {
+      schd.run([results, i, frame] {
+        // temporary memory of the task, from the arena of its sync object
+        uint32_t *ids = static_cast<uint32_t*>(
+          px_sched::Scheduler::arenaAlloc(sizeof(uint32_t)*kObjects, alignof(uint32_t)));
+        uint32_t visible = 0;
+        for(uint32_t o = 0; o < kObjects; ++o) {
+          if ((o + i + frame) % 3 == 0) ids[visible++] = o;
+        }
+        uint32_t checksum = 0;
+        for(uint32_t v = 0; v < visible; ++v) checksum += ids[v];
+        results[i].visible = visible;
+        results[i].checksum = checksum;
+      }, &culled);
+    }
+    schd.waitFor(culled);
+
+    uint32_t visible = 0;
+    for(uint32_t i = 0; i < kChunks; ++i) {
+      visible += results[i].visible;
+      if (results[i].visible == 0 || results[i].checksum == 0) errors++;
+    }
+    schd.decrementSync(&frame_sync); // end of frame, releases the results
+    printf("Frame %u: %u visible objects, %u arena blocks\n",
+      frame, visible, schd.num_arena_blocks());
+  }
+
+  if (errors) return 1;
+
+  // alternating between two sync objects keeps using the same two blocks
+  uint32_t blocks = schd.num_arena_blocks();
+  px_sched::Sync a, b;
+  schd.incrementSync(&a);
+  schd.incrementSync(&b);
+  for(uint32_t i = 0; i < 1000; ++i) {
+    if (!schd.arenaAlloc(a, 16) || !schd.arenaAlloc(b, 16)) return 2;
+  }
+  printf("Interleaved sync objects: %u new arena blocks\n", schd.num_arena_blocks() - blocks);
+  if (schd.num_arena_blocks() - blocks > 2) return 3;
+  schd.decrementSync(&a);
+  schd.decrementSync(&b);
+
+  // a big capture, copied to the arena and destroyed after it is executed
+  // (or skipped)
+  std::shared_ptr<uint32_t> alive = std::make_shared<uint32_t>(0);
+  struct { uint32_t values[256]; } table;
+  for(uint32_t i = 0; i < 256; ++i) table.values[i] = i;
+  uint32_t sum = 0;
+  px_sched::Sync big;
+  schd.runArena([alive, table, &sum] {
+    for(uint32_t v : table.values) sum += v;
+  }, &big);
+  schd.waitFor(big);
+  if (sum != 255*256/2 || alive.use_count() != 1) return 4;
+
+  px_sched::CancelToken token;
+  px_sched::TaskParams tp;
+  tp.cancel_token = &token;
+  px_sched::Sync cancelled;
+  bool executed = false;
+  schd.run([&schd, &token, &tp, &cancelled, &executed, alive, table] {
+    schd.cancel(token);
+    schd.runArena([alive, table, &executed] { executed = true; }, &cancelled, tp);
+  }, &cancelled, tp);
+  schd.waitFor(cancelled);
+  if (executed || alive.use_count() != 1) return 5;
+  return 0;
+}
@@ -0,0 +1,67 @@
+// Example-14:
+// Fork-join recursive parallelism with SpawnScope (parallel quicksort and
+// a recursive sum), no sync objects are needed for each level.
+
+#include <algorithm>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void quicksort(px_sched::Scheduler *schd, uint32_t *begin, uint32_t *end) {
+  if (end - begin < 2048) {
+    std::sort(begin, end);
+    return;
+  }
+  uint32_t pivot = begin[(end - begin)/2];
+  uint32_t *mid1 = std::partition(begin, end, [pivot](uint32_t v) { return v < pivot; });
+  uint32_t *mid2 = std::partition(mid1, end, [pivot](uint32_t v) { return v == pivot; });
+  px_sched::SpawnScope scope(schd);
+  scope.spawn([schd, begin, mid1] { quicksort(schd, begin, mid1); });
+  quicksort(schd, mid2, end);
+  scope.sync();
+}
+
+static uint64_t sum(px_sched::Scheduler *schd, const uint32_t *begin, const uint32_t *end) {
+  if (end - begin < 4096) {
+    uint64_t result = 0;
+    for(const uint32_t *i = begin; i != end; ++i) result += *i;
+    return result;
+  }
+  const uint32_t *mid = begin + (end - begin)/2;
+  uint64_t left = 0;
+  px_sched::SpawnScope scope(schd);
+  scope.spawn([schd, begin, mid, &left] { left = sum(schd, begin, mid); });
+  uint64_t right = sum(schd, mid, end);
+  scope.sync();
+  return left + right;
+}
+
+int main(int, char **) {
+  px_sched::Scheduler schd;
+  schd.init();
+
+  const size_t kSize = 1 << 20;
+  uint32_t *data = new uint32_t[kSize];
+  uint64_t expected = 0;
+  uint32_t seed = 1234;
+  for(size_t i = 0; i < kSize; ++i) {
+    seed = seed*1664525u + 1013904223u;
+    data[i] = seed >> 8;
+    expected += data[i];
+  }
+
+  // the root is launched as a regular task, nested scopes use the deque of
+  // the worker that executes them
+  uint64_t total = 0;
+  px_sched::Sync done;
+  schd.run([&schd, data, &total] {
+    quicksort(&schd, data, data + kSize);
+    total = sum(&schd, data, data + kSize);
+  }, &done);
+  schd.waitFor(done);
+
+  bool sorted = std::is_sorted(data, data + kSize);
+  printf("Sorted %zu elements: %s, sum %s\n", kSize,
+    sorted? "OK" : "FAILED", (total == expected)? "OK" : "FAILED");
+  delete [] data;
+  return (sorted && total == expected)? 0 : 1;
+}
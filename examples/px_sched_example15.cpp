@@ -0,0 +1,63 @@
+// Example-15:
+// Pipeline with backpressure: read -> decompress -> upload, with only 4
+// buffers in flight. Reading stops until one buffer is uploaded.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  uint16_t io_group = params.addWorkerGroup("IO", 1);
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kTokens = 4;
+  const uint64_t kItems = 32;
+  uint64_t buffers[kTokens] = {}; // one buffer per token
+  std::atomic<uint32_t> in_flight = {0};
+  std::atomic<uint32_t> max_in_flight = {0};
+  uint64_t next_upload = 0;
+  uint32_t errors = 0;
+
+  px_sched::Pipeline pipeline;
+  pipeline.addStage(px_sched::Pipeline::kSerial, [&] {
+    px_sched::Pipeline::Token *token = px_sched::Pipeline::current_token();
+    if (token->sequence == kItems) {
+      token->end = true;
+      return;
+    }
+    uint32_t n = in_flight.fetch_add(1) + 1;
+    uint32_t prev = max_in_flight.load();
+    while (n > prev && !max_in_flight.compare_exchange_weak(prev, n)) {}
+    buffers[token->slot] = token->sequence;
+    printf("Read %llu (slot %u) from %s\n",
+      static_cast<unsigned long long>(token->sequence), token->slot,
+      px_sched::Scheduler::current_thread_name());
+  }, io_group);
+  pipeline.addStage(px_sched::Pipeline::kParallel, [&] {
+    px_sched::Pipeline::Token *token = px_sched::Pipeline::current_token();
+    std::this_thread::sleep_for(std::chrono::microseconds(100*(token->sequence%3)));
+    buffers[token->slot] *= 10;
+  });
+  pipeline.addStage(px_sched::Pipeline::kSerial, [&] {
+    px_sched::Pipeline::Token *token = px_sched::Pipeline::current_token();
+    // serial stages see the tokens in input order
+    if (token->sequence != next_upload || buffers[token->slot] != token->sequence*10) errors++;
+    next_upload++;
+    in_flight.fetch_sub(1);
+    printf("Upload %llu from %s\n",
+      static_cast<unsigned long long>(token->sequence),
+      px_sched::Scheduler::current_thread_name());
+  });
+
+  px_sched::Sync done;
+  pipeline.run(&schd, kTokens, &done);
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(done);
+  printf("Waiting for tasks to finish...DONE \n");
+  printf("Uploaded %llu items, max %u in flight\n",
+    static_cast<unsigned long long>(next_upload), max_in_flight.load());
+
+  return (errors == 0 && next_upload == kItems && max_in_flight.load() <= kTokens)? 0 : 1;
+}
@@ -0,0 +1,58 @@
+// Example-16:
+// Channels: network tasks send messages to the simulation, the consumer is
+// launched as a task when messages arrive (no polling). Producers wait when
+// the channel is full.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+struct Message {
+  uint32_t producer;
+  uint32_t value;
+};
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  uint16_t sim_group = params.addWorkerGroup("Sim", 1);
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kProducers = 4;
+  const uint32_t kMessages = 1000;
+  uint64_t total = 0;
+  uint32_t received = 0;
+  uint32_t consumer_runs = 0;
+  px_sched::Sync consumed;
+  schd.incrementSync(&consumed);
+
+  px_sched::Channel<Message> channel;
+  channel.init(&schd, 64);
+  channel.setConsumer([&] {
+    consumer_runs++;
+    Message msg;
+    while (channel.tryReceive(&msg)) {
+      total += msg.value;
+      if (++received == kProducers*kMessages) schd.decrementSync(&consumed);
+    }
+  }, sim_group);
+
+  px_sched::Sync produced;
+  for(uint32_t p = 0; p < kProducers; ++p) {
+    schd.run([&channel, p] {
+      for(uint32_t i = 0; i < kMessages; ++i) {
+        Message msg = {p, i};
+        channel.send(msg);
+      }
+    }, &produced);
+  }
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(produced);
+  schd.waitFor(consumed);
+  printf("Waiting for tasks to finish...DONE \n");
+  const uint64_t expected = uint64_t(kProducers)*kMessages*(kMessages-1)/2;
+  printf("Received %u messages in %u consumer runs\n", received, consumer_runs);
+
+  return (total == expected)? 0 : 1;
+}
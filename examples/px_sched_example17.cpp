@@ -0,0 +1,84 @@
+// Example-17:
+// Lock contention profiler: tasks share a few locks, the profiler reports
+// which ones make the workers wait (see PX_SCHED_LOCK_PROFILER).
+
+#define PX_SCHED_LOCK_PROFILER 1
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  px_sched::Scheduler schd;
+  schd.init();
+
+  const uint32_t kTasks = 64;
+  const uint32_t kIterations = 200;
+  px_sched::Mutex<std::mutex> shared("Shared");
+  px_sched::TTASLock stats_lock;
+  uint64_t shared_value = 0;
+  uint64_t stats = 0;
+
+  auto launch = [&](px_sched::Sync *done) {
+    for(uint32_t i = 0; i < kTasks; ++i) {
+      schd.run([&] {
+        for(uint32_t n = 0; n < kIterations; ++n) {
+          {
+            // long critical section, most of the task time
+            std::lock_guard<px_sched::Mutex<std::mutex>> l(shared);
+            for(uint32_t k = 0; k < 100; ++k) shared_value += k;
+            if (n % 50 == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+          }
+          std::lock_guard<px_sched::TTASLock> l(stats_lock);
+          stats++;
+        }
+      }, done);
+    }
+  };
+  px_sched::Sync done;
+  launch(&done);
+  schd.waitFor(done);
+
+  char buffer[4096];
+  schd.getDebugStatus(buffer, sizeof(buffer));
+  printf("%s\n", buffer);
+
+  px_sched::LockProfile profile[4];
+  uint32_t num = px_sched::Scheduler::getLockProfile(profile, 4);
+  uint32_t errors = 0;
+  for(uint32_t i = 0; i < num; ++i) {
+    const px_sched::LockProfile &p = profile[i];
+    printf("%-8s adquired %llu, contended %llu, wait %.3f ms (max %.3f ms), hold %.3f ms\n",
+      p.name, static_cast<unsigned long long>(p.acquisitions),
+      static_cast<unsigned long long>(p.contended),
+      static_cast<double>(p.wait_ns)/1e6, static_cast<double>(p.max_wait_ns)/1e6,
+      static_cast<double>(p.hold_ns)/1e6);
+    if (p.acquisitions != kTasks*kIterations) errors++;
+  }
+  if (num != 2 || stats != kTasks*kIterations) errors++;
+
+  // after a reset only the new acquisitions are reported, even with resets
+  // while the locks are in use
+  px_sched::Scheduler::resetLockProfile();
+  if (px_sched::Scheduler::getLockProfile(profile, 4) != 0) errors++;
+  launch(&done);
+  for(uint32_t i = 0; i < 10; ++i) {
+    px_sched::Scheduler::resetLockProfile();
+    std::this_thread::yield();
+  }
+  schd.waitFor(done);
+  num = px_sched::Scheduler::getLockProfile(profile, 4);
+  for(uint32_t i = 0; i < num; ++i) {
+    if (profile[i].acquisitions > kTasks*kIterations) errors++;
+  }
+  px_sched::Scheduler::resetLockProfile();
+  launch(&done);
+  schd.waitFor(done);
+  num = px_sched::Scheduler::getLockProfile(profile, 4);
+  printf("after reset: %u resources, %llu acquisitions\n", num,
+    static_cast<unsigned long long>(num? profile[0].acquisitions : 0));
+  for(uint32_t i = 0; i < num; ++i) {
+    if (profile[i].acquisitions != kTasks*kIterations) errors++;
+  }
+  if (num != 2) errors++;
+
+  return (errors == 0)? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Example-18:
+// Tasks that declare the resources they read and write, the scheduler
+// infers the order (same pattern as example 7, without building it by hand).
+
+#include <cstdlib> // demo: rand
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+struct Data {
+  px_sched::Resource resource;
+  uint32_t version = 0;           // number of writes applied
+  std::atomic<int32_t> readers = {0};
+  std::atomic<int32_t> writers = {0};
+};
+
+int main(int, char **) {
+  px_sched::Scheduler schd;
+  schd.init();
+
+  Data positions, bounds;
+  std::atomic<uint32_t> errors = {0};
+  uint32_t positions_writes = 0;
+  uint32_t bounds_writes = 0;
+
+  px_sched::Sync done;
+  for(uint32_t i = 0; i < 1000; ++i) {
+    int op = std::rand() % 4;
+    if (op == 0) {
+      // update positions, version must follow the order of submission
+      uint32_t expected = positions_writes++;
+      schd.run([&positions, &errors, expected] {
+        if (positions.writers.fetch_add(1) != 0 || positions.readers.load() != 0) errors++;
+        if (positions.version != expected) errors++;
+        positions.version++;
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        positions.writers.fetch_sub(1);
+      }, {px_sched::write(positions.resource)}, &done);
+    } else {
+      // read positions (and sometimes compute the bounds from them)
+      bool write_bounds = (op == 1);
+      uint32_t expected = positions_writes;
+      uint32_t expected_bounds = write_bounds? bounds_writes++ : 0;
+      auto job = [&positions, &bounds, &errors, expected, expected_bounds, write_bounds] {
+        positions.readers.fetch_add(1);
+        if (positions.writers.load() != 0 || positions.version != expected) errors++;
+        if (write_bounds) {
+          if (bounds.writers.fetch_add(1) != 0 || bounds.version != expected_bounds) errors++;
+          bounds.version++;
+          bounds.writers.fetch_sub(1);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        positions.readers.fetch_sub(1);
+      };
+      if (write_bounds) {
+        schd.run(job, {px_sched::read(positions.resource), px_sched::write(bounds.resource)}, &done);
+      } else {
+        schd.run(job, {px_sched::read(positions.resource)}, &done);
+      }
+    }
+  }
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(done);
+  printf("Waiting for tasks to finish...DONE \n");
+  printf("positions: %u writes, bounds: %u writes, %u errors\n",
+    positions.version, bounds.version, errors.load());
+
+  bool ok = errors.load() == 0 && positions.version == positions_writes &&
+            bounds.version == bounds_writes;
+  return ok? 0 : 1;
+}
@@ -0,0 +1,77 @@
+// Example-19:
+// Fair share between subsystems: a burst of analytics tasks is queued
+// before the simulation tasks, the simulation (weight 3) still gets most of
+// the CPU time, and analytics never runs more than 2 tasks at once.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void busy(uint32_t microseconds) {
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_number_tasks = 2048;
+  uint16_t sim = params.addShareGroup("Simulation", 3);
+  uint16_t analytics = params.addShareGroup("Analytics", 1, 2);
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kTasks = 300;
+  std::atomic<uint32_t> analytics_done = {0};
+  std::atomic<uint32_t> analytics_running = {0};
+  std::atomic<uint32_t> analytics_max_running = {0};
+  uint32_t analytics_done_at_sim_end = 0;
+  std::atomic<uint32_t> sim_done = {0};
+
+  px_sched::TaskParams analytics_params;
+  analytics_params.share_group = analytics;
+  px_sched::TaskParams sim_params;
+  sim_params.share_group = sim;
+
+  // all tasks are queued at once when the gate is released (tasks waiting
+  // for a sync object are queued in reverse order, analytics goes first)
+  px_sched::Sync gate;
+  schd.incrementSync(&gate);
+  px_sched::Sync done;
+  for(uint32_t i = 0; i < kTasks; ++i) {
+    schd.runAfter(gate, [&] {
+      busy(200);
+      if (sim_done.fetch_add(1) + 1 == kTasks) analytics_done_at_sim_end = analytics_done.load();
+    }, &done, sim_params);
+  }
+  for(uint32_t i = 0; i < kTasks; ++i) {
+    schd.runAfter(gate, [&] {
+      uint32_t n = analytics_running.fetch_add(1) + 1;
+      uint32_t prev = analytics_max_running.load();
+      while (n > prev && !analytics_max_running.compare_exchange_weak(prev, n)) {}
+      busy(200);
+      analytics_running.fetch_sub(1);
+      analytics_done.fetch_add(1);
+    }, &done, analytics_params);
+  }
+  schd.decrementSync(&gate);
+  schd.waitFor(done);
+
+  px_sched::ShareGroupStats sim_stats, analytics_stats;
+  schd.getShareGroupStats(sim, &sim_stats);
+  schd.getShareGroupStats(analytics, &analytics_stats);
+  printf("Simulation: %llu tasks %llu us, Analytics: %llu tasks %llu us\n",
+    static_cast<unsigned long long>(sim_stats.tasks_executed),
+    static_cast<unsigned long long>(sim_stats.cpu_time_ns/1000),
+    static_cast<unsigned long long>(analytics_stats.tasks_executed),
+    static_cast<unsigned long long>(analytics_stats.cpu_time_ns/1000));
+  printf("Analytics tasks done when simulation finished: %u (max %u running)\n",
+    analytics_done_at_sim_end, analytics_max_running.load());
+
+  bool ok = sim_stats.tasks_executed == kTasks && analytics_stats.tasks_executed == kTasks &&
+            analytics_max_running.load() <= 2;
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  // with a FIFO queue all the analytics tasks would finish first
+  ok = ok && analytics_done_at_sim_end < kTasks/2;
+#endif
+  return ok? 0 : 1;
+}
@@ -0,0 +1,97 @@
+// Example-20:
+// Deadlines: a frame critical chain (animation -> skinning -> submit) must
+// finish within 8ms, it is queued after a burst of bulk work. Only the last
+// task has a deadline, runAfter propagates it to the tasks it waits for, so
+// the whole chain runs ahead of the bulk work. Misses report the chain of
+// tasks that made them late.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void busy(uint32_t microseconds) {
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_number_tasks = 1024;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kBulkTasks = 400;
+  std::atomic<uint32_t> bulk_done = {0};
+  uint32_t bulk_done_at_submit = 0;
+
+  // everything is queued at once when the gate is released
+  px_sched::Sync gate;
+  schd.incrementSync(&gate);
+  px_sched::Sync done;
+  for(uint32_t i = 0; i < kBulkTasks; ++i) {
+    schd.runAfter(gate, [&] { busy(100); bulk_done.fetch_add(1); }, &done);
+  }
+
+  const uint64_t frame_start = px_sched::Scheduler::now();
+  px_sched::Sync animation, skinning;
+  schd.runAfter(gate, [] { busy(500); }, &animation);
+  schd.runAfter(animation, [] { busy(500); }, &skinning);
+  px_sched::TaskParams submit;
+  submit.deadline = frame_start + 8000;
+  submit.name = "Submit";
+  schd.runAfter(skinning, [&] {
+    bulk_done_at_submit = bulk_done.load();
+  }, &done, submit);
+
+  schd.decrementSync(&gate);
+  schd.waitFor(done);
+
+  // a task that can't make it, reported as a deadline miss
+  px_sched::TaskParams late;
+  late.deadline = px_sched::Scheduler::now() + 1000;
+  late.name = "Late";
+  px_sched::Sync late_done;
+  schd.run([] { busy(3000); }, &late_done, late);
+  schd.waitFor(late_done);
+
+  // a task that is ready too late, because of the tasks it waits for
+  px_sched::TaskParams decode, upload, present;
+  decode.name = "Decode";
+  upload.name = "Upload";
+  present.name = "Present";
+  px_sched::Sync chain_gate, decoded, uploaded, presented;
+  schd.incrementSync(&chain_gate);
+  schd.runAfter(chain_gate, [] { busy(3000); }, &decoded, decode);
+  schd.runAfter(decoded, [] { busy(100); }, &uploaded, upload);
+  present.deadline = px_sched::Scheduler::now() + 1000;
+  schd.runAfter(uploaded, [] {}, &presented, present);
+  schd.decrementSync(&chain_gate);
+  schd.waitFor(presented);
+
+  printf("Bulk tasks done when the frame was submitted: %u of %u\n", bulk_done_at_submit, kBulkTasks);
+  px_sched::DeadlineMiss misses[4];
+  uint32_t num_misses = schd.getDeadlineMisses(misses, 4);
+  for(uint32_t i = 0; i < num_misses; ++i) {
+    printf("Missed deadline: %s (cause %d), %llu us late\n", misses[i].name, misses[i].cause,
+      static_cast<unsigned long long>(misses[i].finish_time - misses[i].deadline));
+    for(uint32_t j = 0; j < misses[i].num_upstream; ++j) {
+      printf("  after %s\n", misses[i].upstream[j].name);
+    }
+  }
+
+  // most recent first, the tasks before Present miss the deadline too
+  bool ok = num_misses == 4 &&
+    strcmp(misses[0].name, "Present") == 0 && misses[0].cause == px_sched::DeadlineMiss::kReadyLate &&
+    misses[0].num_upstream == 2 &&
+    strcmp(misses[0].upstream[0].name, "Upload") == 0 &&
+    strcmp(misses[0].upstream[1].name, "Decode") == 0 &&
+    strcmp(misses[1].name, "Upload") == 0 && misses[1].num_upstream == 1 &&
+    strcmp(misses[1].upstream[0].name, "Decode") == 0 &&
+    strcmp(misses[2].name, "Decode") == 0 && misses[2].cause == px_sched::DeadlineMiss::kRanLong &&
+    strcmp(misses[3].name, "Late") == 0 && misses[3].cause == px_sched::DeadlineMiss::kRanLong &&
+    misses[3].num_upstream == 0;
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  ok = ok && bulk_done_at_submit < kBulkTasks/4;
+#endif
+  return ok? 0 : 1;
+}
@@ -0,0 +1,52 @@
+// Example-21:
+// Limiter: decompression tasks need a big scratch buffer, only 2 can run at
+// the same time. Excess tasks wait inside the limiter (no worker blocks), so
+// the rest of the work keeps all the workers busy meanwhile.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kMaxDecompressors = 2;
+  const uint32_t kFiles = 32;
+  px_sched::Limiter decompressors(kMaxDecompressors);
+  static char scratch[kMaxDecompressors][64*1024];
+  std::atomic<uint32_t> slots = {0}; // bit per scratch buffer in use
+  std::atomic<uint32_t> errors = {0};
+  std::atomic<uint32_t> decompressed = {0};
+  std::atomic<uint32_t> other_work = {0};
+
+  px_sched::TaskParams limited;
+  limited.limiter = &decompressors;
+  px_sched::Sync done;
+  for(uint32_t i = 0; i < kFiles; ++i) {
+    schd.run([&, i] {
+      // take a free scratch buffer, there is always one
+      uint32_t slot = 0;
+      while (slot < kMaxDecompressors && (slots.fetch_or(1u << slot) & (1u << slot))) slot++;
+      if (slot == kMaxDecompressors) {
+        errors++;
+        return;
+      }
+      for(uint32_t n = 0; n < sizeof(scratch[slot]); ++n) scratch[slot][n] = static_cast<char>(n + i);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      slots.fetch_and(~(1u << slot));
+      decompressed++;
+    }, &done, limited);
+    schd.run([&] { other_work++; }, &done);
+  }
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(done);
+  printf("Waiting for tasks to finish...DONE \n");
+  printf("%u files decompressed, %u other tasks, %u errors\n",
+    decompressed.load(), other_work.load(), errors.load());
+
+  bool ok = errors.load() == 0 && decompressed.load() == kFiles && other_work.load() == kFiles &&
+            decompressors.running_tasks() == 0 && decompressors.waiting_tasks() == 0;
+  return ok? 0 : 1;
+}
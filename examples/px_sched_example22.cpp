@@ -0,0 +1,84 @@
+// Example-22:
+// Teams: a Jacobi solver executed by a team of workers that synchronize with
+// a barrier each iteration (one launch instead of a task wave + waitFor per
+// iteration), and a Latch to wait for a group of tasks.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static const uint32_t kCells = 1024;
+static const uint32_t kIterations = 200;
+
+// reference solution, executed by a single thread
+static void solve(float *a, float *b) {
+  for(uint32_t it = 0; it < kIterations; ++it) {
+    for(uint32_t i = 1; i < kCells-1; ++i) b[i] = (a[i-1] + a[i] + a[i+1])/3.0f;
+    for(uint32_t i = 1; i < kCells-1; ++i) a[i] = b[i];
+  }
+}
+
+static void init(float *a, float *b) {
+  for(uint32_t i = 0; i < kCells; ++i) a[i] = b[i] = static_cast<float>(i%7);
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_running_threads = 4; // team members must run at the same time
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  static float ref_a[kCells], ref_b[kCells];
+  init(ref_a, ref_b);
+  solve(ref_a, ref_b);
+
+  static float a[kCells], b[kCells];
+  init(a, b);
+  std::atomic<uint32_t> barriers = {0};
+  px_sched::Sync solved;
+  uint32_t team_size = schd.runTeam(4, [&] {
+    px_sched::Team *team = px_sched::Team::current();
+    const uint32_t chunk = (kCells + team->size() - 1)/team->size();
+    uint32_t begin = team->index()*chunk;
+    uint32_t end = begin + chunk;
+    if (begin < 1) begin = 1;
+    if (end > kCells-1) end = kCells-1;
+    for(uint32_t it = 0; it < kIterations; ++it) {
+      for(uint32_t i = begin; i < end; ++i) b[i] = (a[i-1] + a[i] + a[i+1])/3.0f;
+      team->barrier();
+      for(uint32_t i = begin; i < end; ++i) a[i] = b[i];
+      team->barrier();
+      if (team->index() == 0) barriers++;
+    }
+  }, &solved);
+
+  // teams that don't fit wait for the running ones
+  std::atomic<uint32_t> members_run = {0};
+  px_sched::Sync others;
+  for(uint32_t t = 0; t < 3; ++t) {
+    schd.runTeam(4, [&] {
+      px_sched::Team *team = px_sched::Team::current();
+      team->barrier();
+      members_run++;
+    }, &others);
+  }
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(solved);
+  schd.waitFor(others);
+
+  px_sched::Latch loaded(8);
+  for(uint32_t i = 0; i < 8; ++i) schd.run([&] { loaded.countDown(); });
+  loaded.wait();
+  printf("Waiting for tasks to finish...DONE \n");
+
+  uint32_t errors = 0;
+  for(uint32_t i = 0; i < kCells; ++i) {
+    if (a[i] != ref_a[i]) errors++;
+  }
+  printf("Team of %u, %u iterations, %u other members, %u errors\n",
+    team_size, barriers.load(), members_run.load(), errors);
+
+  return (errors == 0 && barriers.load() == kIterations &&
+          members_run.load() == 3*team_size && loaded.tryWait())? 0 : 1;
+}
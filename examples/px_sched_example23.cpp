@@ -0,0 +1,56 @@
+// Example-23:
+// Pool pressure: a burst of tasks bigger than the pool of tasks. Instead of
+// aborting, the main thread waits until tasks are released, and producers
+// running on workers execute ready tasks meanwhile.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void work() {
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_number_tasks = 64; // small pools on purpose
+  params.pool_exhausted_policy = px_sched::SchedulerParams::kPoolWait;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kBurst = 2000;
+  const uint32_t kProducers = 4;
+  const uint32_t kChildren = 500;
+  std::atomic<uint32_t> executed = {0};
+
+  px_sched::Sync done;
+  // producers on workers
+  for(uint32_t p = 0; p < kProducers; ++p) {
+    schd.run([&] {
+      px_sched::Sync children;
+      for(uint32_t i = 0; i < kChildren; ++i) {
+        schd.run([&] { work(); executed++; }, &children);
+      }
+      schd.runAfter(children, [&] { executed++; }, &done);
+    }, &done);
+  }
+  // burst from the main thread
+  for(uint32_t i = 0; i < kBurst; ++i) {
+    schd.run([&] { work(); executed++; }, &done);
+  }
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(done);
+  printf("Waiting for tasks to finish...DONE \n");
+  const uint32_t expected = kBurst + kProducers*(kChildren + 1);
+  printf("%u/%u tasks executed, pool full %u times (tasks), %u times (sync objects)\n",
+    executed.load(), expected, schd.num_task_pool_waits(), schd.num_sync_pool_waits());
+
+  bool ok = executed.load() == expected;
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  // without threads tasks are executed right away, the pool never fills up
+  ok = ok && schd.num_task_pool_waits() > 0;
+#endif
+  return ok? 0 : 1;
+}
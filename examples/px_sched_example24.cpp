@@ -0,0 +1,66 @@
+// Example-24:
+// Live snapshot: the scheduler publishes its state to a shared file, read
+// here as another process would do (see px_sched_top) to find the worker
+// that is stuck in a long task.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  const char *path = "/tmp/px_sched_example24.snapshot";
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.snapshot_path = path;
+  params.snapshot_period_in_microseconds = 1000;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  px_sched::Sync done;
+  std::atomic<bool> release = {false};
+  px_sched::TaskParams tp;
+  tp.name = "Stall";
+#ifdef PX_SCHED_CONFIG_SINGLE_THREAD
+  release = true; // without threads run executes the task right away
+#endif
+  schd.run([&] {
+    while (!release.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }, &done, tp);
+  schd.publishSnapshot();
+
+  const px_sched::Snapshot *snapshot = px_sched::Snapshot::map(path);
+  if (!snapshot) {
+    printf("ERROR: snapshot not available\n");
+    release = true;
+    schd.waitFor(done);
+    return 1;
+  }
+  px_sched::Snapshot::Data data;
+  bool found = false;
+  uint32_t tasks_in_use = 0;
+  for(uint32_t tries = 0; tries < 2000 && !found; ++tries) {
+    if (!px_sched::Snapshot::read(snapshot, &data)) continue;
+    tasks_in_use = data.tasks_in_use;
+#ifdef PX_SCHED_CONFIG_SINGLE_THREAD
+    // the task was executed by run, there are no workers to show
+    found = data.num_workers == 0 && data.max_tasks == params.max_number_tasks;
+#else
+    for(uint32_t i = 0; i < data.num_workers; ++i) {
+      const px_sched::Snapshot::Worker &w = data.workers[i];
+      if (w.state == px_sched::Snapshot::kRunning && strcmp(w.task, "Stall") == 0) {
+        printf("%s is running %s\n", w.name, w.task);
+        found = true;
+      }
+    }
+#endif
+    if (!found) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  release = true;
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(done);
+  printf("Waiting for tasks to finish...DONE \n");
+  printf("Snapshot: %u tasks in use, stalled worker %s\n", tasks_in_use, found? "found" : "not found");
+  px_sched::Snapshot::unmap(snapshot);
+  schd.stop();
+  remove(path);
+  return found? 0 : 1;
+}
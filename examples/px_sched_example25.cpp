@@ -0,0 +1,101 @@
+// Example-25:
+// Trace analysis: records the task graph of a frame, finds its critical path
+// and exports it (DOT and HTML), then analyzes it again from a saved trace
+// as an offline tool would do (see px_sched_trace_report).
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+#define PX_SCHED_TRACE_IMPLEMENTATION 1
+#include "../px_sched_trace.h"
+
+static px_sched::TaskParams named(const char *name) {
+  px_sched::TaskParams tp;
+  tp.name = name;
+  return tp;
+}
+
+static void work(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// position in the trace of the event of the task with the given name (events
+// are stored in the order they happened), -1 if not found
+static int32_t eventPos(const px_sched::TraceEvent *events, uint32_t num_events,
+                        const char *name, px_sched::TraceEvent::Type type) {
+  uint32_t task = 0;
+  for(uint32_t i = 0; i < num_events; ++i) {
+    const px_sched::TraceEvent &e = events[i];
+    if (e.type == px_sched::TraceEvent::kCreate && e.name && strcmp(e.name, name) == 0) task = e.task;
+    if (task && e.task == task && e.type == type) return static_cast<int32_t>(i);
+  }
+  return -1;
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_running_threads = 4;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  schd.startTrace(1024);
+  // the frame starts once it is fully built
+  px_sched::Sync frame;
+  schd.incrementSync(&frame);
+  px_sched::Sync input, simulation, render;
+  schd.runAfter(frame, [] { work(4); }, &input, named("Input"));
+  schd.runAfter(input, [] { work(2); }, &simulation, named("Animation"));
+  schd.runAfter(input, [] { work(2); }, &simulation, named("Physics"));
+  schd.runAfter(input, [] { work(2); }, &simulation, named("Audio"));
+  schd.runAfter(simulation, [] { work(6); }, &render, named("Render"));
+  schd.decrementSync(&frame);
+  schd.waitFor(render);
+  schd.stopTrace();
+
+  uint32_t num_events = 0;
+  const px_sched::TraceEvent *events = schd.traceEvents(&num_events);
+
+  // only the order of the events is checked, their times depend on the machine
+  uint32_t count[px_sched::TraceEvent::kEnd+1] = {};
+  for(uint32_t i = 0; i < num_events; ++i) count[events[i].type]++;
+  for(uint32_t type = px_sched::TraceEvent::kReady; type <= px_sched::TraceEvent::kEnd; ++type) {
+    if (count[type] != 5) return 10;
+  }
+  const char *names[] = {"Input", "Animation", "Physics", "Audio", "Render"};
+  for(const char *name : names) {
+    int32_t ready = eventPos(events, num_events, name, px_sched::TraceEvent::kReady);
+    int32_t start = eventPos(events, num_events, name, px_sched::TraceEvent::kStart);
+    int32_t end = eventPos(events, num_events, name, px_sched::TraceEvent::kEnd);
+    if (ready < 0 || !(ready < start && start < end)) return 11;
+  }
+  for(uint32_t i = 1; i < 4; ++i) {
+    if (eventPos(events, num_events, names[i], px_sched::TraceEvent::kReady) <
+        eventPos(events, num_events, "Input", px_sched::TraceEvent::kEnd)) return 12;
+    if (eventPos(events, num_events, "Render", px_sched::TraceEvent::kReady) <
+        eventPos(events, num_events, names[i], px_sched::TraceEvent::kEnd)) return 13;
+  }
+
+  px_sched::TraceAnalysis analysis;
+  analysis.analyze(events, num_events);
+  analysis.printReport(stdout);
+
+  const std::vector<uint32_t> &path = analysis.criticalPath();
+  const std::vector<px_sched::TraceAnalysis::Task> &tasks = analysis.tasks();
+  const px_sched::TraceAnalysis::Report &report = analysis.report();
+  if (report.num_tasks != 5 || path.size() != 3) return 1;
+  if (tasks[path.front()].name != "Input" || tasks[path.back()].name != "Render") return 2;
+
+  if (!analysis.exportDot("/tmp/px_sched_example25.dot")) return 5;
+  if (!analysis.exportHtml("/tmp/px_sched_example25.html")) return 6;
+
+  const char *trace_path = "/tmp/px_sched_example25.trace";
+  if (!px_sched::TraceAnalysis::save(trace_path, events, num_events)) return 7;
+  px_sched::TraceAnalysis offline;
+  if (!offline.load(trace_path)) return 8;
+  if (offline.report().num_tasks != report.num_tasks ||
+      offline.report().makespan_ns != report.makespan_ns ||
+      offline.criticalPath().size() != path.size()) {
+    return 9;
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+// Example-26:
+// Simulator: predicts how a fork-join graph scales from 1 to 64 cores and
+// the effect of capping a share group, then replays a recorded frame on a
+// virtual 64-core machine.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+#define PX_SCHED_TRACE_IMPLEMENTATION 1
+#include "../px_sched_trace.h"
+#define PX_SCHED_SIM_IMPLEMENTATION 1
+#include "../px_sched_sim.h"
+
+static const uint64_t kMs = 1000000;
+
+static px_sched::Simulator::Params machine(uint16_t cores) {
+  px_sched::Simulator::Params params;
+  params.scheduler.num_threads = cores;
+  params.num_cores = cores;
+  return params;
+}
+
+static px_sched::TaskParams named(const char *name) {
+  px_sched::TaskParams tp;
+  tp.name = name;
+  return tp;
+}
+
+int main(int, char **) {
+  // fork-join: 64 tasks of 1ms between two of 1ms
+  px_sched::Simulator sim;
+  px_sched::Simulator::Task task;
+  task.cost_ns = kMs;
+  task.name = "Fork";
+  const uint32_t fork = sim.addTask(task);
+  px_sched::Simulator::Task join;
+  join.cost_ns = kMs;
+  join.name = "Join";
+  task.name = "Work";
+  task.preds.push_back(fork);
+  for(uint32_t i = 0; i < 64; ++i) join.preds.push_back(sim.addTask(task));
+  sim.addTask(join);
+
+  uint64_t prev = UINT64_MAX;
+  for(uint16_t cores = 1; cores <= 64; cores *= 4) {
+    px_sched::Simulator::Result r = sim.run(machine(cores));
+    px_sched::Simulator::printResult(stdout, r);
+    if (r.tasks_executed != 66 || r.makespan_ns >= prev || r.utilisation > 1.0) return 1;
+    if (r.makespan_ns != sim.run(machine(cores)).makespan_ns) return 2; // deterministic
+    prev = r.makespan_ns;
+  }
+  if (prev > 4*kMs) return 3;
+
+  // the same graph with the work capped to one task at a time
+  px_sched::Simulator::Params capped = machine(16);
+  uint16_t background = capped.scheduler.addShareGroup("Background", 1, 1);
+  for(uint32_t i = 0; i < sim.numTasks(); ++i) sim.task(i).share_group = background;
+  px_sched::Simulator::Result r = sim.run(capped);
+  px_sched::Simulator::printResult(stdout, r);
+  if (r.makespan_ns < 66*kMs) return 4;
+
+  // replay of a recorded frame on 64 cores
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  px_sched::Scheduler schd;
+  schd.init(params);
+  schd.startTrace(1024);
+  px_sched::Sync frame, input, simulation, render;
+  schd.incrementSync(&frame);
+  schd.runAfter(frame, [] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }, &input, named("Input"));
+  for(uint32_t i = 0; i < 8; ++i) {
+    schd.runAfter(input, [] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }, &simulation, named("Simulation"));
+  }
+  schd.runAfter(simulation, [] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }, &render, named("Render"));
+  schd.decrementSync(&frame);
+  schd.waitFor(render);
+  schd.stopTrace();
+  uint32_t num_events = 0;
+  const px_sched::TraceEvent *events = schd.traceEvents(&num_events);
+  px_sched::TraceAnalysis analysis;
+  analysis.analyze(events, num_events);
+
+  px_sched::Simulator replay;
+  replay.addTrace(analysis);
+  r = replay.run(machine(64));
+  px_sched::Simulator::printResult(stdout, r);
+  const uint64_t ideal = analysis.report().ideal_path_ns;
+  if (r.tasks_executed != 10 || r.makespan_ns < ideal || r.makespan_ns > ideal + kMs) return 5;
+  return 0;
+}
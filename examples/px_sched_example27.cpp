@@ -0,0 +1,57 @@
+// Example-27:
+// Long chains of tasks, each one launching the next. Without threads the
+// ready tasks are queued, so the chain doesn't grow the stack, and with
+// manual_pump the main loop decides when tasks are executed (pump).
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+struct Chain {
+  px_sched::Scheduler *schd;
+  px_sched::Sync sync;
+  uint32_t left;
+  uintptr_t stack_top;
+  uintptr_t stack_bottom;
+};
+
+static void step(Chain *chain) {
+  char marker;
+  uintptr_t stack = reinterpret_cast<uintptr_t>(&marker);
+  if (!chain->stack_top) chain->stack_top = stack;
+  if (stack < chain->stack_bottom) chain->stack_bottom = stack;
+  if (--chain->left) chain->schd->run([chain] { step(chain); }, &chain->sync);
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 2;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  const uint32_t kSteps = 200000;
+  Chain chain = {&schd, px_sched::Sync(), kSteps, 0, UINTPTR_MAX};
+  schd.run([&chain] { step(&chain); }, &chain.sync);
+  schd.waitFor(chain.sync);
+  printf("Chain of %u tasks done\n", kSteps);
+  if (chain.left != 0) return 1;
+#ifdef PX_SCHED_CONFIG_SINGLE_THREAD
+  // every step was executed from the same frame
+  printf("Stack used by the chain: %zu bytes\n", static_cast<size_t>(chain.stack_top - chain.stack_bottom));
+  if (chain.stack_top - chain.stack_bottom > 4096) return 2;
+
+  // tasks are only executed when the main loop pumps them
+  params.manual_pump = true;
+  schd.init(params);
+  uint32_t executed = 0;
+  px_sched::Sync frame;
+  for(uint32_t i = 0; i < 10; ++i) schd.run([&executed] { executed++; }, &frame);
+  if (executed != 0 || schd.num_tasks_ready() != 10) return 3;
+  if (schd.pump(3) != 3 || executed != 3) return 4;
+  if (schd.runUntilIdle() != 7 || executed != 10) return 5;
+  // waitFor pumps until the sync object is released
+  for(uint32_t i = 0; i < 10; ++i) schd.run([&executed] { executed++; }, &frame);
+  schd.waitFor(frame);
+  if (executed != 20) return 6;
+#endif
+  return 0;
+}
@@ -0,0 +1,68 @@
+// Example-28:
+// WorkerLocal: tasks accumulate statistics and collect values in a per
+// worker instance (no atomics or locks), merged once the tasks are done.
+
+#include <vector>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+struct Stats {
+  uint64_t sum = 0;
+  uint32_t count = 0;
+  uint32_t max = 0;
+};
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  px_sched::WorkerLocal<Stats> stats;
+  stats.init(&schd);
+  px_sched::WorkerLocal<std::vector<uint32_t>> multiples; // of 1000
+  multiples.init(&schd);
+
+  const uint32_t kTasks = 64;
+  const uint32_t kValues = 10000;
+  px_sched::Sync done;
+  for(uint32_t t = 0; t < kTasks; ++t) {
+    schd.run([&stats, &multiples, t] {
+      Stats &s = stats.local();
+      std::vector<uint32_t> &m = multiples.local();
+      for(uint32_t i = 0; i < kValues; ++i) {
+        uint32_t value = t*kValues + i;
+        s.sum += value;
+        s.count++;
+        if (value > s.max) s.max = value;
+        if (value % 1000 == 0) m.push_back(value);
+      }
+    }, &done);
+  }
+  // the main thread has its own instance
+  stats.local().count++;
+  schd.waitFor(done);
+
+  Stats total = stats.combine([](const Stats &a, const Stats &b) {
+    Stats r;
+    r.sum = a.sum + b.sum;
+    r.count = a.count + b.count;
+    r.max = (a.max > b.max)? a.max : b.max;
+    return r;
+  });
+  uint32_t instances = 0;
+  size_t num_multiples = 0;
+  multiples.forEach([&](std::vector<uint32_t> &m) {
+    instances++;
+    num_multiples += m.size();
+  });
+  printf("sum %llu, count %u, max %u, %zu multiples of 1000 in %u instances\n",
+    static_cast<unsigned long long>(total.sum), total.count, total.max, num_multiples, instances);
+
+  const uint64_t n = uint64_t(kTasks)*kValues;
+  if (total.sum != n*(n-1)/2 || total.count != n + 1 || total.max != n - 1) return 1;
+  if (num_multiples != n/1000 || instances == 0) return 2;
+  stats.clear();
+  if (stats.combine([](const Stats &a, const Stats &) { return a; }).count != 0) return 3;
+  return 0;
+}
@@ -0,0 +1,60 @@
+// Example-29:
+// Latency mode: low latency tasks are started by a spinning thread while it
+// is idle, and by the regular workers when it is busy.
+
+#include <string.h>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static bool runOn(px_sched::Scheduler *schd, const char *prefix) {
+  const char *name = nullptr;
+  px_sched::Sync s;
+  px_sched::TaskParams tp;
+  tp.low_latency = true;
+  schd->run([&name] { name = px_sched::Scheduler::current_thread_name(); }, &s, tp);
+  schd->waitFor(s);
+  printf("low latency task executed by %s\n", name? name : "(main thread)");
+  return name && strncmp(name, prefix, strlen(prefix)) == 0;
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 2;
+  uint16_t latency = params.addLatencyGroup("Latency", 1);
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  uint32_t executed = 0;
+  px_sched::Sync s;
+  for(uint32_t i = 0; i < 100; ++i) {
+    px_sched::TaskParams tp;
+    tp.low_latency = true;
+    schd.run([&executed] { executed++; }, &s, tp);
+    schd.waitFor(s);
+  }
+  if (executed != 100) return 1;
+
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  // idle, the spinning thread takes it (it might be finishing the last one)
+  bool spinner = false;
+  for(uint32_t tries = 0; tries < 100 && !spinner; ++tries) spinner = runOn(&schd, "Latency");
+  if (!spinner) return 2;
+
+  // busy, the task goes to its own group
+  std::atomic<bool> release = {false};
+  std::atomic<bool> started = {false};
+  px_sched::Sync blocker;
+  schd.run([&] {
+    started = true;
+    while (!release.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }, &blocker, latency);
+  while (!started.load()) std::this_thread::yield();
+  bool worker = runOn(&schd, "Worker");
+  release = true;
+  schd.waitFor(blocker);
+  if (!worker) return 3;
+#else
+  (void)latency;
+#endif
+  return 0;
+}
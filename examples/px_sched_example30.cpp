@@ -0,0 +1,118 @@
+// Example-30:
+// Hybrid CPUs: heavy tasks are executed by workers on performance cores and
+// background tasks by workers on efficiency cores. The capacities are given
+// (two performance and two efficiency cpus) so it works on any machine, see
+// getPlacementStats for the result.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void printPlacement(const px_sched::PlacementStats &stats) {
+  static const char *kClasses[] = {"performance", "efficiency"};
+  static const char *kCosts[] = {"normal", "heavy", "background"};
+  for(uint32_t c = 0; c < px_sched::PlacementStats::kNumCoreClasses; ++c) {
+    printf("%-12s (%u workers):", kClasses[c], stats.workers[c]);
+    for(uint32_t cost = 0; cost < px_sched::TaskParams::kNumCosts; ++cost) {
+      printf(" %s %llu", kCosts[cost], static_cast<unsigned long long>(stats.tasks[c][cost]));
+    }
+    printf("\n");
+  }
+}
+
+static void runOne(px_sched::Scheduler *schd, px_sched::TaskParams::Cost cost) {
+  px_sched::Sync s;
+  px_sched::TaskParams tp;
+  tp.cost = cost;
+  schd->run([] { std::this_thread::sleep_for(std::chrono::microseconds(100)); }, &s, tp);
+  schd->waitFor(s);
+}
+
+int main(int, char **) {
+  uint32_t detected[PX_SCHED_MAX_CPUS];
+  uint32_t num_detected = px_sched::Scheduler::detectCpuCapacities(detected, PX_SCHED_MAX_CPUS);
+  printf("cpu capacities of this machine:");
+  for(uint32_t i = 0; i < num_detected; ++i) printf(" %u", detected[i]);
+  printf("%s\n", num_detected? "" : " unknown");
+
+  const uint32_t capacities[] = {1024, 1024, 400, 400};
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_running_threads = 4;
+  params.core_aware = true;
+  params.cpu_capacities = capacities;
+  params.num_cpus = 4;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  px_sched::PlacementStats stats;
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  schd.getPlacementStats(&stats);
+  if (!stats.hybrid || stats.workers[0] != 2 || stats.workers[1] != 2) return 1;
+
+  // one at a time, the workers of the class are idle and take them
+  const uint32_t kTasks = 50;
+  for(uint32_t i = 0; i < kTasks; ++i) {
+    runOne(&schd, px_sched::TaskParams::kHeavy);
+    runOne(&schd, px_sched::TaskParams::kBackground);
+  }
+  schd.getPlacementStats(&stats);
+  printPlacement(stats);
+  using px_sched::PlacementStats;
+  if (stats.tasks[PlacementStats::kPerformance][px_sched::TaskParams::kHeavy] < kTasks/2) return 2;
+  if (stats.tasks[PlacementStats::kEfficiency][px_sched::TaskParams::kBackground] < kTasks/2) return 3;
+
+  // more heavy tasks than performance workers, the rest help
+  px_sched::Sync burst;
+  px_sched::TaskParams heavy;
+  heavy.cost = px_sched::TaskParams::kHeavy;
+  std::atomic<uint32_t> executed = {0};
+  for(uint32_t i = 0; i < 32; ++i) {
+    schd.run([&executed] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      executed.fetch_add(1);
+    }, &burst, heavy);
+  }
+  schd.waitFor(burst);
+  if (executed.load() != 32) return 4;
+
+  // placed tasks keep the max_running_tasks of their share group
+  {
+    px_sched::SchedulerParams shared = params;
+    px_sched::TaskParams capped;
+    capped.cost = px_sched::TaskParams::kHeavy;
+    capped.share_group = shared.addShareGroup("Capped", 1, 1);
+    schd.init(shared);
+    std::atomic<uint32_t> running = {0};
+    std::atomic<uint32_t> max_running = {0};
+    px_sched::Sync s;
+    for(uint32_t i = 0; i < 16; ++i) {
+      schd.run([&running, &max_running] {
+        uint32_t r = running.fetch_add(1) + 1;
+        uint32_t m = max_running.load();
+        while (r > m && !max_running.compare_exchange_weak(m, r)) {}
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        running.fetch_sub(1);
+      }, &s, capped);
+    }
+    schd.waitFor(s);
+    if (max_running.load() != 1) return 7;
+  }
+#endif
+
+  // favored cores of a homogeneous cpu (a few percent faster), nothing changes
+  const uint32_t favored[] = {1024, 1024, 980, 980};
+  params.cpu_capacities = favored;
+  schd.init(params);
+  runOne(&schd, px_sched::TaskParams::kHeavy);
+  schd.getPlacementStats(&stats);
+  if (stats.hybrid || stats.tasks[0][px_sched::TaskParams::kHeavy] != 0) return 5;
+
+  // core_aware disabled (the default), nothing changes
+  params.cpu_capacities = capacities;
+  params.core_aware = false;
+  schd.init(params);
+  runOne(&schd, px_sched::TaskParams::kHeavy);
+  schd.getPlacementStats(&stats);
+  if (stats.hybrid || stats.tasks[0][px_sched::TaskParams::kHeavy] != 0) return 6;
+  return 0;
+}
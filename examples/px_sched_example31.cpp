@@ -0,0 +1,69 @@
+// Example-31:
+// Compile time graphs: the stages of a frame are described with types, each
+// stage checks that the stages it depends on already finished. The same
+// graph is executed every frame without building it again.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+struct Frame {
+  std::atomic<uint32_t> done[5];
+  std::atomic<uint32_t> errors = {0};
+  uint32_t number = 0;
+  void finish(uint32_t stage, std::initializer_list<uint32_t> after) {
+    for(uint32_t a : after) {
+      if (done[a].load() != number) errors.fetch_add(1);
+    }
+    done[stage].store(number);
+  }
+};
+
+struct Input { Frame *f; void operator()() { f->finish(0, {}); } };
+struct Physics { Frame *f; void operator()() { f->finish(1, {0}); } };
+struct Animation { Frame *f; void operator()() { f->finish(2, {0}); } };
+struct Audio { Frame *f; void operator()() { f->finish(3, {0}); } };
+struct Render { Frame *f; void operator()() { f->finish(4, {1, 2}); } };
+
+typedef px_sched::Graph<
+    px_sched::Node<Input>,
+    px_sched::Node<Physics, px_sched::After<Input>>,
+    px_sched::Node<Animation, px_sched::After<Input>>,
+    px_sched::Node<Audio, px_sched::After<Input>>,
+    px_sched::Node<Render, px_sched::After<Physics, Animation>>> FrameGraph;
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  Frame frame;
+  for(auto &d : frame.done) d.store(0);
+  FrameGraph graph;
+  graph.get<Input>().f = &frame;
+  graph.get<Physics>().f = &frame;
+  graph.get<Animation>().f = &frame;
+  graph.get<Audio>().f = &frame;
+  graph.get<Render>().f = &frame;
+
+  const uint32_t kFrames = 1000;
+  for(uint32_t i = 1; i <= kFrames; ++i) {
+    frame.number = i;
+    px_sched::Sync s;
+    graph.run(&schd, &s);
+    schd.waitFor(s);
+    if (graph.running()) return 1;
+    for(auto &d : frame.done) {
+      if (d.load() != i) return 2;
+    }
+  }
+  printf("%u frames of %u nodes, %u errors\n", kFrames, FrameGraph::kNumNodes, frame.errors.load());
+  if (frame.errors.load() != 0) return 3;
+
+  // without sync object, the graph is polled
+  frame.number = kFrames + 1;
+  graph.run(&schd, nullptr);
+  while (graph.running()) std::this_thread::yield();
+  if (frame.done[4].load() != kFrames + 1 || frame.errors.load() != 0) return 4;
+  return 0;
+}
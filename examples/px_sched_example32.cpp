@@ -0,0 +1,74 @@
+// Example-32:
+// Pool pressure under locks: producers launch tasks while they hold a lock
+// the others wait for, and the pool of tasks is full. A worker holding a
+// lock parks until an element is released instead of executing the new
+// tasks inside its critical section (they could need the same lock).
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void work() {
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+template<class Lock>
+static uint32_t runProducers(px_sched::Scheduler *schd, Lock *lock) {
+  const uint32_t kProducers = 2; // fewer than workers, the rest execute the children
+  const uint32_t kRounds = 20;
+  const uint32_t kChildren = 40;
+  const uint32_t kBurst = 1000;
+  std::atomic<std::thread::id> owner = {std::thread::id()};
+  std::atomic<uint32_t> executed = {0};
+  std::atomic<uint32_t> errors = {0};
+
+  auto child = [&] {
+    // executed by the thread in the critical section of a producer
+    if (owner.load() == std::this_thread::get_id()) errors++;
+    work();
+    executed++;
+  };
+  px_sched::Sync done;
+  for(uint32_t p = 0; p < kProducers; ++p) {
+    schd->run([&] {
+      for(uint32_t r = 0; r < kRounds; ++r) {
+        std::lock_guard<Lock> l(*lock);
+        owner.store(std::this_thread::get_id());
+        for(uint32_t i = 0; i < kChildren; ++i) schd->run(child, &done);
+        owner.store(std::thread::id());
+      }
+    }, &done);
+  }
+  // keeps the pool full while the producers run
+  for(uint32_t i = 0; i < kBurst; ++i) schd->run(child, &done);
+  schd->waitFor(done);
+
+  const uint32_t expected = kProducers*kRounds*kChildren + kBurst;
+  printf("%u/%u tasks executed, %u inside a critical section\n",
+    executed.load(), expected, errors.load());
+  return (executed.load() == expected? 0 : 1) + errors.load();
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_running_threads = 4;
+  params.max_number_tasks = 64; // small pools on purpose
+  params.pool_exhausted_policy = px_sched::SchedulerParams::kPoolWait;
+#ifdef PX_SCHED_CONFIG_SINGLE_THREAD
+  // without threads the only way to release tasks is to execute them
+  params.max_number_tasks = 8192;
+#endif
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  px_sched::Mutex<std::mutex> mutex("Producers");
+  px_sched::TTASLock ttas;
+  uint32_t errors = runProducers(&schd, &mutex);
+  errors += runProducers(&schd, &ttas);
+  printf("pool full %u times (tasks)\n", schd.num_task_pool_waits());
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  if (schd.num_task_pool_waits() == 0) errors++;
+#endif
+  return errors == 0? 0 : 1;
+}
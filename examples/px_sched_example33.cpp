@@ -0,0 +1,124 @@
+// Example-33:
+// Wide sync objects: thousands of tasks release the same sync object, each
+// worker gathers its decrements and applies them at once (see
+// SchedulerParams::counter_batch_size). The sync object must reach zero
+// exactly when the last task finishes, whatever the workers do next: go
+// idle, spin, execute tasks of another sync object, wait or help a full pool.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static void work() {
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(2);
+  while (std::chrono::steady_clock::now() < end) {}
+}
+
+struct FanIn {
+  std::atomic<uint32_t> executed = {0};
+  std::atomic<uint32_t> after = {0};  // times the task after them was executed
+  std::atomic<uint32_t> early = {0};  // ... before all of them finished
+};
+
+static const uint32_t kTasks = 5000;
+
+// kTasks tasks on the wide sync object (returned), and a task after them
+static px_sched::Sync fanIn(px_sched::Scheduler *schd, FanIn *f, px_sched::Sync *done,
+                            const px_sched::TaskParams &tp = px_sched::TaskParams(),
+                            px_sched::Sync *other = nullptr) {
+  px_sched::Sync wide;
+  for(uint32_t i = 0; i < kTasks; ++i) {
+    schd->run([f] { work(); f->executed++; }, &wide, tp);
+    // tasks of another sync object in between, workers switch all the time
+    if (other) schd->run([] { work(); }, other, tp);
+  }
+  schd->runAfter(wide, [f] {
+    if (f->executed.load() != kTasks) f->early++;
+    f->after++;
+  }, done, tp);
+  return wide;
+}
+
+static uint32_t check(const char *name, const FanIn &f) {
+  bool ok = f.executed.load() == kTasks && f.after.load() == 1 && f.early.load() == 0;
+  printf("%-10s %u/%u tasks, after %u (early %u) %s\n", name, f.executed.load(), kTasks,
+    f.after.load(), f.early.load(), ok? "OK" : "ERROR");
+  return ok? 0 : 1;
+}
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  params.max_running_threads = 4;
+  params.max_number_tasks = 16384;
+  uint16_t latency = params.addLatencyGroup("Latency", 2);
+  px_sched::Scheduler schd;
+  schd.init(params);
+  uint32_t errors = 0;
+
+  // the workers go idle after the last tasks, waited from the main thread
+  for(uint32_t round = 0; round < 4; ++round) {
+    FanIn f;
+    px_sched::Sync done;
+    px_sched::Sync wide = fanIn(&schd, &f, &done);
+    schd.waitFor(wide);
+    if (f.executed.load() != kTasks) errors++;
+    schd.waitFor(done);
+    errors += check("idle", f);
+  }
+
+  // tasks of two sync objects interleaved
+  {
+    FanIn f;
+    px_sched::Sync done, other;
+    fanIn(&schd, &f, &done, px_sched::TaskParams(), &other);
+    schd.waitFor(done);
+    schd.waitFor(other);
+    errors += check("switch", f);
+  }
+
+  // executed by spinning workers
+  {
+    FanIn f;
+    px_sched::Sync done;
+    px_sched::TaskParams tp;
+    tp.worker_group = latency;
+    fanIn(&schd, &f, &done, tp);
+    schd.waitFor(done);
+    errors += check("spinning", f);
+  }
+
+#ifndef PX_SCHED_CONFIG_SINGLE_THREAD
+  // a worker launches them and waits
+  {
+    FanIn f;
+    px_sched::Sync outer;
+    schd.run([&] {
+      px_sched::Sync done;
+      px_sched::Sync wide = fanIn(&schd, &f, &done);
+      schd.waitFor(wide);
+      if (f.executed.load() != kTasks) errors++;
+      schd.waitFor(done);
+    }, &outer);
+    schd.waitFor(outer);
+    errors += check("worker", f);
+  }
+#endif
+
+  // launched from a worker with a small pool, it executes them while the
+  // pool is full
+  params.max_number_tasks = 256;
+  params.pool_exhausted_policy = px_sched::SchedulerParams::kPoolWait;
+#ifdef PX_SCHED_CONFIG_SINGLE_THREAD
+  // without threads the only way to release tasks is to execute them
+  params.max_number_tasks = 16384;
+#endif
+  schd.init(params);
+  {
+    FanIn f;
+    px_sched::Sync done;
+    schd.run([&] { fanIn(&schd, &f, &done); }, &done);
+    schd.waitFor(done);
+    errors += check("full pool", f);
+  }
+  return errors == 0? 0 : 1;
+}
@@ -0,0 +1,53 @@
+// Example-9:
+// Worker groups: blocking tasks (simulated I/O) on their own group of
+// threads, so they never take the place of compute tasks.
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+int main(int, char **) {
+  px_sched::SchedulerParams params;
+  params.num_threads = 4;
+  uint16_t io_group = params.addWorkerGroup("IO", 2);
+
+  px_sched::Scheduler schd;
+  schd.init(params);
+
+  px_sched::Sync loaded;
+  for(size_t i = 0; i < 8; ++i) {
+    auto load = [i] {
+      // blocking call, only IO threads will be waiting here
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      printf("Load %zu completed from %s\n",
+       i, px_sched::Scheduler::current_thread_name());
+    };
+    schd.run(load, &loaded, io_group);
+  }
+
+  // compute tasks can run while the IO group is blocked
+  px_sched::Sync computed;
+  for(size_t i = 0; i < 8; ++i) {
+    auto compute = [i] {
+      printf("Compute %zu completed from %s\n",
+       i, px_sched::Scheduler::current_thread_name());
+    };
+    schd.run(compute, &computed);
+  }
+
+  // Sync objects work across groups, process the data once it is loaded
+  px_sched::Sync processed;
+  for(size_t i = 0; i < 8; ++i) {
+    auto process = [i] {
+      printf("Process %zu completed from %s\n",
+       i, px_sched::Scheduler::current_thread_name());
+    };
+    schd.runAfter(loaded, process, &processed);
+  }
+
+  printf("Waiting for tasks to finish...\n");
+  schd.waitFor(computed);
+  schd.waitFor(processed);
+  printf("Waiting for tasks to finish...DONE \n");
+
+  return 0;
+}
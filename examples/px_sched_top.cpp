@@ -0,0 +1,61 @@
+// px_sched_top:
+// Shows the live snapshot of a px_sched scheduler running in another process
+// (see SchedulerParams::snapshot_path), refreshed like top.
+//
+// usage: px_sched_top snapshot_path [iterations (0 --> forever)] [delay_ms]
+
+#include <cstdlib>
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+
+static const char *kStates[] = {"idle", "running", "parked"};
+
+static void print(const px_sched::Snapshot::Data &d) {
+  printf("px_sched pid %u  tasks %u/%u  sync objects %u/%u  timers %u\n",
+    d.pid, d.tasks_in_use, d.max_tasks, d.syncs_in_use, d.max_syncs, d.timers);
+  printf("cancelled %u  deadline misses %u  pool full %u (tasks) %u (sync objects)  %u threads waiting\n\n",
+    d.tasks_cancelled, d.deadline_misses, d.task_pool_waits, d.sync_pool_waits, d.pool_waiters);
+  printf("%-20s %8s %8s %8s\n", "GROUP", "THREADS", "ACTIVE", "READY");
+  for(uint32_t g = 0; g < d.num_groups && g < PX_SCHED_MAX_WORKER_GROUPS; ++g) {
+    const px_sched::Snapshot::Group &group = d.groups[g];
+    printf("%-20s %4u/%-3u %8u %8u\n", group.name, group.num_threads,
+      group.max_running_threads, group.active_threads, group.ready_tasks);
+  }
+  printf("\n%-20s %-8s %10s %12s  %s\n", "WORKER", "STATE", "TASKS", "RUNNING(ms)", "TASK");
+  for(uint32_t i = 0; i < d.num_workers && i < px_sched::Snapshot::kMaxWorkers; ++i) {
+    const px_sched::Snapshot::Worker &w = d.workers[i];
+    const char *state = (w.state < 3)? kStates[w.state] : "?";
+    if (w.state == px_sched::Snapshot::kRunning) {
+      double ms = (d.time > w.task_start)? static_cast<double>(d.time - w.task_start)/1000.0 : 0.0;
+      printf("%-20s %-8s %10llu %12.1f  %s\n", w.name, state,
+        static_cast<unsigned long long>(w.tasks_executed), ms, w.task);
+    } else {
+      printf("%-20s %-8s %10llu %12s\n", w.name, state,
+        static_cast<unsigned long long>(w.tasks_executed), "");
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage: %s snapshot_path [iterations (0 --> forever)] [delay_ms]\n", argv[0]);
+    return 1;
+  }
+  uint32_t iterations = (argc > 2)? static_cast<uint32_t>(atoi(argv[2])) : 0;
+  uint32_t delay_ms = (argc > 3)? static_cast<uint32_t>(atoi(argv[3])) : 1000;
+  const px_sched::Snapshot *snapshot = px_sched::Snapshot::map(argv[1]);
+  if (!snapshot) {
+    printf("%s is not a px_sched snapshot (version %u)\n", argv[1], px_sched::Snapshot::kVersion);
+    return 1;
+  }
+  for(uint32_t i = 0; iterations == 0 || i < iterations; ++i) {
+    if (i) std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    px_sched::Snapshot::Data data;
+    if (!px_sched::Snapshot::read(snapshot, &data)) continue;
+    if (iterations != 1) printf("\033[H\033[2J");
+    print(data);
+    fflush(stdout);
+  }
+  px_sched::Snapshot::unmap(snapshot);
+  return 0;
+}
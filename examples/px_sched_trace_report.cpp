@@ -0,0 +1,33 @@
+// px_sched_trace_report:
+// Analyzes a trace saved with px_sched::TraceAnalysis::save, prints the
+// critical path, parallelism and idle time of the workers and optionally
+// exports the task graph.
+//
+// usage: px_sched_trace_report trace_file [graph.dot] [timeline.html]
+
+#define PX_SCHED_IMPLEMENTATION 1
+#include "../px_sched.h"
+#define PX_SCHED_TRACE_IMPLEMENTATION 1
+#include "../px_sched_trace.h"
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage: %s trace_file [graph.dot] [timeline.html]\n", argv[0]);
+    return 1;
+  }
+  px_sched::TraceAnalysis analysis;
+  if (!analysis.load(argv[1])) {
+    printf("Can not read trace %s\n", argv[1]);
+    return 1;
+  }
+  analysis.printReport(stdout);
+  if (argc > 2 && !analysis.exportDot(argv[2])) {
+    printf("Can not write %s\n", argv[2]);
+    return 1;
+  }
+  if (argc > 3 && !analysis.exportHtml(argv[3])) {
+    printf("Can not write %s\n", argv[3]);
+    return 1;
+  }
+  return 0;
+}
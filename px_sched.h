@@ -61,7 +61,9 @@ namespace px_sched {
 // Right now there is only two backends(single-threaded, and regular threads),
 // in the future we will add windows-fibers and posix-ucontext. Meanwhile try
 // to avoid waitFor(...) and use more runAfter if possible. Try not to suspend
-// threads on external mutexes.
+// threads on external mutexes. The single-threaded backend executes tasks in
+// order from a ready queue (see Scheduler::pump), useful on WASM and to
+// profile without threads.
 #if !defined(PX_SCHED_CONFIG_SINGLE_THREAD)  && \
     !defined(PX_SCHED_CONFIG_REGULAR_THREADS)
 # define PX_SCHED_CONFIG_REGULAR_THREADS 1
@@ -86,16 +88,116 @@ namespace px_sched {
 #endif
 // -----------------------------------------------------------------------------
 
+// -- Asynchronous I/O ---------------------------------------------------------
+// Scheduler::readAsync uses io_uring on linux (if available), otherwise, or
+// if the ring can not be created at init, reads are executed as blocking
+// tasks by the threads of SchedulerParams::io_worker_group.
+#ifndef PX_SCHED_CONFIG_IO_URING
+#  if defined(__linux__) && defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#      define PX_SCHED_CONFIG_IO_URING 1
+#    endif
+#  endif
+#endif
+#ifndef PX_SCHED_CONFIG_IO_URING
+#  define PX_SCHED_CONFIG_IO_URING 0
+#endif
+// -----------------------------------------------------------------------------
+
 #ifndef PX_SCHED_CACHE_LINE_SIZE
 #define PX_SCHED_CACHE_LINE_SIZE 64
 #endif
 
+// Maximum number of worker groups (including the default one) a scheduler
+// can be configured with, see SchedulerParams::addWorkerGroup
+#ifndef PX_SCHED_MAX_WORKER_GROUPS
+#define PX_SCHED_MAX_WORKER_GROUPS 4
+#endif
+
+// Maximum number of children of a SpawnScope pending at the same time, past
+// that children are executed right away by spawn
+#ifndef PX_SCHED_SPAWN_SCOPE_SIZE
+#define PX_SCHED_SPAWN_SCOPE_SIZE 16
+#endif
+
+// Blocks of scratch memory a thread keeps open at the same time, one per sync
+// object (see Scheduler::arenaAlloc)
+#ifndef PX_SCHED_ARENA_CURSORS
+#define PX_SCHED_ARENA_CURSORS 4
+#endif
+
+// Maximum number of share groups (see SchedulerParams::addShareGroup)
+#ifndef PX_SCHED_MAX_SHARE_GROUPS
+#define PX_SCHED_MAX_SHARE_GROUPS 8
+#endif
+
+// Number of deadline misses kept for reports (see Scheduler::getDeadlineMisses)
+#ifndef PX_SCHED_DEADLINE_MISSES
+#define PX_SCHED_DEADLINE_MISSES 16
+#endif
+
+// Number of upstream tasks kept with every deadline miss (see
+// DeadlineMiss::upstream)
+#ifndef PX_SCHED_DEADLINE_CHAIN
+#define PX_SCHED_DEADLINE_CHAIN 4
+#endif
+
+// Maximum number of cpus considered by the placement on hybrid CPUs (see
+// SchedulerParams::core_aware)
+#ifndef PX_SCHED_MAX_CPUS
+#define PX_SCHED_MAX_CPUS 256
+#endif
+
+// Maximum number of resources a task can declare (see Scheduler::run with
+// accesses)
+#ifndef PX_SCHED_MAX_ACCESSES
+#define PX_SCHED_MAX_ACCESSES 16
+#endif
+
+// Maximum number of stages of a Pipeline
+#ifndef PX_SCHED_PIPELINE_MAX_STAGES
+#define PX_SCHED_PIPELINE_MAX_STAGES 8
+#endif
+
+// Maximum number of MCSLock a thread can hold at the same time
+#ifndef PX_SCHED_MCS_MAX_LOCKS
+#define PX_SCHED_MCS_MAX_LOCKS 8
+#endif
+
+// Instruction used in spin loops to tell the CPU the thread is waiting
+#ifndef PX_SCHED_CPU_PAUSE
+#  if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#    include <intrin.h>
+#    define PX_SCHED_CPU_PAUSE() _mm_pause()
+#  elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#    define PX_SCHED_CPU_PAUSE() __builtin_ia32_pause()
+#  elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#    define PX_SCHED_CPU_PAUSE() __asm__ __volatile__("yield")
+#  else
+#    define PX_SCHED_CPU_PAUSE() ((void)0)
+#  endif
+#endif
+
 // **WARNING** ---> WORK IN PROGRESS <--- **WARNING** 
 // Enable if you want the threads to track resource locking, this might slow
 // down things a bit.
 #ifndef PX_SCHED_CHECK_DEADLOCKS
 #define PX_SCHED_CHECK_DEADLOCKS 0
 #endif
+
+// Enable to record per resource acquisitions, contention, wait and hold times
+// of the locks of px_sched (Mutex, Spinlock...), see Scheduler::getLockProfile
+#ifndef PX_SCHED_LOCK_PROFILER
+#define PX_SCHED_LOCK_PROFILER 0
+#endif
+
+// Maximum number of different resources tracked by the lock profiler
+#ifndef PX_SCHED_LOCK_PROFILER_SIZE
+#define PX_SCHED_LOCK_PROFILER_SIZE 256
+#endif
+
+// locks notify every acquisition, not only the ones that wait
+#define PX_SCHED_IMP_TRACK_LOCKS (PX_SCHED_LOCK_PROFILER || PX_SCHED_CHECK_DEADLOCKS)
 // -----------------------------------------------------------------------------
 
 
@@ -136,7 +238,11 @@ namespace px_sched {
 #endif
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <initializer_list>
+#include <mutex>
 #include <thread>
 
 namespace px_sched {
@@ -147,19 +253,340 @@ namespace px_sched {
     friend class Scheduler;
   };
 
+  // Timer object, handle to a periodic task (see Scheduler::runEvery)
+  class Timer {
+    uint32_t hnd = 0;
+    friend class Scheduler;
+  };
+
+  // Cancellation token, shared by a group of tasks (see TaskParams). Like
+  // Sync objects it is created on first use, and it is valid while there
+  // are unfinished tasks attached to it.
+  class CancelToken {
+    uint32_t hnd = 0;
+    friend class Scheduler;
+  };
+
+  class Limiter;
+
+  // Optional parameters of a task (see Scheduler::run/runAfter)
+  struct TaskParams {
+    uint16_t worker_group = 0;      // see SchedulerParams::addWorkerGroup
+    uint16_t share_group = 0;       // see SchedulerParams::addShareGroup
+    CancelToken *cancel_token = nullptr;
+    Limiter *limiter = nullptr;     // see Limiter
+    // time (see Scheduler::now) the task must be finished by, 0 --> none
+    uint64_t deadline = 0;
+    const char *name = nullptr;     // used in reports (deadline misses)
+    // executed by the latency group (see SchedulerParams::addLatencyGroup)
+    // if one of its threads is idle, otherwise by worker_group
+    bool low_latency = false;
+    // placement on hybrid CPUs (see SchedulerParams::core_aware): heavy or
+    // critical tasks prefer performance cores, background tasks prefer
+    // efficiency cores. The max_running_tasks of the share group still
+    // applies, but not its virtual time (placed tasks are executed in order)
+    enum Cost {
+      kNormal,
+      kHeavy,
+      kBackground,
+      kNumCosts
+    };
+    Cost cost = kNormal;
+  };
+
+  // Task that finished after its deadline (see Scheduler::getDeadlineMisses),
+  // times in microseconds (see Scheduler::now)
+  struct DeadlineMiss {
+    enum Cause {
+      kReadyLate,     //< dependencies (or the submission) finished too late
+      kStartedLate,   //< the task waited too long in the ready queue
+      kRanLong,       //< the task started in time, but its execution was too long
+    };
+    struct Link {
+      const char *name = nullptr;
+      uint64_t finish_time = 0;
+    };
+    const char *name = nullptr;
+    Cause cause = kReadyLate;
+    uint64_t deadline = 0;
+    uint64_t ready_time = 0;
+    uint64_t start_time = 0;
+    uint64_t finish_time = 0;
+    // chain of tasks responsible of the ready time: the last task that
+    // finished of the ones it waited for (runAfter, chainSync), then the
+    // last one that task waited for, and so on
+    Link upstream[PX_SCHED_DEADLINE_CHAIN];
+    uint32_t num_upstream = 0;
+  };
+
+
+  // Event of a task recorded while tracing (see Scheduler::startTrace), the
+  // analyzer of px_sched_trace.h rebuilds the task graph from them
+  struct TraceEvent {
+    enum Type {
+      kCreate,   //< sync: sync object of the task
+      kDepends,  //< sync: sync object the task waits for (runAfter, chainSync)
+      kReady,    //< dependencies released
+      kStart,    //< worker: index of the thread that executes it
+      kEnd
+    };
+    static const uint16_t kNoWorker = 0xFFFF;
+    uint64_t time = 0;            //< nanoseconds (steady clock)
+    const char *name = nullptr;   //< TaskParams::name (kCreate)
+    uint32_t task = 0;            //< unique per trace
+    uint32_t sync = 0;
+    uint16_t worker = kNoWorker;
+    uint16_t type = kCreate;
+  };
+
+  // Binary snapshot of the scheduler state, published to a shared file (see
+  // SchedulerParams::snapshot_path) so other processes can watch it without
+  // stopping the scheduler (see px_sched_top in examples). The layout is
+  // versioned, data is written with a seqlock: sequence is odd while the
+  // data is being updated, readers copy it and retry if sequence changed.
+  struct Snapshot {
+    static const uint32_t kMagic = 0x43535850; // "PXSC"
+    static const uint32_t kVersion = 1;
+    static const uint32_t kMaxWorkers = 64;
+    static const uint32_t kNameSize = 32;
+
+    enum WorkerState {
+      kIdle,     //< looking for tasks
+      kRunning,  //< executing a task
+      kParked    //< sleeping, no tasks to execute
+    };
+
+    struct Worker {
+      char name[kNameSize];
+      char task[kNameSize];    //< name of the task being executed (TaskParams::name)
+      uint64_t task_start;     //< time the task started (see Scheduler::now)
+      uint64_t tasks_executed;
+      uint16_t group;
+      uint16_t state;          //< WorkerState
+    };
+
+    struct Group {
+      char name[kNameSize];
+      uint32_t ready_tasks;
+      uint32_t active_threads;
+      uint16_t num_threads;
+      uint16_t max_running_threads;
+    };
+
+    struct Data {
+      uint64_t time;           //< when it was published (see Scheduler::now)
+      uint32_t pid;
+      uint32_t num_groups;
+      uint32_t num_workers;
+      uint32_t tasks_in_use;
+      uint32_t max_tasks;
+      uint32_t syncs_in_use;
+      uint32_t max_syncs;
+      uint32_t timers;
+      uint32_t tasks_cancelled;
+      uint32_t deadline_misses;
+      uint32_t task_pool_waits;
+      uint32_t sync_pool_waits;
+      uint32_t pool_waiters;
+      Group groups[PX_SCHED_MAX_WORKER_GROUPS];
+      Worker workers[kMaxWorkers];
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;  //< sizeof(Snapshot)
+    std::atomic<uint32_t> sequence;
+    Data data;
+
+    // maps (read only) the snapshot published at path, nullptr if the file
+    // can't be mapped or it is not a snapshot of this version
+    static const Snapshot *map(const char *path);
+    static void unmap(const Snapshot *snapshot);
+    // consistent copy of the data, false if it was being updated every try
+    static bool read(const Snapshot *snapshot, Data *out);
+  };
+
+  // Stats of a resource recorded by the lock profiler (PX_SCHED_LOCK_PROFILER)
+  struct LockProfile {
+    const void *resource = nullptr;
+    const char *name = nullptr;
+    uint64_t acquisitions = 0;
+    uint64_t contended = 0;   //< acquisitions that had to wait
+    uint64_t wait_ns = 0;
+    uint64_t max_wait_ns = 0;
+    uint64_t hold_ns = 0;
+  };
 
   struct MemCallbacks {
     void* (*alloc_fn)(size_t amount) = ::malloc;
     void (*free_fn)(void *ptr) = ::free;
   };
 
+  // A worker group is a set of threads with its own ready queue, tasks
+  // launched to one group are only executed by the threads of that group. Use
+  // them to keep tasks that block (file I/O, network...) away from the
+  // threads that run latency critical computations.
+  struct WorkerGroupParams {
+    const char *name = nullptr;
+    uint16_t num_threads = 0;         // num OS threads created for this group
+    uint16_t max_running_threads = 0; // 0 --> will be set to num_threads
+    // latency mode: the threads never park, they spin on the ready queue
+    // (each one keeps a core busy), see SchedulerParams::addLatencyGroup
+    bool spinning = false;
+    int32_t first_cpu = -1;           // >= 0 --> thread i is pinned to cpu first_cpu+i
+  };
+
+  // A share group is a set of tasks (a subsystem, a tenant...) that gets a
+  // share of the CPU time proportional to its weight, so a burst of tasks of
+  // one group can't starve the rest. Optionally the number of tasks of the
+  // group running at the same time can be capped.
+  struct ShareGroupParams {
+    const char *name = nullptr;
+    uint32_t weight = 1;
+    uint16_t max_running_tasks = 0;   // 0 --> no limit
+  };
+
+  // CPU time accounting of a share group (see Scheduler::getShareGroupStats)
+  struct ShareGroupStats {
+    uint64_t cpu_time_ns = 0;     //< time spent executing tasks of the group
+    uint64_t tasks_executed = 0;
+    uint32_t running_tasks = 0;
+  };
+
+  // Placement of tasks on hybrid CPUs (see Scheduler::getPlacementStats):
+  // tasks executed, and time spent, by class of core and TaskParams::cost
+  struct PlacementStats {
+    enum CoreClass {
+      kPerformance,
+      kEfficiency,
+      kNumCoreClasses
+    };
+    bool hybrid = false;  //< false --> all the cores are equal, nothing is recorded
+    uint16_t workers[kNumCoreClasses] = {};
+    uint64_t tasks[kNumCoreClasses][TaskParams::kNumCosts] = {};
+    uint64_t time_ns[kNumCoreClasses][TaskParams::kNumCosts] = {};
+  };
+
   struct SchedulerParams {
     uint16_t num_threads = 16;        // num OS threads created 
     uint16_t max_running_threads = 0; // 0 --> will be set to max hardware concurrency
     uint16_t max_number_tasks = 1024; // max number of simultaneous tasks
     uint16_t thread_num_tries_on_idle = 16;   // number of tries before suspend the thread
     uint32_t thread_sleep_on_idle_in_microseconds = 5; // time spent waiting between tries
+    uint32_t timer_resolution_in_microseconds = 1000; // granularity of delayed/periodic tasks
+    uint32_t arena_block_size = 64*1024; // bytes per block of scratch memory (see Scheduler::arenaAlloc)
+    // decrements of wide sync objects gathered per worker (0 --> disabled),
+    // while they run Scheduler::numPendingTasks can be above the real number
+    // by up to num_threads*counter_batch_size
+    uint16_t counter_batch_size = 32;
+    uint16_t spawn_deque_size = 256;  // per worker slots for spawned children (see SpawnScope)
+    // Single thread only: ready tasks are executed by Scheduler::pump,
+    // runUntilIdle and waitFor, instead of before returning from run (i.e.
+    // pumped once per frame from the main loop on WASM)
+    bool manual_pump = false;
+    // threads other than the workers that can use a WorkerLocal
+    uint16_t max_external_threads = 8;
+
+    // What a thread does when there are no free tasks, sync objects, cancel
+    // tokens or read requests (the pools have max_number_tasks elements):
+    // kPoolAbort (default) retries while other threads release elements
+    // and fails with PX_SCHED_CHECK_FN if none is found, with kPoolWait
+    // workers execute ready tasks of their group until an element is
+    // released, and other threads park.
+    enum PoolPolicy {
+      kPoolWait,
+      kPoolAbort
+    };
+    PoolPolicy pool_exhausted_policy = kPoolAbort;
     MemCallbacks mem_callbacks;
+
+    // Worker groups, group 0 is the default group and it is always described
+    // by num_threads/max_running_threads (worker_groups[0] is filled by init).
+    // Extra groups must be added with addWorkerGroup, that returns the
+    // group index to be used with Scheduler::run/runAfter
+    WorkerGroupParams worker_groups[PX_SCHED_MAX_WORKER_GROUPS];
+    uint16_t num_worker_groups = 1;
+
+    // Asynchronous reads (see Scheduler::readAsync)
+    uint16_t io_queue_depth = 64; // max reads in flight on io_uring (0 --> don't use io_uring)
+    uint16_t io_worker_group = 0; // group that executes blocking reads when io_uring can't be used
+
+    // Share groups, group 0 is the default group (weight 1). Extra groups
+    // must be added with addShareGroup, that returns the index to be used
+    // in TaskParams::share_group. Tasks of each worker group are dequeued
+    // by share group, picking the group with less CPU time/weight.
+    ShareGroupParams share_groups[PX_SCHED_MAX_SHARE_GROUPS];
+    uint16_t num_share_groups = 1;
+
+    // Hybrid CPUs (performance and efficiency cores): the threads of each
+    // worker group are split between both classes of cores, in proportion to
+    // their number, and pinned to the cores of their class. Heavy tasks are
+    // executed by performance workers and background tasks by efficiency
+    // workers, the others only take them when the workers of that class are
+    // busy (see TaskParams::cost). The capacity of each cpu is detected (see
+    // Scheduler::detectCpuCapacities) or given in cpu_capacities. Disabled
+    // by default, and nothing changes unless the smallest capacity is under
+    // 80% of the biggest (cores with a slightly higher turbo frequency are
+    // not efficiency cores).
+    bool core_aware = false;
+    const uint32_t *cpu_capacities = nullptr; // one per cpu, 0 --> not used
+    uint16_t num_cpus = 0;                    // entries of cpu_capacities
+
+    // Live snapshot (see Snapshot), if a path is given the state is
+    // published there every snapshot_period_in_microseconds by a dedicated
+    // thread (without threads call Scheduler::publishSnapshot). Use a file
+    // in /dev/shm to keep it in memory. Not available on windows.
+    const char *snapshot_path = nullptr;
+    uint32_t snapshot_period_in_microseconds = 100000;
+
+    uint16_t addWorkerGroup(const char *name, uint16_t group_num_threads,
+                            uint16_t group_max_running_threads = 0);
+    // Worker group of spinning threads (optionally pinned to isolated cores)
+    // that start tasks in less than a microsecond, at the cost of a core per
+    // thread. Tasks with TaskParams::low_latency are sent to it while one of
+    // its threads is idle.
+    uint16_t addLatencyGroup(const char *name, uint16_t group_num_threads,
+                             int32_t first_cpu = -1);
+    uint16_t latency_group = 0; // set by addLatencyGroup, 0 --> none
+    uint16_t addShareGroup(const char *name, uint32_t weight,
+                           uint16_t max_running_tasks = 0);
+  };
+
+  // Decisions of the scheduler that don't depend on threads, shared with the
+  // simulator (see px_sched_sim.h) so both pick the next task the same way.
+  struct SchedulingPolicy {
+    // virtual time charged to a share group after running elapsed_ns (scaled
+    // to keep precision with big weights)
+    static uint64_t shareVTime(uint64_t elapsed_ns, uint32_t weight) {
+      return (elapsed_ns << 8)/weight + 1;
+    }
+    // share group to dequeue from: the one with the lowest virtual time among
+    // the groups with ready tasks and below their max_running_tasks, skipping
+    // the groups in the discarded mask. num_share_groups if there is none.
+    template<class HasReady, class Running, class VTime>
+    static uint16_t pickShareGroup(const SchedulerParams &params, uint32_t discarded,
+        const HasReady &has_ready, const Running &running, const VTime &vtime) {
+      const uint16_t num_shares = params.num_share_groups;
+      uint16_t best = num_shares;
+      uint64_t best_vtime = 0;
+      for(uint16_t sg = 0; sg < num_shares; ++sg) {
+        if (discarded & (1u << sg)) continue;
+        if (!has_ready(sg)) continue;
+        uint16_t max_running = params.share_groups[sg].max_running_tasks;
+        if (max_running && running(sg) >= max_running) continue;
+        uint64_t v = vtime(sg);
+        if (best == num_shares || v < best_vtime) {
+          best = sg;
+          best_vtime = v;
+        }
+      }
+      return best;
+    }
+    // a parked thread is woken up only while the group is below its
+    // max_running_threads (active threads are running or looking for tasks)
+    static bool wakeUpThread(uint32_t active_threads, uint16_t max_running_threads) {
+      return active_threads < max_running_threads;
+    }
   };
 
   // -- Atomic -----------------------------------------------------------------
@@ -227,6 +654,12 @@ namespace px_sched {
   // used internally by the Scheduler for tasks and counters, but can also
   // be used as a thread-safe object pool
 
+  // used to pad objects to a multiple of the cache line size (N can be 0)
+  template<size_t N>
+  struct CacheLinePadding { char padding[N]; };
+  template<>
+  struct CacheLinePadding<0> {};
+
   template<class T>
   struct ObjectPool {
     const uint32_t kPosMask = 0x000FFFFF; // 20 bits
@@ -256,6 +689,10 @@ namespace px_sched {
     // it also increments in one the number of references (no need to call ref)
     uint32_t adquireAndRef();
 
+    // same, but returns false if there is no free object (every object of
+    // the pool is checked once)
+    bool tryAdquireAndRef(uint32_t *hnd);
+
     void unref(uint32_t hnd) const;
 
     // decrements the counter, if the object is no longer valid (last ref)
@@ -263,6 +700,10 @@ namespace px_sched {
     template<class F>
     void unref(uint32_t hnd, F f) const;
 
+    // same as above, but removes count references at once
+    template<class F>
+    void unref(uint32_t hnd, uint32_t count, F f) const;
+
     // returns true if the given position was a valid object
     bool ref(uint32_t hnd) const;
 
@@ -274,19 +715,21 @@ namespace px_sched {
     void newElement(uint32_t pos) const;
     void deleteElement(uint32_t pos) const;
 
-    struct D {
+    struct E {
       mutable Atomic<uint32_t> state;
       uint32_t version = 0;
       T element;
+    }; // E struct
+
 #if PX_SCHED_CACHE_LINE_SIZE
-      // Avoid false sharing between threads
-      static const size_t PADDING_ADJUSTMENT =
-          ( PX_SCHED_CACHE_LINE_SIZE
-            - ((sizeof(state)+sizeof(version)+sizeof(element))%PX_SCHED_CACHE_LINE_SIZE)
-          ) % PX_SCHED_CACHE_LINE_SIZE;
-      char padding[PADDING_ADJUSTMENT];
+    // Avoid false sharing between threads
+    static const size_t PADDING_ADJUSTMENT =
+        ( PX_SCHED_CACHE_LINE_SIZE - (sizeof(E)%PX_SCHED_CACHE_LINE_SIZE)
+        ) % PX_SCHED_CACHE_LINE_SIZE;
+    struct D : E, CacheLinePadding<PADDING_ADJUSTMENT> {};
+#else
+    struct D : E {};
 #endif
-    }; // D struct
 
     mutable Atomic<uint32_t> in_use_;
     Atomic<uint32_t> next_;
@@ -296,6 +739,99 @@ namespace px_sched {
   };
 
 
+  class Scheduler;
+  class Resource;
+
+  // Access of a task to a resource, see read(resource) and write(resource)
+  struct Access {
+    Resource *resource;
+    bool write;
+  };
+
+  // Fork-join scope for recursive parallelism. spawn launches a child job
+  // that can be executed in parallel, sync waits for all the children of the
+  // scope (the destructor calls sync). On workers children are pushed to the
+  // deque of the thread, sync executes the ones that weren't stolen by
+  // other workers of the group, so spawn+sync costs little more than a
+  // function call when there is no stealing. From other threads children
+  // are launched as regular tasks. A scope must be used by one thread only.
+  class SpawnScope {
+  public:
+    explicit SpawnScope(Scheduler *schd) : schd_(schd) {}
+    ~SpawnScope() { sync(); }
+    void spawn(const Job &job);
+    void sync();
+  private:
+    SpawnScope(const SpawnScope &) = delete;
+    SpawnScope& operator=(const SpawnScope &) = delete;
+    struct Node {
+      Job job;
+      SpawnScope *scope = nullptr;
+    };
+    Scheduler *schd_;
+    Node nodes_[PX_SCHED_SPAWN_SCOPE_SIZE];
+    uint32_t num_nodes_ = 0;
+    Atomic<uint32_t> pending_;
+    Sync tasks_; // children launched as tasks
+    friend class Scheduler;
+  };
+
+  //-- Parker -----------------------------------------------------------------
+  // Wait loop of Latch, Barrier and full pools: spins for a while (pause
+  // with exponential backoff, then yields) and parks the thread if the
+  // condition is still false, notifying the scheduler so another worker
+  // can run meanwhile.
+  // The condition must be changed inside update, so the waiters don't
+  // return (and destroy the object) while it is being notified.
+  class Parker {
+  public:
+    Parker() {}
+    // f changes the condition, returns true if the waiters must be woken up
+    template<class F> void update(F &&f) {
+      busy_.fetch_add(1);
+      if (f() && parked_.load()) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        cv_.notify_all();
+      }
+      busy_.fetch_sub(1);
+    }
+    template<class F> void waitUntil(F &&done) {
+      if (!spin(done)) {
+        beforePark();
+        {
+          std::unique_lock<std::mutex> lk(mutex_);
+          parked_.fetch_add(1);
+          while (!done()) cv_.wait(lk);
+          parked_.fetch_sub(1);
+        }
+        afterPark();
+      }
+      while (busy_.load()) { PX_SCHED_CPU_PAUSE(); }
+    }
+  private:
+    Parker(const Parker&) = delete;
+    Parker& operator=(const Parker&) = delete;
+    static void beforePark(); // see Scheduler::CurrentThreadSleeps
+    static void afterPark();
+    static const uint32_t kMaxSpins = 1024;
+    static const uint32_t kMaxYields = 64;
+    template<class F> static bool spin(F &&done) {
+      for(uint32_t spins = 1; spins <= kMaxSpins; spins <<= 1) {
+        if (done()) return true;
+        for(uint32_t i = 0; i < spins; ++i) { PX_SCHED_CPU_PAUSE(); }
+      }
+      for(uint32_t i = 0; i < kMaxYields; ++i) {
+        if (done()) return true;
+        std::this_thread::yield();
+      }
+      return done();
+    }
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<uint32_t> parked_ = {0};
+    std::atomic<uint32_t> busy_ = {0};
+  };
+
   class Scheduler {
   public:
     Scheduler();
@@ -304,17 +840,179 @@ namespace px_sched {
     void init(const SchedulerParams &params = SchedulerParams());
     void stop();
 
-    void run(const Job &job, Sync *out_sync_obj = nullptr);
-    void runAfter(Sync sync,const Job &job, Sync *out_sync_obj = nullptr);
+    // worker_group is the index returned by SchedulerParams::addWorkerGroup,
+    // by default tasks are executed by the threads of the default group (0).
+    // Sync objects can be shared freely between tasks of different groups.
+    void run(const Job &job, Sync *out_sync_obj = nullptr, uint16_t worker_group = 0);
+    void runAfter(Sync sync,const Job &job, Sync *out_sync_obj = nullptr, uint16_t worker_group = 0);
+    void run(const Job &job, Sync *out_sync_obj, const TaskParams &task_params);
+    void runAfter(Sync sync,const Job &job, Sync *out_sync_obj, const TaskParams &task_params);
     void waitFor(Sync sync); //< suspend current thread 
 
+#if PX_SCHED_IMP_SINGLE_THREAD
+    // Without threads ready tasks are queued and executed in order by the
+    // calling thread, before returning from run/runAfter/decrementSync...
+    // (or only by pump, runUntilIdle and waitFor with
+    // SchedulerParams::manual_pump). Tasks launched by a task are executed
+    // after it, so long chains of tasks don't grow the stack.
+
+    // executes up to max_tasks ready tasks, returns the number executed
+    uint32_t pump(uint32_t max_tasks = 1);
+    // executes ready tasks (and expired timers) until the queue is empty
+    uint32_t runUntilIdle();
+#endif
+
+    // Runs the job once all the triggers are released
+    void runAfterAll(const Sync *triggers, uint32_t num_triggers, const Job &job,
+                     Sync *out_sync_obj = nullptr,
+                     const TaskParams &task_params = TaskParams());
+
+    // SPMD teams: the job is executed by num_members workers of the group at
+    // the same time, so members can synchronize with Team::barrier (i.e.
+    // iterations of a solver) without a new task wave per iteration. Members
+    // get their context with Team::current(). The team is clamped to the
+    // threads the group can run at once (1 without threads), the size is
+    // returned. Teams wait until the threads they need are not in use by
+    // other teams, don't wait for a team from a worker of its group.
+    uint32_t runTeam(uint32_t num_members, const Job &job,
+                     Sync *out_sync_obj = nullptr, uint16_t worker_group = 0);
+
+    // Tasks that declare the resources they access, the order is inferred
+    // from the order of submission: readers of a resource run concurrently,
+    // and a writer waits for the previous writer and readers.
+    //   schd.run(job, {px_sched::read(a), px_sched::write(b)});
+    void run(const Job &job, std::initializer_list<Access> accesses,
+             Sync *out_sync_obj = nullptr,
+             const TaskParams &task_params = TaskParams());
+
+    // The sync object `to` won't be released before `from`, this doesn't
+    // execute any task (if `from` is already released nothing is done).
+    void chainSync(Sync from, Sync *to);
+
+    // Cooperative cancellation: once cancel is called, the tasks attached to
+    // the token (TaskParams::cancel_token) that didn't start yet are skipped,
+    // their sync objects are released as if they were executed. Running
+    // tasks can poll isCancelled() to finish early.
+    void cancel(CancelToken token);
+    bool isCancelled(CancelToken token) const;
+    // true if the task being executed by the current thread was cancelled
+    static bool isCancelled();
+
+    // number of tasks skipped because they were cancelled
+    uint32_t num_tasks_cancelled() const { return tasks_cancelled_.load(); }
+
+    // number of times a thread found the pool of tasks (or of sync objects)
+    // full, see SchedulerParams::pool_exhausted_policy (cancel tokens and
+    // read requests are not counted)
+    uint32_t num_task_pool_waits() const { return task_pool_waits_.load(); }
+    uint32_t num_sync_pool_waits() const { return sync_pool_waits_.load(); }
+
+    // CPU time accounting of a share group (only recorded if there is more
+    // than one share group, see SchedulerParams::addShareGroup)
+    void getShareGroupStats(uint16_t share_group, ShareGroupStats *out) const;
+
+    // Tasks executed by each class of core (see SchedulerParams::core_aware),
+    // i.e. heavy tasks that ended on efficiency cores
+    void getPlacementStats(PlacementStats *out) const;
+    // capacity of each cpu the process can use (0 for the rest), read from
+    // sysfs on Linux (cpu_capacity, or the max frequency of cpufreq when the
+    // kernel doesn't report it).
+    // Returns the number of entries written, 0 if it is unknown.
+    static uint32_t detectCpuCapacities(uint32_t *out, uint32_t max_cpus);
+
+    // Deadlines (TaskParams::deadline): ready tasks with a deadline are
+    // executed before the rest, earliest deadline first. The deadline is
+    // propagated backward through runAfter, the tasks the deadline task
+    // waits for (and the ones they wait for...) are also picked early.
+    // Tasks that finish after their deadline are recorded, the last
+    // PX_SCHED_DEADLINE_MISSES are kept (most recent first).
+    uint32_t num_deadline_misses() const { return deadline_misses_.count.load(); }
+    uint32_t getDeadlineMisses(DeadlineMiss *out, uint32_t max_entries);
+
+    // Scratch memory that lives as long as the sync object is pending, it is
+    // bump allocated from blocks owned by the calling thread, and all of them
+    // are released at once when the sync object is released (no destructors
+    // are called). Blocks are reused, after the first frames no memory is
+    // requested to MemCallbacks. The sync object must be pending (tasks not
+    // finished, or incrementSync), otherwise nullptr is returned. Tasks
+    // launched with runAfter on the sync object can't access its memory, use
+    // the sync object of a bigger group (i.e. the frame) to pass results.
+    void *arenaAlloc(Sync sync, size_t size, size_t align = alignof(std::max_align_t));
+    // same, using the sync object of the task executed by the current thread
+    static void *arenaAlloc(size_t size, size_t align = alignof(std::max_align_t));
+    // Like run, but the job is copied into the scratch memory of out_sync_obj
+    // instead of a Job, so big captures don't go through the heap. Its
+    // destructor is called once it is executed (or skipped, if cancelled).
+    // Without out_sync_obj it is the same as run.
+    template<class F>
+    void runArena(const F &job, Sync *out_sync_obj, const TaskParams &task_params = TaskParams());
+
+    // number of blocks of scratch memory allocated (in use or free)
+    uint32_t num_arena_blocks() const { return arena_.num_blocks.load(); }
+
+    // Delayed tasks, they are kept in a timer wheel (no thread is waiting for
+    // them) and launched once the given time has passed. The sync object is
+    // pending from the moment the task is created. Times are in microseconds,
+    // and rounded to SchedulerParams::timer_resolution_in_microseconds.
+    void runAfterDelay(uint64_t delay_in_microseconds, const Job &job,
+                       Sync *out_sync_obj = nullptr,
+                       const TaskParams &task_params = TaskParams());
+    // same as runAfterDelay, but time is absolute (see Scheduler::now)
+    void runAt(uint64_t time_in_microseconds, const Job &job,
+               Sync *out_sync_obj = nullptr,
+               const TaskParams &task_params = TaskParams());
+
+    // Periodic tasks, the job is executed every period until stopTimer is
+    // called with the returned timer. The same task is re-armed after each
+    // execution, so the job object is only copied once.
+    void runEvery(uint64_t period_in_microseconds, const Job &job,
+                  Timer *out_timer = nullptr,
+                  const TaskParams &task_params = TaskParams());
+    void stopTimer(Timer timer);
+
+    // monotonic time in microseconds, used by delayed and periodic tasks
+    static uint64_t now();
+
+    uint32_t num_timers() const { return timers_.count.load(); }
+
+    // Reads size bytes from the file descriptor fd (starting at offset) into
+    // buffer without blocking the calling thread. The read counts as a task
+    // attached to out_sync_obj, use runAfter on it to process the data.
+    // If out_result is given it will hold the number of bytes read, or
+    // -errno if the read failed, once the sync object is released.
+    void readAsync(int fd, uint64_t offset, void *buffer, size_t size,
+                   Sync *out_sync_obj, int64_t *out_result = nullptr);
+
+    // returns true if readAsync is backed by io_uring, false if reads are
+    // executed as blocking tasks (see SchedulerParams::io_worker_group)
+    bool hasAsyncIO() const { return io_ring_ != nullptr; }
+
+    // returns the index of the worker group with the given name, or
+    // kInvalidWorkerGroup if there is no group with that name
+    static const uint16_t kInvalidWorkerGroup = 0xFFFF;
+    uint16_t findWorkerGroup(const char *name) const;
+
     // returns the number of tasks not yet finished associated to the sync object
     // thus 0 means all of them has finished (or the sync object was empty, or
-    // unused)
+    // unused). On wide sync objects it can be stale by up to
+    // num_threads*counter_batch_size (see SchedulerParams::counter_batch_size)
     uint32_t numPendingTasks(Sync s);
 
     bool hasFinished(Sync s) { return numPendingTasks(s) == 0; }
   
+    // Records the events of every task (creation, dependencies, ready, start
+    // and end) to analyze them later (see px_sched_trace.h). The buffer holds
+    // max_events (allocated with MemCallbacks), events past that are dropped.
+    void startTrace(uint32_t max_events);
+    void stopTrace();
+    // events recorded, call it once the trace is stopped. They are valid
+    // until the next startTrace (or the scheduler is stopped).
+    const TraceEvent *traceEvents(uint32_t *num_events) const;
+    uint32_t num_trace_events_dropped() const;
+
+    // writes the current state to the snapshot (see SchedulerParams::snapshot_path)
+    void publishSnapshot();
+
     // Call this only to print the internal state of the scheduler, mainly if it 
     // stops working and want to see who is waiting for what, and so on.
     void getDebugStatus(char *buffer, size_t buffer_size);
@@ -354,52 +1052,284 @@ namespace px_sched {
     // blocked but also didn't adquired the lock (try_lock)
     static void CurrentThreadAfterLockResource(bool success);
 
+    // Call this method after adquiring a resource without calling
+    // CurrentThreadBeforeLockResource (the lock was free, or the thread only
+    // spun for wait_ns nanoseconds).
+    static void CurrentThreadLockedResource(const void *resource_ptr, const char *name = nullptr,
+                                            uint64_t wait_ns = 0);
+
     // Call this method once the resouce is unlocked.
     static void CurrentThreadReleasesResource(const void *resource_ptr);
 
+    // Call these methods after adquiring and before releasing a lock other
+    // tasks could need (the locks of px_sched already do it). While a worker
+    // holds a lock a full pool parks it instead of executing other tasks,
+    // they could try to take the same lock (see SchedulerParams::pool_exhausted_policy).
+    static void CurrentThreadHoldsLock();
+    static void CurrentThreadDropsLock();
+
+    // Lock contention profiler (compiled with PX_SCHED_LOCK_PROFILER 1): fills
+    // out with the stats of up to max_entries resources, sorted by total wait
+    // time, and returns the number of entries written. Threads record into
+    // their own buffers, the result is approximate while locks are in use.
+    static uint32_t getLockProfile(LockProfile *out, uint32_t max_entries);
+    static void resetLockProfile();
+
     const SchedulerParams& params() const { return params_; }
 
-    // Number of active threads (executing tasks)
-    uint32_t active_threads() const { return active_threads_.load(); }
+    // Number of active threads (executing tasks), of all groups
+    uint32_t active_threads() const;
 
     uint32_t num_tasks() const { return tasks_.in_use(); }
     uint32_t num_counters() const { return counters_.in_use(); }
 
-#if PX_SCHED_IMP_REGULAR_THREADS
-    uint32_t num_tasks_ready() { return ready_tasks_.in_use(); }
-#endif
-
-#if PX_SCHED_IMP_SINGLE_THREAD
-    uint32_t num_tasks_ready() { return 0; }
-#endif
+    // Number of tasks waiting to be executed (of all groups)
+    uint32_t num_tasks_ready();
 
   private:
     struct TLS;
     static TLS* tls();
-    void wakeUpOneThread();
+    // workers of core_class first (see SchedulerParams::core_aware)
+    void wakeUpOneThread(uint16_t worker_group,
+                         uint8_t core_class = PlacementStats::kNumCoreClasses);
+    void pushReady(uint32_t task_ref);
     SchedulerParams params_;
-    Atomic<uint32_t> active_threads_;
     Atomic<uint32_t> running_;
 
     struct WaitFor;
 
     struct Task {
       Job job;
+      // internal tasks execute call(scheduler, call_arg) instead of the job
+      void (*call)(Scheduler *, uintptr_t) = nullptr;
+      uintptr_t call_arg = 0;
+      void (*drop)(uintptr_t) = nullptr; // releases call_arg if the task is skipped
       uint32_t counter_id = 0;
       Atomic<uint32_t> next_sibling_task;
+      uint16_t worker_group = 0;
+      uint16_t share_group = 0;
+      uint32_t cancel_token = 0;
+      Limiter *limiter = nullptr;
+      const char *name = nullptr;
+      bool low_latency = false;
+      uint8_t cost = TaskParams::kNormal;
+      uint32_t trace_id = 0;    // 0 --> not traced
+      uint64_t deadline = 0;
+      uint64_t ready_time = 0;  // only for tasks with a deadline
+      // what the task waited for, only upstream of a deadline (see noteFinished)
+      DeadlineMiss::Link upstream[PX_SCHED_DEADLINE_CHAIN];
+      uint32_t num_upstream = 0;
+      // delayed/periodic tasks (in timer ticks)
+      uint64_t timer_expiry = 0;
+      uint64_t timer_period = 0;
+      Atomic<uint32_t> timer_stopped;
+    };
+
+    struct ArenaBlock {
+      ArenaBlock *next;
+      size_t capacity;
+      size_t used;
     };
 
     struct Counter {
       Atomic<uint32_t> task_id;
       Atomic<uint32_t> user_count;
       WaitFor *wait_ptr = nullptr;
+      // scratch memory, released with the counter
+      Atomic<ArenaBlock*> arena_blocks;
+      ArenaBlock *arena_tail = nullptr;
+      Atomic<ArenaBlock*> arena_large;
+      // earliest deadline of the tasks waiting for this counter, and the
+      // counter its tasks wait for (to propagate deadlines backward)
+      Atomic<uint64_t> deadline;
+      Atomic<uint32_t> upstream;
+      // last task that finished (and what it waited for), only with a
+      // deadline, inherited by the tasks woken by the counter
+      DeadlineMiss::Link last_finished[PX_SCHED_DEADLINE_CHAIN];
+      uint32_t num_last_finished = 0;
+      Atomic<uint32_t> last_finished_lock;
+    };
+
+    struct DeadlineMisses {
+      DeadlineMiss list[PX_SCHED_DEADLINE_MISSES];
+      uint32_t next = 0;
+      Atomic<uint32_t> count;
+      std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+    };
+    DeadlineMisses deadline_misses_;
+
+    // task events (see startTrace)
+    struct Trace {
+      TraceEvent *events = nullptr;
+      uint32_t capacity = 0;
+      Atomic<uint32_t> count;   // can go past capacity (dropped events)
+      Atomic<uint32_t> next_id;
+      Atomic<uint32_t> active;
+      Atomic<uint32_t> writers; // recording an event right now
+    };
+    Trace trace_;
+    void traceEvent(uint32_t task_id, TraceEvent::Type type, uint32_t sync = 0,
+                    const char *name = nullptr);
+    void releaseTrace();
+    uint16_t traceWorker() const;
+
+    // live snapshot (see SchedulerParams::snapshot_path)
+    struct SnapshotWriter {
+      Snapshot *shared = nullptr;
+      std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+#if PX_SCHED_IMP_REGULAR_THREADS
+      std::thread thread;
+      std::mutex mutex;
+      std::condition_variable cv;
+#endif
+    };
+    SnapshotWriter snapshot_;
+    void openSnapshot();
+    void closeSnapshot();
+    void fillSnapshot(Snapshot::Data *data);
+    uint64_t effectiveDeadline(const Task &task);
+    void propagateDeadline(uint32_t counter_hnd, uint64_t deadline);
+    void linkUpstream(uint32_t counter_hnd, uint32_t upstream_hnd, uint64_t deadline);
+    void noteFinished(uint32_t counter_hnd, const Task &task);
+    void inheritUpstream(Counter *c, Task *task);
+    bool linkTask(uint32_t task_ref, uint32_t trigger_hnd, uint64_t deadline);
+    bool adquireLimiter(uint32_t task_ref);
+    uint32_t releaseLimiter(Limiter *limiter);
+    void queueReady(uint32_t task_ref);
+
+    // blocks of scratch memory not owned by any counter
+    struct ArenaPool {
+      ArenaBlock *free_list = nullptr;
+      Atomic<uint32_t> num_blocks;
+      std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+      void lock() { while(lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); } }
+      void unlock() { lock_.clear(std::memory_order_release); }
+    };
+
+    struct CancelState {
+      Atomic<uint32_t> cancelled;
+    };
+
+    struct IORequest {
+      int fd = -1;
+      uint64_t offset = 0;
+      void *buffer = nullptr;
+      size_t size = 0;
+      size_t done = 0;
+      int64_t *result = nullptr;
+      uint32_t counter_id = 0;
+    };
+
+    struct IORing;
+
+    // Hierarchical timer wheel: 4 levels of 64 slots, each slot is a list of
+    // tasks linked through Task::next_sibling_task
+    struct TimerWheel {
+      static const uint32_t kLevels = 4;
+      static const uint32_t kSlotBits = 6;
+      static const uint32_t kSlots = 1u << kSlotBits;
+      static const uint64_t kSlotMask = kSlots - 1;
+      uint32_t slots[kLevels][kSlots];
+      uint64_t current_tick = 0;
+      uint64_t resolution = 1000;
+      Atomic<uint32_t> count;
+      Atomic<uint64_t> watch_tick; // tick a parked worker will wake up at
+      std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+      void lock() { while(lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); } }
+      void unlock() { lock_.clear(std::memory_order_release); }
     };
 
     ObjectPool<Task> tasks_;
     ObjectPool<Counter> counters_;
-    uint32_t createTask(const Job &job, Sync *out_sync_obj);
+    ObjectPool<CancelState> cancel_tokens_;
+    ObjectPool<IORequest> io_requests_;
+    Atomic<uint32_t> tasks_cancelled_;
+    // pool pressure (see SchedulerParams::pool_exhausted_policy)
+    Atomic<uint32_t> task_pool_waits_;
+    Atomic<uint32_t> sync_pool_waits_;
+    Atomic<uint32_t> pool_waiters_;
+    Parker pool_parker_;
+    template<class T>
+    uint32_t adquireFromPool(ObjectPool<T> *pool, Atomic<uint32_t> *pool_waits);
+    bool helpPool();
+    void notifyPoolWaiters() { pool_parker_.update([] { return true; }); }
+
+    // fair share: tasks are dequeued from the share group with the lowest
+    // virtual time (cpu time/weight)
+    struct ShareGroup {
+      Atomic<uint64_t> vtime;
+      Atomic<uint64_t> cpu_time_ns;
+      Atomic<uint64_t> tasks_executed;
+      Atomic<uint32_t> running_tasks;
+    };
+    ShareGroup share_groups_[PX_SCHED_MAX_SHARE_GROUPS];
+    Atomic<uint64_t> share_vtime_floor_; // vtime of the last group picked
+    IORing *io_ring_ = nullptr;
+    TimerWheel timers_;
+    ArenaPool arena_;
+    void *arenaAlloc(uint32_t counter_hnd, size_t size, size_t align);
+    template<class F>
+    static void ArenaJobTask(Scheduler *schd, uintptr_t job);
+    template<class F>
+    static void ArenaJobDrop(uintptr_t job);
+    void releaseArena(Counter *c);
+    void resetArenaPool();
+    void initTimers();
+    void initAccounting();
+    static uint64_t threadCpuTime();
+    void addTimer(uint32_t task_ref);
+    bool insertTimerLocked(uint32_t task_ref);
+    void processTimers();
+    uint64_t nextTimerTick();
+    void onTimerAdded(uint64_t expiry_tick);
+    void releaseTask(uint32_t task_ref);
+    void finishTask(uint32_t task_ref);
+    uint32_t allocTask(Sync *out_sync_obj, const TaskParams &task_params);
+    uint32_t createTask(const Job &job, Sync *out_sync_obj, const TaskParams &task_params);
     uint32_t createCounter();
-    void unrefCounter(uint32_t counter_hnd);
+    uint32_t refCounter(Sync *sync_obj);
+    friend class SpawnScope;
+    friend class Pipeline;
+    friend class MCSLock;
+    friend class Team;
+    template<class T> friend class Channel;
+    template<class T> friend class WorkerLocal;
+    template<class... Nodes> friend class Graph;
+    // instance of a WorkerLocal used by the current thread: workers first,
+    // then external threads (assigned the first time they use one)
+    uint32_t workerLocalSlots() const;
+    uint32_t workerLocalIndex();
+    void runCall(void (*call)(Scheduler *, uintptr_t), uintptr_t call_arg, const TaskParams &task_params);
+    void spawnChild(SpawnScope *scope, const Job &job);
+    void syncScope(SpawnScope *scope);
+    uint32_t refCancelToken(CancelToken *token);
+    bool cancelRequested(uint32_t token_hnd) const;
+    void unrefCounter(uint32_t counter_hnd, uint32_t count = 1);
+    void releaseCounter(uint32_t counter_hnd);
+    void executeTask(Task *task);
+    void readBlockingLater(uint32_t request_hnd);
+    void completeRead(uint32_t request_hnd, int64_t result);
+    static int64_t ReadBlocking(IORequest *req);
+    static void ReadBlockingTask(Scheduler *schd, uintptr_t request_hnd);
+    // SPMD teams (see runTeam), teams that don't fit in the threads of the
+    // group wait in a FIFO until a running team finishes
+    struct TeamState;
+    struct Teams {
+      uint32_t reserved[PX_SCHED_MAX_WORKER_GROUPS] = {};
+      TeamState *head[PX_SCHED_MAX_WORKER_GROUPS] = {};
+      TeamState *tail[PX_SCHED_MAX_WORKER_GROUPS] = {};
+      std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+      void lock() { while(lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); } }
+      void unlock() { lock_.clear(std::memory_order_release); }
+    };
+    Teams teams_;
+    uint32_t teamCapacity(uint16_t worker_group) const;
+    void launchTeam(TeamState *team);
+    void teamDone(TeamState *team);
+    static void TeamTask(Scheduler *schd, uintptr_t member);
+    // call of the tasks created by chainSync, they are finished (without
+    // going through the ready queue) when their trigger is released
+    static void EdgeTask(Scheduler *, uintptr_t) {}
 
 #if PX_SCHED_IMP_REGULAR_THREADS
     struct IndexQueue {
@@ -463,6 +1393,81 @@ namespace px_sched {
       volatile uint16_t current_ = 0;
     };
 
+    // ready tasks with a deadline, earliest deadline first (binary heap)
+    struct DeadlineQueue {
+      struct Entry {
+        uint64_t deadline;
+        uint32_t task_ref;
+      };
+      ~DeadlineQueue() {
+        PX_SCHED_CHECK_FN(heap_ == nullptr, "DeadlineQueue Resources leaked...");
+      }
+      void reset() {
+        if (heap_) {
+          mem_.free_fn(heap_);
+          heap_ = nullptr;
+        }
+        size_ = 0;
+        count.store(0);
+      }
+      void init(uint16_t max, const MemCallbacks &mem_cb = MemCallbacks()) {
+        _lock();
+        reset();
+        mem_ = mem_cb;
+        size_ = max;
+        heap_ = static_cast<Entry*>(mem_.alloc_fn(sizeof(Entry)*size_));
+        _unlock();
+      }
+      void push(uint32_t task_ref, uint64_t deadline) {
+        _lock();
+        uint32_t i = count.load();
+        PX_SCHED_CHECK_FN(i < size_, "DeadlineQueue Overflow total in use %u (max %hu)", i, size_);
+        while (i > 0 && heap_[(i-1)/2].deadline > deadline) {
+          heap_[i] = heap_[(i-1)/2];
+          i = (i-1)/2;
+        }
+        heap_[i].deadline = deadline;
+        heap_[i].task_ref = task_ref;
+        count.fetch_add(1);
+        _unlock();
+      }
+      bool pop(uint32_t *task_ref) {
+        if (count.load() == 0) return false;
+        _lock();
+        uint32_t n = count.load();
+        if (n == 0) {
+          _unlock();
+          return false;
+        }
+        *task_ref = heap_[0].task_ref;
+        Entry last = heap_[--n];
+        uint32_t i = 0;
+        for(;;) {
+          uint32_t child = i*2 + 1;
+          if (child >= n) break;
+          if (child + 1 < n && heap_[child+1].deadline < heap_[child].deadline) child++;
+          if (heap_[child].deadline >= last.deadline) break;
+          heap_[i] = heap_[child];
+          i = child;
+        }
+        heap_[i] = last;
+        count.store(n);
+        _unlock();
+        return true;
+      }
+      void _unlock() { lock_.clear(std::memory_order_release); }
+      void _lock() {
+        while(lock_.test_and_set(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+      }
+      Entry *heap_ = nullptr;
+      std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+      MemCallbacks mem_;
+      uint16_t size_ = 0;
+      Atomic<uint32_t> count; // readable without the lock
+    };
+
     struct WaitFor {
       explicit WaitFor() 
         : owner(std::this_thread::get_id())
@@ -473,10 +1478,18 @@ namespace px_sched {
             "WaitFor::wait can only be invoked from the thread "
             "that created the object");
         std::unique_lock<std::mutex> lk(mutex);
-        if(!ready) {
+        while(!ready) {
           condition_variable.wait(lk);
         }
       }
+      // returns false if the timeout expired before being signaled
+      bool wait(uint64_t timeout_in_microseconds) {
+        PX_SCHED_TRACE_FN("WaitForTimeout");
+        std::unique_lock<std::mutex> lk(mutex);
+        return condition_variable.wait_for(lk,
+            std::chrono::microseconds(timeout_in_microseconds),
+            [this] { return ready; });
+      }
       void signal() {
         if (owner != std::this_thread::get_id()) {
           std::lock_guard<std::mutex> lk(mutex);
@@ -493,76 +1506,643 @@ namespace px_sched {
       bool ready;
     };
 
+    // Chase-Lev deque of spawned children (see SpawnScope), the owner pushes
+    // and pops at the bottom, other workers steal from the top
+    struct SpawnDeque {
+      ~SpawnDeque() {
+        PX_SCHED_CHECK_FN(buffer_ == nullptr, "SpawnDeque Resources leaked...");
+      }
+      void init(uint32_t size, const MemCallbacks &mem_cb) {
+        reset();
+        mem_ = mem_cb;
+        mask_ = size - 1;
+        buffer_ = static_cast<std::atomic<SpawnScope::Node*>*>(
+            mem_.alloc_fn(sizeof(std::atomic<SpawnScope::Node*>)*size));
+        for(uint32_t i = 0; i < size; ++i) {
+          new (&buffer_[i]) std::atomic<SpawnScope::Node*>(nullptr);
+        }
+      }
+      void reset() {
+        if (buffer_) {
+          mem_.free_fn(buffer_);
+          buffer_ = nullptr;
+        }
+      }
+      // owner only, returns false if the deque is full
+      bool push(SpawnScope::Node *n, bool *was_empty) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > static_cast<int64_t>(mask_)) return false;
+        *was_empty = (b == t);
+        buffer_[static_cast<uint64_t>(b) & mask_].store(n, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+      }
+      // owner only
+      SpawnScope::Node *pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        SpawnScope::Node *n = nullptr;
+        if (t <= b) {
+          n = buffer_[static_cast<uint64_t>(b) & mask_].load(std::memory_order_relaxed);
+          if (t == b) {
+            // last one, race against thieves
+            if (!top_.compare_exchange_strong(t, t + 1,
+                  std::memory_order_seq_cst, std::memory_order_relaxed)) {
+              n = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+          }
+        } else {
+          bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return n;
+      }
+      SpawnScope::Node *steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        SpawnScope::Node *n = buffer_[static_cast<uint64_t>(t) & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1,
+              std::memory_order_seq_cst, std::memory_order_relaxed)) {
+          return nullptr;
+        }
+        return n;
+      }
+      std::atomic<int64_t> top_ = {0};
+      CacheLinePadding<PX_SCHED_CACHE_LINE_SIZE> padding_;
+      std::atomic<int64_t> bottom_ = {0};
+      std::atomic<SpawnScope::Node*> *buffer_ = nullptr;
+      uint64_t mask_ = 0;
+      MemCallbacks mem_;
+    };
+
     struct Worker {
       std::thread thread;
        // setted by the thread when is sleep
       Atomic<WaitFor*> wake_up;
       TLS *thread_tls = nullptr;
       uint16_t thread_index = 0xFFFF;
+      uint16_t worker_group = 0;
+      SpawnDeque spawn_deque;
+      // only updated with a snapshot (see SchedulerParams::snapshot_path)
+      Atomic<const char*> task_name;
+      Atomic<uint64_t> task_start;
+      Atomic<uint64_t> tasks_executed;
+      // hybrid CPUs only (see SchedulerParams::core_aware)
+      uint8_t core_class = PlacementStats::kNumCoreClasses;
+      Atomic<uint64_t> placed_tasks[TaskParams::kNumCosts];
+      Atomic<uint64_t> placed_ns[TaskParams::kNumCosts];
+    };
+
+    struct WorkerGroup {
+      // one queue per share group
+      IndexQueue ready_tasks[PX_SCHED_MAX_SHARE_GROUPS];
+      DeadlineQueue deadline_tasks;
+      Atomic<uint32_t> active_threads;
+      Atomic<uint32_t> idle_spinners; // spinning threads without a task
+      // hybrid CPUs: heavy (kPerformance) and background (kEfficiency) tasks
+      IndexQueue placed_tasks[PlacementStats::kNumCoreClasses];
+      Atomic<uint32_t> class_busy[PlacementStats::kNumCoreClasses];
+      uint16_t class_threads[PlacementStats::kNumCoreClasses] = {};
+      uint16_t first_worker = 0;
+      uint16_t num_threads = 0;
+      uint16_t max_running_threads = 0;
     };
 
-    uint16_t wakeUpThreads(uint16_t max_num_threads);
+    uint16_t wakeUpThreads(uint16_t worker_group, uint16_t max_num_threads,
+                           uint8_t core_class = PlacementStats::kNumCoreClasses);
+    // strict --> tasks placed for the other class of cores are left to its
+    // workers while some of them are not busy
+    bool popReady(WorkerGroup *group, uint32_t *task_ref,
+                  const Worker *worker = nullptr, bool strict = false);
+    bool popShareReady(WorkerGroup *group, uint32_t *task_ref);
+    bool popPlaced(WorkerGroup *group, uint8_t core_class, uint32_t *task_ref);
+    void splitCoreClasses(const uint32_t *num_class_cpus);
+    uint32_t numReady(WorkerGroup *group);
+    void finishShareTask(uint16_t share_group);
+    void runReadyTask(uint32_t task_ref);
+    void parkWorker(Worker *worker, WaitFor *wf);
+    void spinWorker(Worker *worker);
+    void flushCounterBatch(TLS *d);
+    bool stealSpawned(Worker *thief, bool strict = false);
+    static void runSpawned(SpawnScope::Node *node);
+    uint32_t counter_batch_threshold_ = 0; // see releaseCounter
 
     Worker *workers_ = nullptr;
-    IndexQueue ready_tasks_;
+    Atomic<Worker*> timer_watcher_; // parked worker in charge of the timers
+    uint16_t num_workers_ = 0;
+    WorkerGroup *groups_ = nullptr;
+    Atomic<uint32_t> external_slots_; // see workerLocalIndex
+    uint32_t external_generation_ = 0; // incremented by init
+    bool hybrid_ = false; // see SchedulerParams::core_aware
 
     static void WorkerThreadMain(Scheduler *schd, Worker *);
+    static bool PinThread(std::thread *thread, const uint32_t *cpus, uint32_t num_cpus);
+    static void SnapshotThreadMain(Scheduler *schd);
 #endif 
 
+#if PX_SCHED_IMP_SINGLE_THREAD
+    // ready tasks (ring buffer of max_number_tasks), executed by drain
+    uint32_t *ready_ = nullptr;
+    uint32_t ready_begin_ = 0;
+    uint32_t ready_count_ = 0;
+    bool draining_ = false;
+    uint32_t drain(uint32_t max_tasks);
+#endif
+
 
   };
 
-  //-- Optional: Mutex template to encapsultae scheduler notification ----------
-  template<class M>
-  class Mutex {
+  //-- Pipeline ---------------------------------------------------------------
+  // Tokens flow through a list of stages (i.e. read -> decompress -> upload),
+  // only max_tokens can be in flight, the first stage (input) doesn't start a
+  // new token until one of them leaves the pipeline. Serial stages process
+  // one token at a time in input order, parallel stages process any number
+  // of them at the same time. Every stage execution is a task, executed by
+  // the worker group of the stage. Stage jobs get their token with
+  // Pipeline::current_token(), token slots are in [0, max_tokens) to be used
+  // as index of per token buffers (bounded memory).
+  class Pipeline {
   public:
+    enum StageMode {
+      kSerial,
+      kParallel
+    };
 
-    ~Mutex() { lock(); }
+    struct Token {
+      uint32_t slot = 0;     // index of the token, [0, max_tokens)
+      uint64_t sequence = 0; // position of the token in the input
+      bool end = false;      // set by the input stage when there is no more input
+    };
 
-    void lock() {
-      std::thread::id tid = std::this_thread::get_id();
-      if (owner_ == tid) {
-        count_++;
-        return;
-      }
-      Scheduler::CurrentThreadBeforeLockResource(&mutex_);
-      mutex_.lock();
-      owner_ = tid;
-      count_ = 1;
-      Scheduler::CurrentThreadAfterLockResource(true);
-    }
-    void unlock() {
-      std::thread::id tid = std::this_thread::get_id();
-      PX_SCHED_CHECK_FN(owner_ == tid, "Invalid Mutex::unlock owner mistmatch");
-      count_--;
-      if (count_ == 0) {
-        owner_ = std::thread::id();
-        Scheduler::CurrentThreadReleasesResource(&mutex_);
-        mutex_.unlock();
-      }
-    }
+    Pipeline() = default;
+    ~Pipeline();
+
+    // the first stage is the input stage, it is always serial
+    void addStage(StageMode mode, const Job &job, uint16_t worker_group = 0);
+
+    // starts the pipeline, out_sync_obj is pending until the input ends and
+    // all tokens leave the pipeline
+    void run(Scheduler *schd, uint32_t max_tokens, Sync *out_sync_obj);
+
+    // token of the stage executed by the current thread
+    static Token *current_token();
 
-    bool try_lock() {
-      std::thread::id tid = std::this_thread::get_id();
-      if (owner_ == tid) {
-        count_++;
-        return true;
-      }
-      Scheduler::CurrentThreadBeforeLockResource(&mutex_);
-      bool result = mutex_.try_lock();
-      if (result) {
-        owner_ = tid;
-        count_ = 1;
-      }
-      Scheduler::CurrentThreadAfterLockResource(result);
-      return result;
-    }
+  private:
+    Pipeline(const Pipeline &) = delete;
+    Pipeline& operator=(const Pipeline &) = delete;
+
+    struct Stage {
+      Job job;
+      StageMode mode = kSerial;
+      uint16_t worker_group = 0;
+      uint64_t next_sequence = 0; // serial stages
+      bool busy = false;          // serial stages
+    };
+    struct Slot {
+      Token token;
+      Pipeline *pipeline = nullptr;
+      uint32_t stage = 0;
+      bool in_use = false;
+      bool waiting = false; // for its turn on a serial stage
+    };
+    static const uint32_t kMaxLaunches = 3;
+    static void StageTask(Scheduler *schd, uintptr_t slot);
+    void stageDone(Slot *slot);
+    void admit(Slot **launches, uint32_t *num_launches);
+    void dispatch(uint32_t stage, Slot **launches, uint32_t *num_launches);
+    void launch(Slot *slot);
+    void lock() { while(lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); } }
+    void unlock() { lock_.clear(std::memory_order_release); }
+
+    Stage stages_[PX_SCHED_PIPELINE_MAX_STAGES];
+    uint32_t num_stages_ = 0;
+    Scheduler *schd_ = nullptr;
+    Slot *slots_ = nullptr;
+    uint32_t max_tokens_ = 0;
+    uint32_t in_flight_ = 0;
+    uint64_t next_input_ = 0;
+    bool input_end_ = false;
+    bool running_ = false;
+    Sync sync_;
+    std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+  #if PX_SCHED_IMP_SINGLE_THREAD
+    // stages are executed right away, launches are queued to avoid recursion
+    Slot **queue_ = nullptr;
+    uint32_t queue_begin_ = 0;
+    uint32_t queue_size_ = 0;
+    bool draining_ = false;
+  #endif
+  };
+
+  //-- Channel ----------------------------------------------------------------
+  // Bounded lock-free MPMC queue (storage from the MemCallbacks of the
+  // scheduler). Instead of polling, a consumer job can be set: it is launched
+  // as a task when data arrives, and it should receive until the channel is
+  // empty. Only one consumer task is executed at a time (MPSC). send blocks
+  // while the channel is full, notifying the scheduler so another worker can
+  // take its place (the consumer must be able to run, ideally on another
+  // worker group). The destructor waits for the consumer task to finish.
+  template<class T>
+  class Channel {
+  public:
+    Channel() = default;
+    ~Channel();
+
+    // capacity is rounded up to a power of two
+    void init(Scheduler *schd, uint32_t capacity);
+    void reset();
+
+    void setConsumer(const Job &job, uint16_t worker_group = 0);
+
+    bool trySend(const T &value);
+    void send(const T &value);
+    bool tryReceive(T *out_value);
+
+    bool empty() const;
+    uint32_t capacity() const { return static_cast<uint32_t>(mask_ + 1); }
+
+  private:
+    Channel(const Channel &) = delete;
+    Channel& operator=(const Channel &) = delete;
+    struct Cell {
+      Atomic<size_t> sequence;
+      T value;
+    };
+    static void ConsumerTask(Scheduler *schd, uintptr_t channel);
+    void notifyConsumer();
+
+    Scheduler *schd_ = nullptr;
+    Cell *cells_ = nullptr;
+    size_t mask_ = 0;
+    Atomic<size_t> send_pos_;
+    CacheLinePadding<PX_SCHED_CACHE_LINE_SIZE> padding_;
+    Atomic<size_t> receive_pos_;
+    Job consumer_;
+    bool has_consumer_ = false;
+    uint16_t consumer_group_ = 0;
+    Atomic<uint32_t> consumer_scheduled_;
+    Atomic<uint32_t> consumer_tasks_; // launched and not finished
+    // producers waiting for room
+    Atomic<uint32_t> waiting_;
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+  };
+
+  //-- WorkerLocal ------------------------------------------------------------
+  // One instance of T per worker, plus one per external thread that uses it
+  // (see SchedulerParams::max_external_threads), each in its own cache line.
+  // Tasks accumulate into local() without contention, and the instances are
+  // merged with combine/forEach once the tasks are finished. An instance is
+  // created from the initial value the first time its thread uses it.
+  //
+  //   px_sched::WorkerLocal<uint64_t> sum;
+  //   sum.init(&schd);
+  //   ... tasks: sum.local() += value;
+  //   schd.waitFor(s);
+  //   uint64_t total = sum.combine([](uint64_t a, uint64_t b) { return a + b; });
+  template<class T>
+  class WorkerLocal {
+  public:
+    WorkerLocal() = default;
+    ~WorkerLocal();
+
+    void init(Scheduler *schd, const T &initial = T());
+    void reset();
+
+    // instance of the current thread
+    T &local();
+
+    // the rest are not thread safe, call them when no task uses local()
+    // calls f(T&) with each instance used
+    template<class F>
+    void forEach(const F &f);
+    // reduces the instances used with f(const T&, const T&) -> T, returns
+    // the initial value if none was used
+    template<class F>
+    T combine(const F &f) const;
+    // all the instances are unused again
+    void clear();
+
+  private:
+    WorkerLocal(const WorkerLocal &) = delete;
+    WorkerLocal& operator=(const WorkerLocal &) = delete;
+    struct E {
+      T value;
+      bool used;
+    };
+#if PX_SCHED_CACHE_LINE_SIZE
+    // Avoid false sharing between threads
+    static const size_t PADDING_ADJUSTMENT =
+        ( PX_SCHED_CACHE_LINE_SIZE - (sizeof(E)%PX_SCHED_CACHE_LINE_SIZE)
+        ) % PX_SCHED_CACHE_LINE_SIZE;
+    struct D : E, CacheLinePadding<PADDING_ADJUSTMENT> {};
+#else
+    struct D : E {};
+#endif
+
+    Scheduler *schd_ = nullptr;
+    void *memory_ = nullptr;
+    D *data_ = nullptr; // memory_ aligned to the cache line
+    uint32_t size_ = 0;
+    T initial_ = T();
+  };
+
+  //-- Graph ------------------------------------------------------------------
+  // Task graph whose shape is known at compile time (i.e. the fixed stages of
+  // a frame). Nodes are functor types, executed as tasks once the nodes they
+  // depend on (After<...>) are finished. Dependencies must be declared before
+  // the node, so graphs can't have cycles. Dependency counts, successors and
+  // the storage of the functors are computed at compile time: a run doesn't
+  // create jobs, sync objects or counters, only one task per node, and
+  // out_sync_obj is released when every node is finished.
+  //
+  //   struct Input   { void operator()() { ... } };
+  //   struct Physics { float dt; void operator()() { ... } };
+  //   ...
+  //   px_sched::Graph<px_sched::Node<Input>,
+  //                   px_sched::Node<Physics, px_sched::After<Input>>,
+  //                   px_sched::Node<Audio, px_sched::After<Input>>,
+  //                   px_sched::Node<Render, px_sched::After<Physics, Audio>>> frame;
+  //   frame.get<Physics>().dt = dt;
+  //   frame.run(&schd, &sync);
+  //   schd.waitFor(sync);
+  template<class... Types>
+  struct After {};
+
+  template<class T, class Dependencies = After<>>
+  struct Node {
+    typedef T Type;
+    typedef Dependencies Deps;
+  };
+
+  // compile time helpers of Graph
+  template<uint32_t... Is>
+  struct GraphSequence {};
+
+  template<uint32_t N, uint32_t... Is>
+  struct GraphMakeSequence : GraphMakeSequence<N - 1, N - 1, Is...> {};
+
+  template<uint32_t... Is>
+  struct GraphMakeSequence<0, Is...> {
+    typedef GraphSequence<Is...> type;
+  };
+
+  template<class A, class B>
+  struct GraphSame { static const bool value = false; };
+
+  template<class A>
+  struct GraphSame<A, A> { static const bool value = true; };
+
+  // index of the node of type T (sizeof...(Nodes) if there is none)
+  template<class T, class... Nodes>
+  struct GraphIndexOf { static const uint32_t value = 0; };
+
+  template<class T, class N, class... Nodes>
+  struct GraphIndexOf<T, N, Nodes...> {
+    static const uint32_t value = GraphSame<T, typename N::Type>::value?
+        0 : 1 + GraphIndexOf<T, Nodes...>::value;
+  };
+
+  template<uint32_t I, class... Nodes>
+  struct GraphNodeAt;
+
+  template<class N, class... Nodes>
+  struct GraphNodeAt<0, N, Nodes...> { typedef N type; };
+
+  template<uint32_t I, class N, class... Nodes>
+  struct GraphNodeAt<I, N, Nodes...> : GraphNodeAt<I - 1, Nodes...> {};
+
+  // bit mask and number of the dependencies
+  template<class Deps, class... Nodes>
+  struct GraphDeps {
+    static const uint64_t mask = 0;
+    static const uint32_t count = 0;
+  };
+
+  template<class D, class... Ds, class... Nodes>
+  struct GraphDeps<After<D, Ds...>, Nodes...> {
+    static const uint32_t index = GraphIndexOf<D, Nodes...>::value;
+    static_assert(index < sizeof...(Nodes), "Dependency is not a node of the graph");
+    static_assert(((GraphDeps<After<Ds...>, Nodes...>::mask >> index) & 1) == 0,
+        "Repeated dependency");
+    static const uint64_t mask = (uint64_t(1) << index) | GraphDeps<After<Ds...>, Nodes...>::mask;
+    static const uint32_t count = 1 + GraphDeps<After<Ds...>, Nodes...>::count;
+  };
+
+  template<uint32_t I, class... Nodes>
+  struct GraphNodeInfo {
+    typedef typename GraphNodeAt<I, Nodes...>::type N;
+    typedef GraphDeps<typename N::Deps, Nodes...> Deps;
+    static_assert(GraphIndexOf<typename N::Type, Nodes...>::value == I, "Repeated node type");
+    static_assert((Deps::mask >> I) == 0, "Dependencies must be declared before the node");
+  };
+
+  // nodes from J that depend on node I (bit mask)
+  template<uint32_t I, uint32_t J, class... Nodes>
+  struct GraphSuccessors {
+    static const uint64_t mask =
+        (((GraphNodeInfo<J, Nodes...>::Deps::mask >> I) & 1) << J) |
+        GraphSuccessors<I, J + 1, Nodes...>::mask;
+  };
+
+  template<uint32_t I, class... Nodes>
+  struct GraphSuccessors<I, sizeof...(Nodes), Nodes...> {
+    static const uint64_t mask = 0;
+  };
+
+  template<uint32_t I, class T>
+  struct GraphSlot { T value; };
+
+  template<class Sequence, class... Nodes>
+  struct GraphStorage;
+
+  template<uint32_t... Is, class... Nodes>
+  struct GraphStorage<GraphSequence<Is...>, Nodes...> : GraphSlot<Is, typename Nodes::Type>... {};
+
+  template<class... Nodes>
+  class Graph {
+  public:
+    static const uint32_t kNumNodes = sizeof...(Nodes);
+    static_assert(kNumNodes > 0 && kNumNodes <= 64, "Graphs have from 1 to 64 nodes");
+
+    Graph() = default;
+    ~Graph();
+
+    // functor of the node of type T
+    template<class T>
+    T &get();
+
+    // launches the nodes without dependencies (with task_params), the rest
+    // are launched as their dependencies finish. out_sync_obj (optional) is
+    // pending until every node is finished, the graph can't be run again
+    // until then.
+    void run(Scheduler *schd, Sync *out_sync_obj, const TaskParams &task_params = TaskParams());
+    bool running() const { return pending_nodes_.load() != 0; }
+
+  private:
+    Graph(const Graph &) = delete;
+    Graph& operator=(const Graph &) = delete;
+    typedef typename GraphMakeSequence<kNumNodes>::type Sequence;
+    struct Tables {
+      uint32_t num_deps[kNumNodes];
+      uint64_t successors[kNumNodes];
+      void (*task[kNumNodes])(Scheduler *, uintptr_t);
+    };
+    template<uint32_t... Is>
+    static const Tables &tables(GraphSequence<Is...>);
+    template<uint32_t I>
+    static void NodeTask(Scheduler *schd, uintptr_t graph);
+    void nodeDone(uint32_t node);
+
+    GraphStorage<Sequence, Nodes...> storage_;
+    Atomic<uint32_t> pending_deps_[kNumNodes];
+    Atomic<uint32_t> pending_nodes_;
+    Scheduler *schd_ = nullptr;
+    Sync sync_;
+    bool has_sync_ = false;
+    TaskParams task_params_;
+  };
+
+  //-- Optional: Mutex template to encapsultae scheduler notification ----------
+  template<class M>
+  class Mutex {
+  public:
+    explicit Mutex(const char *name = nullptr) : name_(name) {}
+
+    // waits for the current owner, and unlocks to keep the count of locks
+    // held by the thread (see Scheduler::CurrentThreadHoldsLock) balanced
+    ~Mutex() { lock(); unlock(); }
+
+    void lock() {
+      std::thread::id tid = std::this_thread::get_id();
+      if (owner_ == tid) {
+        count_++;
+        return;
+      }
+      // the scheduler is only notified if the thread is going to wait:
+      // notifying it wakes up another worker, and the lock profiler would
+      // count every acquisition as contended
+      if (mutex_.try_lock()) {
+        owner_ = tid;
+        count_ = 1;
+        Scheduler::CurrentThreadLockedResource(&mutex_, name_);
+        Scheduler::CurrentThreadHoldsLock();
+        return;
+      }
+      Scheduler::CurrentThreadBeforeLockResource(&mutex_, name_);
+      mutex_.lock();
+      owner_ = tid;
+      count_ = 1;
+      Scheduler::CurrentThreadAfterLockResource(true);
+      Scheduler::CurrentThreadHoldsLock();
+    }
+    void unlock() {
+      std::thread::id tid = std::this_thread::get_id();
+      PX_SCHED_CHECK_FN(owner_ == tid, "Invalid Mutex::unlock owner mistmatch");
+      count_--;
+      if (count_ == 0) {
+        owner_ = std::thread::id();
+        Scheduler::CurrentThreadDropsLock();
+        Scheduler::CurrentThreadReleasesResource(&mutex_);
+        mutex_.unlock();
+      }
+    }
+
+    bool try_lock() {
+      std::thread::id tid = std::this_thread::get_id();
+      if (owner_ == tid) {
+        count_++;
+        return true;
+      }
+      bool result = mutex_.try_lock();
+      if (result) {
+        owner_ = tid;
+        count_ = 1;
+        Scheduler::CurrentThreadLockedResource(&mutex_, name_);
+        Scheduler::CurrentThreadHoldsLock();
+      }
+      return result;
+    }
   private:
     std::thread::id owner_ ;
     uint32_t count_ = 0;
+    const char *name_;
     M mutex_;
   };
 
+  //-- Optional: SpinWait ------------------------------------------------------
+  // Wait loop of the locks below: spins with pause instructions (exponential
+  // backoff) and then yields the thread. Once it starts yielding the
+  // scheduler is notified, so another worker can take the place of this one.
+  class SpinWait {
+  public:
+    SpinWait(const void *resource, const char *name) : resource_(resource), name_(name) {}
+
+    void wait() {
+#if PX_SCHED_IMP_TRACK_LOCKS
+      if (spins_ == 1) start_ = std::chrono::steady_clock::now();
+#endif
+      if (spins_ <= kMaxSpins) {
+        for(uint32_t i = 0; i < spins_; ++i) { PX_SCHED_CPU_PAUSE(); }
+        spins_ <<= 1;
+        return;
+      }
+      if (!notified_) {
+        Scheduler::CurrentThreadBeforeLockResource(resource_, name_);
+        notified_ = true;
+      }
+      std::this_thread::yield();
+    }
+
+    // call it once the lock is adquired, returns true if the scheduler was
+    // notified (CurrentThreadReleasesResource must be called on unlock)
+    bool adquired() {
+      if (notified_) {
+        Scheduler::CurrentThreadAfterLockResource(true);
+        return true;
+      }
+#if PX_SCHED_IMP_TRACK_LOCKS
+      uint64_t wait_ns = 1;
+      if (spins_ > 1) {
+        wait_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+      }
+      Scheduler::CurrentThreadLockedResource(resource_, name_, wait_ns);
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    // call it when the lock is adquired without waiting, same result as adquired
+    static bool adquiredNoWait(const void *resource, const char *name) {
+#if PX_SCHED_IMP_TRACK_LOCKS
+      Scheduler::CurrentThreadLockedResource(resource, name);
+      return true;
+#else
+      (void)resource;
+      (void)name;
+      return false;
+#endif
+    }
+
+  private:
+    static const uint32_t kMaxSpins = 64;
+    const void *resource_;
+    const char *name_;
+    uint32_t spins_ = 1;
+    bool notified_ = false;
+#if PX_SCHED_IMP_TRACK_LOCKS
+    std::chrono::steady_clock::time_point start_;
+#endif
+  };
+
   //-- Optional: Spinlock ------------------------------------------------------
   class Spinlock {
   public:
@@ -570,10 +2150,18 @@ namespace px_sched {
 
     ~Spinlock() {
       lock();
+      unlock();
     }
 
     void lock() {
-      while(!try_lock()) { std::this_thread::yield(); }
+      if (try_lock()) return;
+      std::thread::id tid = std::this_thread::get_id();
+      SpinWait w(this, "Spinlock");
+      do {
+        // test before the test-and-set, waiting doesn't write the cache line
+        while (!(owner_ == std::thread::id())) w.wait();
+      } while (!adquire(tid));
+      notified_ = w.adquired();
     }
 
     void unlock() {
@@ -581,6 +2169,11 @@ namespace px_sched {
       PX_SCHED_CHECK_FN(owner_ == tid, "Invalid Spinlock::unlock owner mistmatch");
       count_--;
       if (count_ == 0) {
+        Scheduler::CurrentThreadDropsLock();
+        if (notified_) {
+          notified_ = false;
+          Scheduler::CurrentThreadReleasesResource(this);
+        }
         owner_.store(std::thread::id());
       }
     }
@@ -591,55 +2184,649 @@ namespace px_sched {
         count_++;
         return true;
       }
+      if (adquire(tid)) {
+        notified_ = SpinWait::adquiredNoWait(this, "Spinlock");
+        return true;
+      }
+      return false;
+    }
+  private:
+    bool adquire(std::thread::id tid) {
       std::thread::id expected;
       if (owner_.compare_exchange_weak(expected, tid)) {
         count_ = 1;
+        Scheduler::CurrentThreadHoldsLock();
         return true;
       }
       return false;
     }
-  private:
+
     Atomic<std::thread::id> owner_ ;
     uint32_t count_;
+    bool notified_ = false;
   };
 
-  //-- Object pool implementation ----------------------------------------------
-  template<class T>
-  inline ObjectPool<T>::~ObjectPool() {
-    reset();
+  //-- Optional: TTASLock ------------------------------------------------------
+  // Test-and-test-and-set lock, the simplest and fastest without contention
+  // (not recursive, not fair)
+  class TTASLock {
+  public:
+    void lock() {
+      if (try_lock()) return;
+      SpinWait w(this, "TTASLock");
+      do {
+        while (locked_.load(std::memory_order_relaxed)) w.wait();
+      } while (locked_.exchange(true, std::memory_order_acquire));
+      notified_ = w.adquired();
+      Scheduler::CurrentThreadHoldsLock();
+    }
+
+    bool try_lock() {
+      if (locked_.load(std::memory_order_relaxed) ||
+          locked_.exchange(true, std::memory_order_acquire)) {
+        return false;
+      }
+      notified_ = SpinWait::adquiredNoWait(this, "TTASLock");
+      Scheduler::CurrentThreadHoldsLock();
+      return true;
+    }
+
+    void unlock() {
+      Scheduler::CurrentThreadDropsLock();
+      if (notified_) {
+        notified_ = false;
+        Scheduler::CurrentThreadReleasesResource(this);
+      }
+      locked_.store(false, std::memory_order_release);
+    }
+  private:
+    std::atomic<bool> locked_ = {false};
+    bool notified_ = false; // only accessed by the owner
+  };
+
+  //-- Optional: TicketLock ----------------------------------------------------
+  // FIFO lock, threads adquire it in the order they called lock (fair, but
+  // all waiters spin on the same cache line)
+  class TicketLock {
+  public:
+    void lock() {
+      uint32_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+      if (serving_.load(std::memory_order_acquire) == ticket) {
+        notified_ = SpinWait::adquiredNoWait(this, "TicketLock");
+        Scheduler::CurrentThreadHoldsLock();
+        return;
+      }
+      SpinWait w(this, "TicketLock");
+      while (serving_.load(std::memory_order_acquire) != ticket) w.wait();
+      notified_ = w.adquired();
+      Scheduler::CurrentThreadHoldsLock();
+    }
+
+    bool try_lock() {
+      uint32_t serving = serving_.load(std::memory_order_acquire);
+      uint32_t expected = serving;
+      if (!next_.compare_exchange_strong(expected, serving + 1,
+            std::memory_order_acquire, std::memory_order_relaxed)) {
+        return false;
+      }
+      notified_ = SpinWait::adquiredNoWait(this, "TicketLock");
+      Scheduler::CurrentThreadHoldsLock();
+      return true;
+    }
+
+    void unlock() {
+      Scheduler::CurrentThreadDropsLock();
+      if (notified_) {
+        notified_ = false;
+        Scheduler::CurrentThreadReleasesResource(this);
+      }
+      serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+  private:
+    std::atomic<uint32_t> next_ = {0};
+    std::atomic<uint32_t> serving_ = {0};
+    bool notified_ = false; // only accessed by the owner
+  };
+
+  //-- Optional: MCSLock -------------------------------------------------------
+  // Queue lock, each waiter spins on its own node (fair, and scales with
+  // many threads). Nodes are taken from the thread, a thread can hold up to
+  // PX_SCHED_MCS_MAX_LOCKS at the same time.
+  class MCSLock {
+  public:
+    struct Node {
+      std::atomic<Node*> next;
+      std::atomic<bool> locked;
+    };
+
+    void lock();
+    bool try_lock();
+    void unlock();
+  private:
+    static Node *allocNode();
+    static void freeNode(Node *node);
+    std::atomic<Node*> tail_ = {nullptr};
+    Node *owner_node_ = nullptr; // only accessed by the owner
+    bool notified_ = false;      // only accessed by the owner
+  };
+
+  //-- Resource ---------------------------------------------------------------
+  // Data accessed by tasks (see Scheduler::run with accesses), it keeps the
+  // sync objects of the last writer and of the readers since then.
+  class Resource {
+  public:
+    Resource() {}
+  private:
+    Resource(const Resource&) = delete;
+    Resource& operator=(const Resource&) = delete;
+    friend class Scheduler;
+    Sync writer_;
+    Sync readers_;
+    TTASLock lock_;
+  };
+
+  inline Access read(Resource &resource) {
+    Access access = {&resource, false};
+    return access;
   }
-  
-  template<class T>
-  void ObjectPool<T>::newElement(uint32_t pos) const {
-    new (&data_[pos].element) T;
-    in_use_.fetch_add(1);
+
+  inline Access write(Resource &resource) {
+    Access access = {&resource, true};
+    return access;
+  }
+
+  //-- Latch ------------------------------------------------------------------
+  // Single use countdown, wait returns once countDown was called count times
+  class Latch {
+  public:
+    explicit Latch(uint32_t count) : count_(count) {}
+    void countDown(uint32_t n = 1) {
+      parker_.update([this, n] {
+        uint32_t prev = count_.fetch_sub(n);
+        PX_SCHED_CHECK_FN(prev >= n, "Latch counted down below zero");
+        return prev == n;
+      });
+    }
+    bool tryWait() const { return count_.load() == 0; }
+    void wait() { parker_.waitUntil([this] { return count_.load() == 0; }); }
+    void arriveAndWait(uint32_t n = 1) { countDown(n); wait(); }
+  private:
+    Latch(const Latch&) = delete;
+    Latch& operator=(const Latch&) = delete;
+    std::atomic<uint32_t> count_;
+    Parker parker_;
+  };
+
+  //-- Barrier ----------------------------------------------------------------
+  // Reusable barrier of num_threads threads, arriveAndWait returns once all
+  // of them arrived
+  class Barrier {
+  public:
+    explicit Barrier(uint32_t num_threads) : num_threads_(num_threads) {}
+    uint32_t num_threads() const { return num_threads_; }
+    void arriveAndWait() {
+      const uint32_t generation = generation_.load();
+      bool last = false;
+      parker_.update([this, generation, &last] {
+        last = (arrived_.fetch_add(1) + 1 == num_threads_);
+        if (last) {
+          arrived_.store(0);
+          generation_.store(generation + 1);
+        }
+        return last;
+      });
+      if (!last) parker_.waitUntil([this, generation] { return generation_.load() != generation; });
+    }
+  private:
+    Barrier(const Barrier&) = delete;
+    Barrier& operator=(const Barrier&) = delete;
+    const uint32_t num_threads_;
+    std::atomic<uint32_t> arrived_ = {0};
+    std::atomic<uint32_t> generation_ = {0};
+    Parker parker_;
+  };
+
+  //-- Limiter ----------------------------------------------------------------
+  // Limits the number of tasks running at the same time (decompressors with
+  // big scratch buffers, a rate limited service...), attached to the tasks
+  // with TaskParams::limiter. Tasks over the limit wait inside the limiter,
+  // not in the ready queue, and are queued as slots are freed: no worker
+  // blocks. The limiter must outlive its tasks.
+  class Limiter {
+  public:
+    explicit Limiter(uint32_t max_running_tasks = 1) : max_running_(max_running_tasks) {}
+    ~Limiter() {
+      PX_SCHED_CHECK_FN(running_.load() == 0 && waiting_.load() == 0,
+          "Limiter destroyed with tasks attached (%u running, %u waiting)",
+          running_.load(), waiting_.load());
+    }
+
+    uint32_t max_running_tasks() const { return max_running_; }
+    uint32_t running_tasks() const { return running_.load(); }
+    uint32_t waiting_tasks() const { return waiting_.load(); }
+  private:
+    Limiter(const Limiter&) = delete;
+    Limiter& operator=(const Limiter&) = delete;
+    friend class Scheduler;
+    const uint32_t max_running_;
+    Atomic<uint32_t> running_;
+    Atomic<uint32_t> waiting_;
+    // waiting tasks, linked through Task::next_sibling_task
+    uint32_t head_ = 0;
+    uint32_t tail_ = 0;
+    TTASLock lock_;
+  };
+
+  //-- Team -------------------------------------------------------------------
+  // Context of a member of a team (see Scheduler::runTeam)
+  class Team {
+  public:
+    uint32_t index() const { return index_; } // in [0, size)
+    uint32_t size() const;
+    // waits until all the members of the team reach the barrier
+    void barrier();
+    // member executed by the current thread, nullptr outside of teams
+    static Team *current();
+  private:
+    Team() {}
+    Team(const Team&) = delete;
+    Team& operator=(const Team&) = delete;
+    friend class Scheduler;
+    Scheduler::TeamState *state_ = nullptr;
+    uint32_t index_ = 0;
+  };
+
+  //-- SchedulerParams implementation -----------------------------------------
+  inline uint16_t SchedulerParams::addWorkerGroup(const char *name,
+      uint16_t group_num_threads, uint16_t group_max_running_threads) {
+    PX_SCHED_CHECK_FN(num_worker_groups < PX_SCHED_MAX_WORKER_GROUPS,
+        "Too many worker groups (max %d), see PX_SCHED_MAX_WORKER_GROUPS",
+        PX_SCHED_MAX_WORKER_GROUPS);
+    PX_SCHED_CHECK_FN(group_num_threads > 0, "Worker groups need at least one thread");
+    WorkerGroupParams &g = worker_groups[num_worker_groups];
+    g.name = name;
+    g.num_threads = group_num_threads;
+    g.max_running_threads = group_max_running_threads;
+    return num_worker_groups++;
+  }
+
+  inline uint16_t SchedulerParams::addLatencyGroup(const char *name,
+      uint16_t group_num_threads, int32_t first_cpu) {
+    uint16_t group = addWorkerGroup(name, group_num_threads);
+    worker_groups[group].spinning = true;
+    worker_groups[group].first_cpu = first_cpu;
+    latency_group = group;
+    return group;
+  }
+
+  inline uint16_t SchedulerParams::addShareGroup(const char *name, uint32_t weight,
+      uint16_t max_running_tasks) {
+    PX_SCHED_CHECK_FN(num_share_groups < PX_SCHED_MAX_SHARE_GROUPS,
+        "Too many share groups (max %d), see PX_SCHED_MAX_SHARE_GROUPS",
+        PX_SCHED_MAX_SHARE_GROUPS);
+    PX_SCHED_CHECK_FN(weight > 0, "Share groups need a weight greater than 0");
+    ShareGroupParams &g = share_groups[num_share_groups];
+    g.name = name;
+    g.weight = weight;
+    g.max_running_tasks = max_running_tasks;
+    return num_share_groups++;
   }
 
+  //-- Channel implementation -------------------------------------------------
   template<class T>
-  void ObjectPool<T>::deleteElement(uint32_t pos) const {
-    data_[pos].element.~T();
-    in_use_.fetch_sub(1);
+  inline Channel<T>::~Channel() {
+    reset();
   }
 
   template<class T>
-  inline void ObjectPool<T>::init(uint32_t count, const MemCallbacks &mem_cb) {
+  inline void Channel<T>::init(Scheduler *schd, uint32_t capacity) {
     reset();
-    mem_ = mem_cb;
-    data_ = static_cast<D*>(mem_.alloc_fn(sizeof(D)*count));
-    for(uint32_t i = 0; i < count; ++i) {
-      data_[i].state.store(0xFFFu<< kVerDisp);
+    schd_ = schd;
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    mask_ = size - 1;
+    cells_ = static_cast<Cell*>(schd_->params().mem_callbacks.alloc_fn(sizeof(Cell)*size));
+    for(size_t i = 0; i < size; ++i) {
+      new (&cells_[i]) Cell();
+      cells_[i].sequence.store(i);
     }
-    count_ = count;
-    next_.store(0);
+    send_pos_.store(0);
+    receive_pos_.store(0);
+    consumer_scheduled_.store(0);
+    consumer_tasks_.store(0);
+    waiting_.store(0);
   }
 
   template<class T>
-  inline void ObjectPool<T>::reset() {
-    count_ = 0;
-    next_.store(0);
-    if (data_) {
-      mem_.free_fn(data_);
-      data_ = nullptr;
+  inline void Channel<T>::reset() {
+    if (cells_) {
+      // wait for the consumer task, it might be finishing
+      while (consumer_tasks_.load()) std::this_thread::yield();
+      for(size_t i = 0; i <= mask_; ++i) cells_[i].~Cell();
+      schd_->params().mem_callbacks.free_fn(cells_);
+      cells_ = nullptr;
+    }
+  }
+
+  template<class T>
+  inline void Channel<T>::setConsumer(const Job &job, uint16_t worker_group) {
+    consumer_ = job;
+    consumer_group_ = worker_group;
+    has_consumer_ = true;
+    if (!empty()) notifyConsumer();
+  }
+
+  template<class T>
+  inline bool Channel<T>::trySend(const T &value) {
+    size_t pos = send_pos_.load();
+    Cell *cell;
+    for(;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load();
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (send_pos_.compare_exchange_weak(pos, pos + 1)) break;
+      } else if (diff < 0) {
+        return false; // full
+      } else {
+        pos = send_pos_.load();
+      }
+    }
+    cell->value = value;
+    cell->sequence.store(pos + 1);
+    notifyConsumer();
+    return true;
+  }
+
+  template<class T>
+  inline void Channel<T>::send(const T &value) {
+    if (trySend(value)) return;
+    PX_SCHED_TRACE_FN("ChannelFull");
+  #if PX_SCHED_IMP_SINGLE_THREAD
+    // the consumer might be waiting in the ready queue
+    while (!trySend(value)) {
+      if (!schd_->pump(1)) {
+        PX_SCHED_CHECK_FN(false, "Channel full, on SingleThreaded mode nothing can receive from it");
+        return;
+      }
+    }
+  #else
+    Scheduler::CurrentThreadSleeps();
+    {
+      std::unique_lock<std::mutex> lk(mutex_);
+      waiting_.fetch_add(1);
+      while (!trySend(value)) condition_variable_.wait(lk);
+      waiting_.fetch_sub(1);
+    }
+    Scheduler::CurrentThreadWakesUp();
+  #endif
+  }
+
+  template<class T>
+  inline bool Channel<T>::tryReceive(T *out_value) {
+    size_t pos = receive_pos_.load();
+    Cell *cell;
+    for(;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load();
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (receive_pos_.compare_exchange_weak(pos, pos + 1)) break;
+      } else if (diff < 0) {
+        return false; // empty
+      } else {
+        pos = receive_pos_.load();
+      }
+    }
+    *out_value = cell->value;
+    cell->sequence.store(pos + mask_ + 1);
+    if (waiting_.load()) {
+      std::lock_guard<std::mutex> lk(mutex_);
+      condition_variable_.notify_all();
+    }
+    return true;
+  }
+
+  template<class T>
+  inline bool Channel<T>::empty() const {
+    size_t pos = receive_pos_.load();
+    return cells_[pos & mask_].sequence.load() != pos + 1;
+  }
+
+  template<class T>
+  inline void Channel<T>::notifyConsumer() {
+    if (has_consumer_ && consumer_scheduled_.exchange(1) == 0) {
+      consumer_tasks_.fetch_add(1);
+      TaskParams task_params;
+      task_params.worker_group = consumer_group_;
+      schd_->runCall(ConsumerTask, reinterpret_cast<uintptr_t>(this), task_params);
+    }
+  }
+
+  template<class T>
+  inline void Channel<T>::ConsumerTask(Scheduler *, uintptr_t channel) {
+    PX_SCHED_TRACE_FN("ChannelConsumer");
+    Channel *c = reinterpret_cast<Channel*>(channel);
+    for(;;) {
+      c->consumer_();
+      c->consumer_scheduled_.store(0);
+      // data sent after the consumer finished, but before it was marked as
+      // not scheduled didn't launch a new consumer
+      if (c->empty() || c->consumer_scheduled_.exchange(1) != 0) break;
+    }
+    // the channel might be destroyed after this
+    c->consumer_tasks_.fetch_sub(1);
+  }
+
+  //-- WorkerLocal implementation ----------------------------------------------
+  template<class T>
+  inline WorkerLocal<T>::~WorkerLocal() {
+    reset();
+  }
+
+  template<class T>
+  inline void WorkerLocal<T>::init(Scheduler *schd, const T &initial) {
+    reset();
+    schd_ = schd;
+    initial_ = initial;
+    size_ = schd_->workerLocalSlots();
+    const size_t align = PX_SCHED_CACHE_LINE_SIZE? PX_SCHED_CACHE_LINE_SIZE : 1;
+    memory_ = schd_->params().mem_callbacks.alloc_fn(sizeof(D)*size_ + align);
+    uintptr_t ptr = reinterpret_cast<uintptr_t>(memory_);
+    data_ = reinterpret_cast<D*>((ptr + align - 1) & ~uintptr_t(align - 1));
+    for(uint32_t i = 0; i < size_; ++i) {
+      new (&data_[i]) D();
+      data_[i].used = false;
+    }
+  }
+
+  template<class T>
+  inline void WorkerLocal<T>::reset() {
+    if (memory_) {
+      for(uint32_t i = 0; i < size_; ++i) data_[i].~D();
+      schd_->params().mem_callbacks.free_fn(memory_);
+      memory_ = nullptr;
+      data_ = nullptr;
+    }
+    size_ = 0;
+  }
+
+  template<class T>
+  inline T &WorkerLocal<T>::local() {
+    D &d = data_[schd_->workerLocalIndex()];
+    if (!d.used) {
+      d.value = initial_;
+      d.used = true;
+    }
+    return d.value;
+  }
+
+  template<class T>
+  template<class F>
+  inline void WorkerLocal<T>::forEach(const F &f) {
+    for(uint32_t i = 0; i < size_; ++i) {
+      if (data_[i].used) f(data_[i].value);
+    }
+  }
+
+  template<class T>
+  template<class F>
+  inline T WorkerLocal<T>::combine(const F &f) const {
+    uint32_t i = 0;
+    while (i < size_ && !data_[i].used) ++i;
+    if (i == size_) return initial_;
+    T result = data_[i].value;
+    for(++i; i < size_; ++i) {
+      if (data_[i].used) result = f(result, data_[i].value);
+    }
+    return result;
+  }
+
+  template<class T>
+  inline void WorkerLocal<T>::clear() {
+    for(uint32_t i = 0; i < size_; ++i) data_[i].used = false;
+  }
+
+  //-- Scheduler templates -----------------------------------------------------
+  template<class F>
+  inline void Scheduler::runArena(const F &job, Sync *out_sync_obj, const TaskParams &task_params) {
+    PX_SCHED_TRACE_FN("RunArena");
+  #if PX_SCHED_IMP_REGULAR_THREADS
+    PX_SCHED_CHECK_FN(running_.load(), "Scheduler not running");
+  #endif
+    uint32_t t_ref = allocTask(out_sync_obj, task_params);
+    Task &task = tasks_.get(t_ref);
+    // the counter is referenced by the task
+    void *memory = task.counter_id? arenaAlloc(task.counter_id, sizeof(F), alignof(F)) : nullptr;
+    if (memory) {
+      task.call = ArenaJobTask<F>;
+      task.drop = ArenaJobDrop<F>;
+      task.call_arg = reinterpret_cast<uintptr_t>(new (memory) F(job));
+    } else {
+      task.job = job;
+    }
+    pushReady(t_ref);
+  }
+
+  template<class F>
+  inline void Scheduler::ArenaJobTask(Scheduler *, uintptr_t job) {
+    F *f = reinterpret_cast<F*>(job);
+    (*f)();
+    f->~F();
+  }
+
+  template<class F>
+  inline void Scheduler::ArenaJobDrop(uintptr_t job) {
+    reinterpret_cast<F*>(job)->~F();
+  }
+
+  //-- Graph implementation ---------------------------------------------------
+  template<class... Nodes>
+  inline Graph<Nodes...>::~Graph() {
+    PX_SCHED_CHECK_FN(!running(), "Graph destroyed while running");
+  }
+
+  template<class... Nodes>
+  template<class T>
+  inline T &Graph<Nodes...>::get() {
+    static const uint32_t index = GraphIndexOf<T, Nodes...>::value;
+    static_assert(index < kNumNodes, "Type is not a node of the graph");
+    return static_cast<GraphSlot<index, T>&>(storage_).value;
+  }
+
+  template<class... Nodes>
+  template<uint32_t... Is>
+  inline const typename Graph<Nodes...>::Tables &Graph<Nodes...>::tables(GraphSequence<Is...>) {
+    static const Tables t = {
+      {GraphNodeInfo<Is, Nodes...>::Deps::count...},
+      {GraphSuccessors<Is, 0, Nodes...>::mask...},
+      {&Graph::template NodeTask<Is>...}
+    };
+    return t;
+  }
+
+  template<class... Nodes>
+  inline void Graph<Nodes...>::run(Scheduler *schd, Sync *out_sync_obj,
+                                   const TaskParams &task_params) {
+    PX_SCHED_TRACE_FN("GraphRun");
+    PX_SCHED_CHECK_FN(!running(), "Graph already running");
+    const Tables &t = tables(Sequence());
+    schd_ = schd;
+    task_params_ = task_params;
+    has_sync_ = out_sync_obj != nullptr;
+    if (has_sync_) {
+      schd->incrementSync(out_sync_obj);
+      sync_ = *out_sync_obj;
+    }
+    for(uint32_t i = 0; i < kNumNodes; ++i) pending_deps_[i].store(t.num_deps[i]);
+    pending_nodes_.store(kNumNodes);
+    for(uint32_t i = 0; i < kNumNodes; ++i) {
+      if (t.num_deps[i] == 0) schd->runCall(t.task[i], reinterpret_cast<uintptr_t>(this), task_params);
+    }
+  }
+
+  template<class... Nodes>
+  template<uint32_t I>
+  inline void Graph<Nodes...>::NodeTask(Scheduler *, uintptr_t graph) {
+    Graph *g = reinterpret_cast<Graph*>(graph);
+    typedef typename GraphNodeAt<I, Nodes...>::type::Type T;
+    static_cast<GraphSlot<I, T>&>(g->storage_).value();
+    g->nodeDone(I);
+  }
+
+  template<class... Nodes>
+  inline void Graph<Nodes...>::nodeDone(uint32_t node) {
+    const Tables &t = tables(Sequence());
+    Scheduler *schd = schd_;
+    Sync sync = sync_;
+    const bool has_sync = has_sync_;
+    const uint64_t successors = t.successors[node];
+    for(uint32_t i = node + 1; i < kNumNodes; ++i) {
+      if (((successors >> i) & 1) && pending_deps_[i].fetch_sub(1) == 1) {
+        schd->runCall(t.task[i], reinterpret_cast<uintptr_t>(this), task_params_);
+      }
+    }
+    // the graph might be run again (or destroyed) right after this
+    if (pending_nodes_.fetch_sub(1) == 1 && has_sync) schd->decrementSync(&sync);
+  }
+
+  //-- Object pool implementation ----------------------------------------------
+  template<class T>
+  inline ObjectPool<T>::~ObjectPool() {
+    reset();
+  }
+  
+  template<class T>
+  void ObjectPool<T>::newElement(uint32_t pos) const {
+    new (&data_[pos].element) T;
+    in_use_.fetch_add(1);
+  }
+
+  template<class T>
+  void ObjectPool<T>::deleteElement(uint32_t pos) const {
+    data_[pos].element.~T();
+    in_use_.fetch_sub(1);
+  }
+
+  template<class T>
+  inline void ObjectPool<T>::init(uint32_t count, const MemCallbacks &mem_cb) {
+    reset();
+    mem_ = mem_cb;
+    data_ = static_cast<D*>(mem_.alloc_fn(sizeof(D)*count));
+    for(uint32_t i = 0; i < count; ++i) {
+      data_[i].state.store(0xFFFu<< kVerDisp);
+    }
+    count_ = count;
+    next_.store(0);
+  }
+
+  template<class T>
+  inline void ObjectPool<T>::reset() {
+    count_ = 0;
+    next_.store(0);
+    if (data_) {
+      mem_.free_fn(data_);
+      data_ = nullptr;
     }
   }
 
@@ -671,8 +2858,18 @@ namespace px_sched {
   template<class T>
   inline uint32_t ObjectPool<T>::adquireAndRef() {
     PX_SCHED_TRACE_FN("ObjectPool<T>::adquireAndRef");
+    uint32_t hnd = 0;
     uint32_t tries = 0;
-    for(;;) {
+    while (!tryAdquireAndRef(&hnd)) {
+      tries += count_;
+      PX_SCHED_CHECK_FN(tries < count_*count_, "It was not possible to find a valid index after %u tries", tries);
+    }
+    return hnd;
+  }
+
+  template<class T>
+  inline bool ObjectPool<T>::tryAdquireAndRef(uint32_t *hnd) {
+    for(uint32_t tries = 0; tries < count_; ++tries) {
       uint32_t pos = (next_.fetch_add(1)%count_);
       D& d = data_[pos];
       uint32_t version = (d.state.load() & kVerMask) >> kVerDisp;
@@ -686,256 +2883,1974 @@ namespace px_sched {
       uint32_t expected = version << kVerDisp;
       if (d.state.compare_exchange_strong(expected, newvalue)) {
         newElement(pos); //< initialize
-        return (newver << kVerDisp) | (pos & kPosMask);
+        *hnd = (newver << kVerDisp) | (pos & kPosMask);
+        return true;
       }
-      tries++;
-      // TODO... make this, optional...
-      PX_SCHED_CHECK_FN(tries < count_*count_, "It was not possible to find a valid index after %u tries", tries);
     }
+    return false;
+  }
+
+
+  template< class T>
+  inline void ObjectPool<T>::unref(uint32_t hnd) const {
+    uint32_t pos = hnd & kPosMask;
+    uint32_t ver = (hnd & kVerMask);
+    D& d = data_[pos];
+    for(;;) {
+      uint32_t prev = d.state.load();
+      uint32_t next = prev - 1;
+      PX_SCHED_CHECK_FN((prev & kVerMask) == ver,
+          "Invalid unref HND = %u(%u), Versions: %u vs %u",
+          pos, hnd, prev & kVerMask, ver);
+      PX_SCHED_CHECK_FN((prev & kRefMask) > 1,
+          "Invalid unref HND = %u(%u), invalid ref count",
+          pos, hnd);
+      if (d.state.compare_exchange_strong(prev, next)) {
+        if ((next & kRefMask) == 1) {
+          deleteElement(pos);
+          d.state.store(0);
+        }
+        return;
+      }
+    }
+  }
+
+  // decrements the counter, if the objet is no longer valid (las ref)
+  // the given function will be executed with the element
+  template<class T>
+  template<class F>
+  inline void ObjectPool<T>::unref(uint32_t hnd, F f) const {
+    unref(hnd, 1, f);
+  }
+
+  template<class T>
+  template<class F>
+  inline void ObjectPool<T>::unref(uint32_t hnd, uint32_t count, F f) const {
+    uint32_t pos = hnd & kPosMask;
+    uint32_t ver = (hnd & kVerMask);
+    D& d = data_[pos];
+    for(;;) {
+      uint32_t prev = d.state.load();
+      uint32_t next = prev - count;
+      PX_SCHED_CHECK_FN((prev & kVerMask) == ver,
+          "Invalid unref HND = %u(%u), Versions: %u vs %u",
+          pos, hnd, prev & kVerMask, ver);
+      PX_SCHED_CHECK_FN((prev & kRefMask) > count,
+          "Invalid unref HND = %u(%u), invalid ref count",
+          pos, hnd);
+      if (d.state.compare_exchange_strong(prev, next)) {
+        if ((next & kRefMask) == 1) {
+          f(d.element);
+          deleteElement(pos);
+          d.state.store(0);
+        }
+        return;
+      }
+    }
+  }
+
+  template< class T>
+  inline bool ObjectPool<T>::ref(uint32_t hnd) const{
+    if (!hnd) return false;
+    uint32_t pos = hnd & kPosMask;
+    uint32_t ver = (hnd & kVerMask);
+    D& d = data_[pos];
+    for (;;) {
+      uint32_t prev = d.state.load();
+      uint32_t next_c =((prev & kRefMask) +1);
+      if ((prev & kVerMask) != ver || next_c <= 2) return false;
+      PX_SCHED_CHECK_FN(next_c  == (next_c & kRefMask), "Too many references...");
+      uint32_t next = (prev & kVerMask) | next_c ;
+      if (d.state.compare_exchange_strong(prev, next)) {
+        return true;
+      }
+    }
+  }
+
+  template< class T>
+  inline uint32_t ObjectPool<T>::refCount(uint32_t hnd) const{
+    if (!hnd) return 0;
+    uint32_t pos = hnd & kPosMask;
+    uint32_t ver = (hnd & kVerMask);
+    D& d = data_[pos];
+    uint32_t current = d.state.load();
+    if ((current & kVerMask) != ver ) return 0;
+    return (current & kRefMask);
+  }
+
+
+} // end of px namespace
+#endif // PX_SCHED
+
+//----------------------------------------------------------------------------
+// -- IMPLEMENTATION ---------------------------------------------------------
+//----------------------------------------------------------------------------
+
+#ifdef PX_SCHED_IMPLEMENTATION
+
+#ifndef PX_SCHED_IMPLEMENTATION_DONE
+#define PX_SCHED_IMPLEMENTATION_DONE 1
+
+#ifdef PX_SCHED_ATLERNATIVE_TLS
+// used to store custom TLS... some platform might have problems with
+// TLS (iOS used to be one)
+#include <unordered_map>
+#endif
+
+#include <string.h> // strcmp
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && PX_SCHED_IMP_REGULAR_THREADS
+#include <pthread.h> // pthread_setaffinity_np
+#include <sched.h>
+#include <stdio.h> // fopen (sysfs)
+#endif
+
+#if PX_SCHED_CONFIG_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if PX_SCHED_CHECK_DEADLOCKS
+#include <vector>
+#include <algorithm>
+#endif
+
+
+namespace px_sched {
+
+#if PX_SCHED_LOCK_PROFILER
+  // Lock profiler: each thread records the stats of the resources it uses
+  // in its own buffer (only written by the owner thread, read by reports).
+  // Buffers are flushed to the global table, by their owner, when they are
+  // full and when the thread exits. Resets are lazy: they bump the global
+  // generation, and each owner clears its buffer the next time it uses it
+  // (reports skip the buffers of older generations).
+  struct LockProfileBuffer {
+    struct Entry {
+      std::atomic<const void*> ptr = {nullptr};
+      const char *name = nullptr;
+      std::atomic<uint64_t> acquisitions = {0};
+      std::atomic<uint64_t> contended = {0};
+      std::atomic<uint64_t> wait_ns = {0};
+      std::atomic<uint64_t> max_wait_ns = {0};
+      std::atomic<uint64_t> hold_ns = {0};
+      std::atomic<uint64_t> locked_at = {0}; // != 0 while the thread holds the resource
+    };
+    static const uint32_t kSize = 16;
+    Entry entries[kSize];
+    uint64_t wait_start = 0;
+    bool registered = false;
+    std::atomic<uint32_t> generation = {0}; // of the stats in the buffer
+    LockProfileBuffer *prev = nullptr;
+    LockProfileBuffer *next = nullptr;
+
+    ~LockProfileBuffer();
+    Entry *find(const void *ptr, const char *name, bool create = true);
+    void flush(); // owner only, global mutex must be held
+    void clear(); // owner only
+  };
+
+  struct LockProfiler {
+    std::mutex mutex;
+    LockProfile table[PX_SCHED_LOCK_PROFILER_SIZE];
+    LockProfile scratch[PX_SCHED_LOCK_PROFILER_SIZE]; // used by reports
+    uint64_t dropped = 0; // stats lost because the table was full
+    LockProfileBuffer *buffers = nullptr;
+    std::atomic<uint32_t> generation = {0}; // incremented by resets
+
+    static LockProfiler *get() {
+      static LockProfiler profiler;
+      return &profiler;
+    }
+
+    static uint64_t now() {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static void add(LockProfile *table, const void *ptr, const char *name,
+                    uint64_t acquisitions, uint64_t contended, uint64_t wait_ns,
+                    uint64_t max_wait_ns, uint64_t hold_ns, uint64_t *dropped) {
+      uint32_t h = static_cast<uint32_t>((reinterpret_cast<uintptr_t>(ptr) >> 4)*2654435761u);
+      for(uint32_t i = 0; i < PX_SCHED_LOCK_PROFILER_SIZE; ++i) {
+        LockProfile &e = table[(h + i)%PX_SCHED_LOCK_PROFILER_SIZE];
+        if (e.resource != ptr && e.resource != nullptr) continue;
+        if (e.resource == nullptr) {
+          e.resource = ptr;
+          e.name = name;
+        }
+        e.acquisitions += acquisitions;
+        e.contended += contended;
+        e.wait_ns += wait_ns;
+        if (max_wait_ns > e.max_wait_ns) e.max_wait_ns = max_wait_ns;
+        e.hold_ns += hold_ns;
+        return;
+      }
+      if (dropped) (*dropped)++;
+    }
+  };
+#endif
+
+  struct Scheduler::TLS {
+    const char *name = nullptr;
+    Scheduler *scheduler = nullptr;
+    uint16_t worker_group = 0;
+    // task being executed by this thread (see Scheduler::isCancelled)
+    Scheduler *task_scheduler = nullptr;
+    uint32_t task_cancel_token = 0;
+    uint32_t task_counter = 0;
+    // blocks of scratch memory in use by this thread, one per sync object
+    // (see Scheduler::arenaAlloc)
+    struct ArenaCursor {
+      Scheduler *scheduler = nullptr;
+      uint32_t counter = 0;
+      void *block = nullptr;
+    };
+    ArenaCursor arena[PX_SCHED_ARENA_CURSORS];
+    uint32_t arena_next = 0; // cursor replaced when a new sync object is used
+    // decrements of a wide counter not yet applied (see Scheduler::releaseCounter)
+    uint32_t batch_counter = 0;
+    uint32_t batch_count = 0;
+    // token of the pipeline stage being executed (see Pipeline::current_token)
+    Pipeline::Token *pipeline_token = nullptr;
+    // member of the team being executed (see Team::current)
+    Team *team = nullptr;
+    // instance of WorkerLocal of a thread that is not a worker
+    Scheduler *external_scheduler = nullptr;
+    uint32_t external_generation = 0;
+    uint32_t external_slot = 0;
+    MCSLock::Node mcs_nodes[PX_SCHED_MCS_MAX_LOCKS];
+    uint32_t mcs_nodes_in_use = 0;
+    // locks held by this thread (see Scheduler::CurrentThreadHoldsLock)
+    uint32_t locks_held = 0;
+#if PX_SCHED_IMP_REGULAR_THREADS
+    Worker *worker = nullptr;
+#endif
+    struct Resource {
+      const void *ptr;
+      const char *name;
+    };
+    Resource next_lock = {nullptr, nullptr};
+#if PX_SCHED_CHECK_DEADLOCKS
+    std::mutex adquired_locks_m;
+    std::vector<Resource> adquired_locks;
+#endif
+#if PX_SCHED_LOCK_PROFILER
+    LockProfileBuffer lock_profile;
+#endif
+  };
+
+#if PX_SCHED_LOCK_PROFILER
+  LockProfileBuffer::~LockProfileBuffer() {
+    if (!registered) return;
+    LockProfiler *profiler = LockProfiler::get();
+    std::lock_guard<std::mutex> l(profiler->mutex);
+    flush();
+    if (prev) prev->next = next; else profiler->buffers = next;
+    if (next) next->prev = prev;
+  }
+
+  LockProfileBuffer::Entry *LockProfileBuffer::find(const void *ptr, const char *name, bool create) {
+    LockProfiler *profiler = LockProfiler::get();
+    if (!registered) {
+      std::lock_guard<std::mutex> l(profiler->mutex);
+      next = profiler->buffers;
+      if (next) next->prev = this;
+      profiler->buffers = this;
+      registered = true;
+      generation.store(profiler->generation.load(), std::memory_order_release);
+    } else if (generation.load(std::memory_order_relaxed) != profiler->generation.load(std::memory_order_acquire)) {
+      clear();
+    }
+    for(uint32_t pass = 0; pass < 2; ++pass) {
+      Entry *free_entry = nullptr;
+      for(uint32_t i = 0; i < kSize; ++i) {
+        const void *p = entries[i].ptr.load(std::memory_order_relaxed);
+        if (p == ptr) return &entries[i];
+        if (!p && !free_entry) free_entry = &entries[i];
+      }
+      if (!create) return nullptr;
+      if (free_entry) {
+        free_entry->name = name;
+        free_entry->ptr.store(ptr, std::memory_order_release);
+        return free_entry;
+      }
+      // buffer full, move the stats to the global table to free entries
+      std::lock_guard<std::mutex> l(profiler->mutex);
+      flush();
+    }
+    return nullptr; // all entries are resources held by this thread
+  }
+
+  void LockProfileBuffer::flush() {
+    LockProfiler *profiler = LockProfiler::get();
+    // stats from before a reset are discarded
+    const bool stale = generation.load(std::memory_order_relaxed) != profiler->generation.load();
+    for(uint32_t i = 0; i < kSize; ++i) {
+      Entry &e = entries[i];
+      const void *p = e.ptr.load(std::memory_order_relaxed);
+      if (!p) continue;
+      if (!stale) LockProfiler::add(profiler->table, p, e.name,
+          e.acquisitions.load(std::memory_order_relaxed),
+          e.contended.load(std::memory_order_relaxed),
+          e.wait_ns.load(std::memory_order_relaxed),
+          e.max_wait_ns.load(std::memory_order_relaxed),
+          e.hold_ns.load(std::memory_order_relaxed), &profiler->dropped);
+      e.acquisitions.store(0, std::memory_order_relaxed);
+      e.contended.store(0, std::memory_order_relaxed);
+      e.wait_ns.store(0, std::memory_order_relaxed);
+      e.max_wait_ns.store(0, std::memory_order_relaxed);
+      e.hold_ns.store(0, std::memory_order_relaxed);
+      if (!e.locked_at.load(std::memory_order_relaxed)) e.ptr.store(nullptr, std::memory_order_relaxed);
+    }
+    generation.store(profiler->generation.load(), std::memory_order_release);
+  }
+
+  // the stats are set to zero before the new generation is published, so
+  // reports never mix them with stats from before the reset. Resources held
+  // keep their entry (the hold time is recorded when they are released).
+  void LockProfileBuffer::clear() {
+    const uint32_t current = LockProfiler::get()->generation.load(std::memory_order_acquire);
+    for(uint32_t i = 0; i < kSize; ++i) {
+      Entry &e = entries[i];
+      e.acquisitions.store(0, std::memory_order_relaxed);
+      e.contended.store(0, std::memory_order_relaxed);
+      e.wait_ns.store(0, std::memory_order_relaxed);
+      e.max_wait_ns.store(0, std::memory_order_relaxed);
+      e.hold_ns.store(0, std::memory_order_relaxed);
+    }
+    generation.store(current, std::memory_order_release);
+  }
+
+  // only called by the owner of the buffer, no need for read-modify-write
+  static void lockProfileAdd(std::atomic<uint64_t> *v, uint64_t amount) {
+    v->store(v->load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+  static void lockProfileAdquired(LockProfileBuffer *b, const void *ptr, const char *name, uint64_t wait_ns) {
+    LockProfileBuffer::Entry *e = b->find(ptr, name);
+    if (!e) return;
+    uint64_t now = LockProfiler::now();
+    lockProfileAdd(&e->acquisitions, 1);
+    if (wait_ns) {
+      lockProfileAdd(&e->contended, 1);
+      lockProfileAdd(&e->wait_ns, wait_ns);
+      if (wait_ns > e->max_wait_ns.load(std::memory_order_relaxed)) {
+        e->max_wait_ns.store(wait_ns, std::memory_order_relaxed);
+      }
+    }
+    e->locked_at.store(now? now : 1, std::memory_order_relaxed);
+  }
+#endif
+
+  Scheduler::TLS* Scheduler::tls() {
+#ifdef PX_SCHED_ATLERNATIVE_TLS
+    static std::unordered_map<std::thread::id, TLS> data;
+    static Atomic<uint32_t> in_use(0);
+    for(;;) {
+      uint32_t expected = 0;
+      if (in_use.compare_exchange_weak(expected, 1)) break;
+    }
+    auto result = &data[std::this_thread::get_id()];
+    in_use.store(0);
+    return result;
+#else
+    static thread_local TLS tls;
+    return &tls;
+#endif
+  }
+
+  MCSLock::Node *MCSLock::allocNode() {
+    Scheduler::TLS *d = Scheduler::tls();
+    for(uint32_t i = 0; i < PX_SCHED_MCS_MAX_LOCKS; ++i) {
+      if ((d->mcs_nodes_in_use & (1u << i)) == 0) {
+        d->mcs_nodes_in_use |= (1u << i);
+        Node *node = &d->mcs_nodes[i];
+        node->next.store(nullptr, std::memory_order_relaxed);
+        node->locked.store(true, std::memory_order_relaxed);
+        return node;
+      }
+    }
+    PX_SCHED_CHECK_FN(false, "Too many MCSLock held by the thread (max %d), see PX_SCHED_MCS_MAX_LOCKS",
+        PX_SCHED_MCS_MAX_LOCKS);
+    return nullptr;
+  }
+
+  void MCSLock::freeNode(Node *node) {
+    Scheduler::TLS *d = Scheduler::tls();
+    uint32_t i = static_cast<uint32_t>(node - d->mcs_nodes);
+    d->mcs_nodes_in_use &= ~(1u << i);
+  }
+
+  void MCSLock::lock() {
+    Node *node = allocNode();
+    Node *prev = tail_.exchange(node, std::memory_order_acq_rel);
+    if (prev) {
+      prev->next.store(node, std::memory_order_release);
+      if (node->locked.load(std::memory_order_acquire)) {
+        SpinWait w(this, "MCSLock");
+        while (node->locked.load(std::memory_order_acquire)) w.wait();
+        notified_ = w.adquired();
+        owner_node_ = node;
+        Scheduler::CurrentThreadHoldsLock();
+        return;
+      }
+    }
+    notified_ = SpinWait::adquiredNoWait(this, "MCSLock");
+    owner_node_ = node;
+    Scheduler::CurrentThreadHoldsLock();
+  }
+
+  bool MCSLock::try_lock() {
+    Node *node = allocNode();
+    Node *expected = nullptr;
+    if (tail_.compare_exchange_strong(expected, node,
+          std::memory_order_acquire, std::memory_order_relaxed)) {
+      notified_ = SpinWait::adquiredNoWait(this, "MCSLock");
+      owner_node_ = node;
+      Scheduler::CurrentThreadHoldsLock();
+      return true;
+    }
+    freeNode(node);
+    return false;
+  }
+
+  void MCSLock::unlock() {
+    Node *node = owner_node_;
+    Scheduler::CurrentThreadDropsLock();
+    if (notified_) {
+      notified_ = false;
+      Scheduler::CurrentThreadReleasesResource(this);
+    }
+    Node *next = node->next.load(std::memory_order_acquire);
+    if (!next) {
+      Node *expected = node;
+      if (tail_.compare_exchange_strong(expected, nullptr,
+            std::memory_order_release, std::memory_order_relaxed)) {
+        freeNode(node);
+        return;
+      }
+      // a thread is enqueuing itself, wait for the link
+      while (!(next = node->next.load(std::memory_order_acquire))) { PX_SCHED_CPU_PAUSE(); }
+    }
+    next->locked.store(false, std::memory_order_release);
+    freeNode(node);
+  }
+
+  void Scheduler::set_current_thread_name(const char *name) {
+    TLS *d = tls();
+    d->name = name;
+  }
+
+  const char *Scheduler::current_thread_name() {
+    TLS *d = tls();
+    return d->name;
+  }
+
+  void Scheduler::CurrentThreadSleeps() {
+    CurrentThreadBeforeLockResource(nullptr);
+  }
+
+  void Scheduler::CurrentThreadWakesUp() {
+    CurrentThreadAfterLockResource(false);
+  }
+
+  void Scheduler::CurrentThreadBeforeLockResource(const void *resource_ptr, const char *name) {
+    // if the lock might work, wake up one thread to replace this one
+    TLS *d = tls();
+    if (d->scheduler && d->scheduler->running_.load()) {
+#if PX_SCHED_IMP_REGULAR_THREADS
+      d->scheduler->groups_[d->worker_group].active_threads.fetch_sub(1);
+#endif
+      d->scheduler->wakeUpOneThread(d->worker_group);
+    }
+    d->next_lock = {resource_ptr, name};
+#if PX_SCHED_LOCK_PROFILER
+    if (resource_ptr) d->lock_profile.wait_start = LockProfiler::now();
+#endif
+  }
+
+  void Scheduler::CurrentThreadAfterLockResource(bool success) {
+    // mark this thread as active (so eventually one thread will step down)
+    TLS *d = tls();
+#if PX_SCHED_IMP_REGULAR_THREADS
+    if (d->scheduler && d->scheduler->running_.load()) {
+      d->scheduler->groups_[d->worker_group].active_threads.fetch_add(1);
+    }
+#endif
+    if (success && d->next_lock.ptr) {
+#if PX_SCHED_CHECK_DEADLOCKS
+      std::lock_guard<std::mutex> l(d->adquired_locks_m);
+      d->adquired_locks.push_back(d->next_lock);
+#endif
+#if PX_SCHED_LOCK_PROFILER
+      uint64_t wait_ns = LockProfiler::now() - d->lock_profile.wait_start;
+      lockProfileAdquired(&d->lock_profile, d->next_lock.ptr, d->next_lock.name, wait_ns? wait_ns : 1);
+#endif
+    }
+    d->next_lock = {nullptr,nullptr}; // reset
+  }
+
+  void Scheduler::CurrentThreadLockedResource(const void *resource_ptr, const char *name,
+                                              uint64_t wait_ns) {
+#if PX_SCHED_IMP_TRACK_LOCKS
+    if (!resource_ptr) return;
+    TLS *d = tls();
+#if PX_SCHED_CHECK_DEADLOCKS
+    {
+      std::lock_guard<std::mutex> l(d->adquired_locks_m);
+      TLS::Resource r = {resource_ptr, name};
+      d->adquired_locks.push_back(r);
+    }
+#endif
+#if PX_SCHED_LOCK_PROFILER
+    lockProfileAdquired(&d->lock_profile, resource_ptr, name, wait_ns);
+#endif
+#else
+    (void)resource_ptr;
+    (void)name;
+    (void)wait_ns;
+#endif
+  }
+
+  void Scheduler::CurrentThreadReleasesResource(const void *resource_ptr) {
+#if PX_SCHED_CHECK_DEADLOCKS
+    TLS *d = tls();
+    if (resource_ptr) {
+      std::lock_guard<std::mutex> l(d->adquired_locks_m);
+      auto f = d->adquired_locks.begin();
+      while (f != d->adquired_locks.end()) {
+        if (f->ptr == resource_ptr) break;
+        f++;
+      };
+      PX_SCHED_CHECK_FN(f != d->adquired_locks.end(), "Can't find resource %p as adquired", resource_ptr);
+      // replace resource with last, and pop (to avoid shifting elements in the vector)
+      std::swap(*f, d->adquired_locks.back());
+      d->adquired_locks.pop_back();
+    }
+#endif
+#if PX_SCHED_LOCK_PROFILER
+    if (resource_ptr) {
+      LockProfileBuffer::Entry *e = tls()->lock_profile.find(resource_ptr, nullptr, false);
+      const uint64_t locked_at = e? e->locked_at.load(std::memory_order_relaxed) : 0;
+      if (locked_at) {
+        lockProfileAdd(&e->hold_ns, LockProfiler::now() - locked_at);
+        e->locked_at.store(0, std::memory_order_relaxed);
+      }
+    }
+#endif
+#if !PX_SCHED_IMP_TRACK_LOCKS
+    (void)resource_ptr;
+#endif
+  }
+
+  void Scheduler::CurrentThreadHoldsLock() {
+    tls()->locks_held++;
+  }
+
+  void Scheduler::CurrentThreadDropsLock() {
+    TLS *d = tls();
+    PX_SCHED_CHECK_FN(d->locks_held > 0, "CurrentThreadDropsLock without CurrentThreadHoldsLock");
+    d->locks_held--;
+  }
+
+  uint32_t Scheduler::getLockProfile(LockProfile *out, uint32_t max_entries) {
+#if PX_SCHED_LOCK_PROFILER
+    LockProfiler *profiler = LockProfiler::get();
+    std::lock_guard<std::mutex> l(profiler->mutex);
+    // global table + the buffers of the running threads
+    LockProfile *all = profiler->scratch;
+    for(uint32_t i = 0; i < PX_SCHED_LOCK_PROFILER_SIZE; ++i) all[i] = profiler->table[i];
+    const uint32_t current = profiler->generation.load();
+    for(LockProfileBuffer *b = profiler->buffers; b; b = b->next) {
+      // not used since the last reset
+      if (b->generation.load(std::memory_order_acquire) != current) continue;
+      for(uint32_t i = 0; i < LockProfileBuffer::kSize; ++i) {
+        const LockProfileBuffer::Entry &e = b->entries[i];
+        const void *p = e.ptr.load(std::memory_order_acquire);
+        if (!p) continue;
+        LockProfiler::add(all, p, e.name,
+            e.acquisitions.load(std::memory_order_relaxed),
+            e.contended.load(std::memory_order_relaxed),
+            e.wait_ns.load(std::memory_order_relaxed),
+            e.max_wait_ns.load(std::memory_order_relaxed),
+            e.hold_ns.load(std::memory_order_relaxed), nullptr);
+      }
+    }
+    // insertion sort of the resources with more wait time
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < PX_SCHED_LOCK_PROFILER_SIZE; ++i) {
+      const LockProfile &e = all[i];
+      if (!e.resource || !e.acquisitions) continue;
+      uint32_t pos = count;
+      while (pos > 0 && out[pos-1].wait_ns < e.wait_ns) pos--;
+      if (pos >= max_entries) continue;
+      if (count < max_entries) count++;
+      for(uint32_t j = count-1; j > pos; --j) out[j] = out[j-1];
+      out[pos] = e;
+    }
+    return count;
+#else
+    (void)out;
+    (void)max_entries;
+    return 0;
+#endif
+  }
+
+  void Scheduler::resetLockProfile() {
+#if PX_SCHED_LOCK_PROFILER
+    LockProfiler *profiler = LockProfiler::get();
+    std::lock_guard<std::mutex> l(profiler->mutex);
+    // the buffers are cleared by their owners (see LockProfileBuffer)
+    profiler->generation.fetch_add(1);
+    for(uint32_t i = 0; i < PX_SCHED_LOCK_PROFILER_SIZE; ++i) profiler->table[i] = LockProfile();
+    profiler->dropped = 0;
+#endif
+  }
+}
+
+// Common to all implementations of px_sched (Single Threaded and Multi Threaded)
+namespace px_sched {
+  void Scheduler::startTrace(uint32_t max_events) {
+    stopTrace();
+    releaseTrace();
+    trace_.events = static_cast<TraceEvent*>(params_.mem_callbacks.alloc_fn(sizeof(TraceEvent)*max_events));
+    trace_.capacity = max_events;
+    trace_.count.store(0);
+    trace_.next_id.store(0);
+    trace_.active.store(1);
+  }
+
+  void Scheduler::stopTrace() {
+    trace_.active.store(0);
+    // wait for the events being recorded
+    while (trace_.writers.load()) { std::this_thread::yield(); }
+  }
+
+  void Scheduler::releaseTrace() {
+    if (trace_.events) {
+      params_.mem_callbacks.free_fn(trace_.events);
+      trace_.events = nullptr;
+    }
+    trace_.capacity = 0;
+    trace_.count.store(0);
+  }
+
+  const TraceEvent *Scheduler::traceEvents(uint32_t *num_events) const {
+    uint32_t count = trace_.count.load();
+    *num_events = (count < trace_.capacity)? count : trace_.capacity;
+    return trace_.events;
+  }
+
+  uint32_t Scheduler::num_trace_events_dropped() const {
+    uint32_t count = trace_.count.load();
+    return (count > trace_.capacity)? count - trace_.capacity : 0;
+  }
+
+  void Scheduler::traceEvent(uint32_t task_id, TraceEvent::Type type, uint32_t sync, const char *name) {
+    trace_.writers.fetch_add(1);
+    if (trace_.active.load()) {
+      uint32_t pos = trace_.count.fetch_add(1);
+      if (pos < trace_.capacity) {
+        TraceEvent &e = trace_.events[pos];
+        e.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        e.name = name;
+        e.task = task_id;
+        e.sync = sync;
+        e.worker = (type == TraceEvent::kStart)? traceWorker() : TraceEvent::kNoWorker;
+        e.type = static_cast<uint16_t>(type);
+      }
+    }
+    trace_.writers.fetch_sub(1);
+  }
+
+  const Snapshot *Snapshot::map(const char *path) {
+#ifdef _WIN32
+    (void)path;
+    return nullptr;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+    void *mem = mmap(nullptr, sizeof(Snapshot), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return nullptr;
+    const Snapshot *snapshot = static_cast<const Snapshot*>(mem);
+    if (snapshot->magic != kMagic || snapshot->version != kVersion ||
+        snapshot->size != sizeof(Snapshot)) {
+      munmap(mem, sizeof(Snapshot));
+      return nullptr;
+    }
+    return snapshot;
+#endif
+  }
+
+  void Snapshot::unmap(const Snapshot *snapshot) {
+#ifdef _WIN32
+    (void)snapshot;
+#else
+    if (snapshot) munmap(const_cast<Snapshot*>(snapshot), sizeof(Snapshot));
+#endif
+  }
+
+  bool Snapshot::read(const Snapshot *snapshot, Data *out) {
+    for(uint32_t tries = 0; tries < 100; ++tries) {
+      uint32_t sequence = snapshot->sequence.load(std::memory_order_acquire);
+      if (sequence & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      memcpy(out, &snapshot->data, sizeof(Data));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (snapshot->sequence.load(std::memory_order_relaxed) == sequence) return true;
+    }
+    return false;
+  }
+
+  // the file is created (or truncated) with the size of the snapshot
+  void Scheduler::openSnapshot() {
+#ifndef _WIN32
+    if (!params_.snapshot_path) return;
+    int fd = open(params_.snapshot_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, sizeof(Snapshot)) == 0) {
+      mem = mmap(nullptr, sizeof(Snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) return;
+    Snapshot *snapshot = static_cast<Snapshot*>(mem);
+    memset(&snapshot->data, 0, sizeof(Snapshot::Data));
+    snapshot->version = Snapshot::kVersion;
+    snapshot->size = sizeof(Snapshot);
+    snapshot->sequence.store(0);
+    // readers check magic, written last
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshot->magic = Snapshot::kMagic;
+    snapshot_.shared = snapshot;
+#endif
+  }
+
+  void Scheduler::closeSnapshot() {
+#ifndef _WIN32
+    if (snapshot_.shared) {
+      munmap(snapshot_.shared, sizeof(Snapshot));
+      snapshot_.shared = nullptr;
+    }
+#endif
+  }
+
+  void Scheduler::publishSnapshot() {
+    Snapshot *snapshot = snapshot_.shared;
+    if (!snapshot) return;
+    // filled outside of the seqlock, readers only retry during the copy
+    Snapshot::Data data;
+    memset(&data, 0, sizeof(data));
+    data.time = now();
+#ifndef _WIN32
+    data.pid = static_cast<uint32_t>(getpid());
+#endif
+    data.tasks_in_use = tasks_.in_use();
+    data.max_tasks = tasks_.size();
+    data.syncs_in_use = counters_.in_use();
+    data.max_syncs = counters_.size();
+    data.timers = timers_.count.load();
+    data.tasks_cancelled = tasks_cancelled_.load();
+    data.deadline_misses = deadline_misses_.count.load();
+    data.task_pool_waits = task_pool_waits_.load();
+    data.sync_pool_waits = sync_pool_waits_.load();
+    data.pool_waiters = pool_waiters_.load();
+    data.num_groups = params_.num_worker_groups;
+    for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+      Snapshot::Group &group = data.groups[g];
+      const char *name = params_.worker_groups[g].name;
+      snprintf(group.name, Snapshot::kNameSize, "%s", name? name : "Group");
+      group.num_threads = params_.worker_groups[g].num_threads;
+      group.max_running_threads = params_.worker_groups[g].max_running_threads;
+    }
+    fillSnapshot(&data);
+    while (snapshot_.lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); }
+    uint32_t sequence = snapshot->sequence.load(std::memory_order_relaxed);
+    snapshot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&snapshot->data, &data, sizeof(data));
+    snapshot->sequence.store(sequence + 2, std::memory_order_release);
+    snapshot_.lock_.clear(std::memory_order_release);
+  }
+
+  void Parker::beforePark() {
+    Scheduler::CurrentThreadSleeps();
+  }
+
+  void Parker::afterPark() {
+    Scheduler::CurrentThreadWakesUp();
+  }
+
+  // returns a free element of the pool, when the pool is full the thread
+  // helps or waits until one is released, or retries for a while and fails
+  // (see SchedulerParams::pool_exhausted_policy)
+  template<class T>
+  uint32_t Scheduler::adquireFromPool(ObjectPool<T> *pool, Atomic<uint32_t> *pool_waits) {
+    uint32_t hnd = 0;
+    if (pool->tryAdquireAndRef(&hnd)) return hnd;
+    if (pool_waits) pool_waits->fetch_add(1);
+    if (params_.pool_exhausted_policy == SchedulerParams::kPoolAbort) return pool->adquireAndRef();
+    while (!pool->tryAdquireAndRef(&hnd)) {
+      if (helpPool()) continue;
+      pool_waiters_.fetch_add(1);
+      pool_parker_.waitUntil([pool] { return pool->in_use() < pool->size(); });
+      pool_waiters_.fetch_sub(1);
+    }
+    return hnd;
+  }
+
+  uint32_t Scheduler::createCounter() {
+    PX_SCHED_TRACE_FN("CreateCounter");
+    uint32_t hnd = adquireFromPool(&counters_, &sync_pool_waits_);
+    Counter *c = &counters_.get(hnd);
+    c->task_id.store(0);
+    c->user_count.store(0);
+    c->wait_ptr = nullptr;
+    c->arena_blocks.store(nullptr);
+    c->arena_tail = nullptr;
+    c->arena_large.store(nullptr);
+    c->deadline.store(0);
+    c->upstream.store(0);
+    c->num_last_finished = 0;
+    c->last_finished_lock.store(0);
+    return hnd;
+  }
+
+  // lowers the deadline of the counter, and of the counters it waits for
+  void Scheduler::propagateDeadline(uint32_t hnd, uint64_t deadline) {
+    // bounded, a chain of counters might be reused and form a loop
+    for(uint32_t depth = 0; hnd && depth < 64; ++depth) {
+      if (!counters_.ref(hnd)) return;
+      Counter &c = counters_.get(hnd);
+      uint64_t current = c.deadline.load();
+      bool lowered = false;
+      while (current == 0 || deadline < current) {
+        if (c.deadline.compare_exchange_weak(current, deadline)) {
+          lowered = true;
+          break;
+        }
+      }
+      uint32_t next = c.upstream.load();
+      unrefCounter(hnd);
+      if (!lowered) return;
+      hnd = next;
+    }
+  }
+
+  // tasks of counter_hnd wait for upstream_hnd (runAfter, chainSync), called
+  // with both counters referenced
+  void Scheduler::linkUpstream(uint32_t counter_hnd, uint32_t upstream_hnd, uint64_t deadline) {
+    if (counter_hnd) {
+      Counter &c = counters_.get(counter_hnd);
+      uint32_t expected = 0;
+      c.upstream.compare_exchange_strong(expected, upstream_hnd);
+      // a task might already wait for this counter with a deadline
+      uint64_t d = c.deadline.load();
+      if (d && (!deadline || d < deadline)) deadline = d;
+    }
+    if (deadline) propagateDeadline(upstream_hnd, deadline);
+  }
+
+  // counters upstream of a deadline remember the last task that finished,
+  // and what that task waited for, to report who made a deadline task late
+  void Scheduler::noteFinished(uint32_t counter_hnd, const Task &task) {
+    Counter &c = counters_.get(counter_hnd);
+    if (!c.deadline.load()) return;
+    DeadlineMiss::Link link;
+    link.name = task.name;
+    link.finish_time = now();
+    while (c.last_finished_lock.exchange(1)) { std::this_thread::yield(); }
+    uint32_t num = 0;
+    // chained sync objects (chainSync) only pass the chain through
+    if (task.call != EdgeTask) c.last_finished[num++] = link;
+    for(uint32_t i = 0; i < task.num_upstream && num < PX_SCHED_DEADLINE_CHAIN; ++i) {
+      c.last_finished[num++] = task.upstream[i];
+    }
+    c.num_last_finished = num;
+    c.last_finished_lock.store(0);
+  }
+
+  // called with the counter released, before the task is queued
+  void Scheduler::inheritUpstream(Counter *c, Task *task) {
+    for(uint32_t i = 0; i < c->num_last_finished; ++i) {
+      task->upstream[i] = c->last_finished[i];
+    }
+    task->num_upstream = c->num_last_finished;
+  }
+
+  // the deadline of the task, or of the tasks waiting for it
+  uint64_t Scheduler::effectiveDeadline(const Task &task) {
+    uint64_t deadline = task.deadline;
+    if (task.counter_id) {
+      uint64_t d = counters_.get(task.counter_id).deadline.load();
+      if (d && (!deadline || d < deadline)) deadline = d;
+    }
+    return deadline;
+  }
+
+  // returns false if the task has to wait inside the limiter
+  bool Scheduler::adquireLimiter(uint32_t t_ref) {
+    Task &task = tasks_.get(t_ref);
+    Limiter *l = task.limiter;
+    l->lock_.lock();
+    if (l->running_.load() < l->max_running_) {
+      l->running_.fetch_add(1);
+      l->lock_.unlock();
+      return true;
+    }
+    task.next_sibling_task.store(0);
+    if (l->tail_) {
+      tasks_.get(l->tail_).next_sibling_task.store(t_ref);
+    } else {
+      l->head_ = t_ref;
+    }
+    l->tail_ = t_ref;
+    l->waiting_.fetch_add(1);
+    l->lock_.unlock();
+    return false;
+  }
+
+  // called once a task of the limiter is executed, returns the waiting task
+  // that takes the slot (to be queued by the caller), or 0
+  uint32_t Scheduler::releaseLimiter(Limiter *l) {
+    l->lock_.lock();
+    uint32_t next = l->head_;
+    if (next) {
+      Task &task = tasks_.get(next);
+      l->head_ = task.next_sibling_task.load();
+      if (!l->head_) l->tail_ = 0;
+      task.next_sibling_task.store(0);
+      l->waiting_.fetch_sub(1);
+    } else {
+      l->running_.fetch_sub(1);
+    }
+    l->lock_.unlock();
+    return next;
+  }
+
+  uint32_t Scheduler::getDeadlineMisses(DeadlineMiss *out, uint32_t max_entries) {
+    DeadlineMisses &m = deadline_misses_;
+    while (m.lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); }
+    uint32_t available = m.count.load() < PX_SCHED_DEADLINE_MISSES? m.count.load() : PX_SCHED_DEADLINE_MISSES;
+    uint32_t num = available < max_entries? available : max_entries;
+    for(uint32_t i = 0; i < num; ++i) {
+      out[i] = m.list[(m.next + PX_SCHED_DEADLINE_MISSES - 1 - i)%PX_SCHED_DEADLINE_MISSES];
+    }
+    m.lock_.clear(std::memory_order_release);
+    return num;
+  }
+
+  uint32_t Scheduler::refCounter(Sync *sync_obj) {
+    if (!sync_obj) return 0;
+    bool new_counter = !counters_.ref(sync_obj->hnd);
+    if (new_counter) {
+      sync_obj->hnd = createCounter();
+    }
+    return sync_obj->hnd;
+  }
+
+  uint32_t Scheduler::refCancelToken(CancelToken *token) {
+    if (!token) return 0;
+    if (!cancel_tokens_.ref(token->hnd)) {
+      token->hnd = adquireFromPool(&cancel_tokens_, nullptr);
+      cancel_tokens_.get(token->hnd).cancelled.store(0);
+    }
+    return token->hnd;
+  }
+
+  // only valid for tokens referenced by a task
+  bool Scheduler::cancelRequested(uint32_t token_hnd) const {
+    return token_hnd && cancel_tokens_.get(token_hnd).cancelled.load() != 0;
+  }
+
+  void Scheduler::cancel(CancelToken token) {
+    PX_SCHED_TRACE_FN("Cancel");
+    if (cancel_tokens_.ref(token.hnd)) {
+      cancel_tokens_.get(token.hnd).cancelled.store(1);
+      cancel_tokens_.unref(token.hnd);
+    }
+  }
+
+  bool Scheduler::isCancelled(CancelToken token) const {
+    bool result = false;
+    if (cancel_tokens_.ref(token.hnd)) {
+      result = cancelRequested(token.hnd);
+      cancel_tokens_.unref(token.hnd);
+    }
+    return result;
+  }
+
+  bool Scheduler::isCancelled() {
+    TLS *d = tls();
+    return d->task_scheduler && d->task_scheduler->cancelRequested(d->task_cancel_token);
+  }
+
+  uint32_t Scheduler::allocTask(Sync *sync_obj, const TaskParams &task_params) {
+    PX_SCHED_CHECK_FN(task_params.worker_group < params_.num_worker_groups,
+        "Invalid worker group %u (num groups %u)", task_params.worker_group, params_.num_worker_groups);
+    PX_SCHED_CHECK_FN(task_params.share_group < params_.num_share_groups,
+        "Invalid share group %u (num groups %u)", task_params.share_group, params_.num_share_groups);
+    uint32_t ref = adquireFromPool(&tasks_, &task_pool_waits_);
+    Task *task = &tasks_.get(ref);
+    task->call = nullptr;
+    task->call_arg = 0;
+    task->drop = nullptr;
+    task->counter_id = refCounter(sync_obj);
+    task->next_sibling_task.store(0);
+    task->worker_group = task_params.worker_group;
+    task->share_group = task_params.share_group;
+    task->name = task_params.name;
+    task->low_latency = task_params.low_latency;
+    task->cost = static_cast<uint8_t>(task_params.cost);
+    task->deadline = task_params.deadline;
+    task->ready_time = 0;
+    task->num_upstream = 0;
+    task->cancel_token = refCancelToken(task_params.cancel_token);
+    task->limiter = task_params.limiter;
+    task->timer_expiry = 0;
+    task->timer_period = 0;
+    task->timer_stopped.store(0);
+    task->trace_id = 0;
+    if (trace_.active.load()) {
+      task->trace_id = trace_.next_id.fetch_add(1) + 1;
+      traceEvent(task->trace_id, TraceEvent::kCreate, task->counter_id, task->name);
+    }
+    return ref;
+  }
+
+  uint32_t Scheduler::createTask(const Job &job, Sync *sync_obj, const TaskParams &task_params) {
+    PX_SCHED_TRACE_FN("CreateTask");
+    uint32_t ref = allocTask(sync_obj, task_params);
+    tasks_.get(ref).job = job;
+    return ref;
+  }
+
+  // internal tasks, call(scheduler, call_arg) is executed instead of a job
+  void Scheduler::runCall(void (*call)(Scheduler *, uintptr_t), uintptr_t call_arg,
+                          const TaskParams &task_params) {
+    uint32_t t_ref = allocTask(nullptr, task_params);
+    Task &task = tasks_.get(t_ref);
+    task.call = call;
+    task.call_arg = call_arg;
+    pushReady(t_ref);
+  }
+
+  // the task waits for the trigger, returns false if it was already
+  // released (nothing is done). Once linked the task can be executed at any time
+  bool Scheduler::linkTask(uint32_t t_ref, uint32_t trigger_hnd, uint64_t deadline) {
+    if (!counters_.ref(trigger_hnd)) return false;
+    Task &task = tasks_.get(t_ref);
+    if (task.trace_id) traceEvent(task.trace_id, TraceEvent::kDepends, trigger_hnd);
+    linkUpstream(task.counter_id, trigger_hnd, deadline);
+    Counter *c = &counters_.get(trigger_hnd);
+    for(;;) {
+      uint32_t current = c->task_id.load();
+      if (c->task_id.compare_exchange_strong(current, t_ref)) {
+        task.next_sibling_task.store(current);
+        break;
+      }
+    }
+    unrefCounter(trigger_hnd);
+    return true;
+  }
+
+  void Scheduler::chainSync(Sync from, Sync *to) {
+    PX_SCHED_TRACE_FN("ChainSync");
+    if (!counters_.ref(from.hnd)) return;
+    uint32_t t_ref = allocTask(to, TaskParams());
+    tasks_.get(t_ref).call = EdgeTask;
+    linkTask(t_ref, from.hnd, 0);
+    unrefCounter(from.hnd);
+  }
+
+  void Scheduler::runAfterAll(const Sync *triggers, uint32_t num_triggers, const Job &job,
+                              Sync *sync_obj, const TaskParams &task_params) {
+    if (num_triggers == 0) {
+      run(job, sync_obj, task_params);
+      return;
+    }
+    if (num_triggers == 1) {
+      runAfter(triggers[0], job, sync_obj, task_params);
+      return;
+    }
+    // the gate is held while the triggers are chained
+    Sync gate;
+    incrementSync(&gate);
+    for(uint32_t i = 0; i < num_triggers; ++i) chainSync(triggers[i], &gate);
+    runAfter(gate, job, sync_obj, task_params);
+    decrementSync(&gate);
+  }
+
+  void Scheduler::run(const Job &job, std::initializer_list<Access> accesses,
+                      Sync *sync_obj, const TaskParams &task_params) {
+    PX_SCHED_TRACE_FN("RunTaskAccesses");
+    PX_SCHED_CHECK_FN(accesses.size() <= PX_SCHED_MAX_ACCESSES,
+        "Too many accesses (max %d), see PX_SCHED_MAX_ACCESSES", PX_SCHED_MAX_ACCESSES);
+    // sorted by resource (a read and a write of the same resource is a write),
+    // locking them in order, tasks that declare the same resources in a
+    // different order can't block each other
+    Access sorted[PX_SCHED_MAX_ACCESSES];
+    uint32_t num = 0;
+    for(const Access &a : accesses) {
+      uint32_t pos = 0;
+      while (pos < num && sorted[pos].resource < a.resource) pos++;
+      if (pos < num && sorted[pos].resource == a.resource) {
+        sorted[pos].write = sorted[pos].write || a.write;
+        continue;
+      }
+      for(uint32_t i = num; i > pos; --i) sorted[i] = sorted[i-1];
+      sorted[pos] = a;
+      num++;
+    }
+    // everything that allocates is created before locking the resources (a
+    // full pool can make the thread execute other tasks): the task, and for
+    // each read the edge that releases the readers of the resource after it
+    // (with a spare sync object in case the resource has no readers)
+    Sync task_sync;
+    uint32_t t_ref = createTask(job, &task_sync, task_params);
+    uint32_t edges[PX_SCHED_MAX_ACCESSES];
+    uint32_t spares[PX_SCHED_MAX_ACCESSES];
+    for(uint32_t i = 0; i < num; ++i) {
+      if (sorted[i].write) continue;
+      edges[i] = allocTask(nullptr, TaskParams());
+      tasks_.get(edges[i]).call = EdgeTask;
+      spares[i] = createCounter();
+    }
+
+    // only the handles are swapped while the resources are locked
+    Sync triggers[PX_SCHED_MAX_ACCESSES*2];
+    uint32_t num_triggers = 0;
+    for(uint32_t i = 0; i < num; ++i) sorted[i].resource->lock_.lock();
+    for(uint32_t i = 0; i < num; ++i) {
+      Resource *r = sorted[i].resource;
+      triggers[num_triggers++] = r->writer_;
+      if (sorted[i].write) {
+        triggers[num_triggers++] = r->readers_;
+        r->writer_ = task_sync;
+        r->readers_ = Sync();
+      } else {
+        // same as refCounter, with the spare instead of a new sync object
+        if (!counters_.ref(r->readers_.hnd)) {
+          r->readers_.hnd = spares[i];
+          spares[i] = 0;
+        }
+        tasks_.get(edges[i]).counter_id = r->readers_.hnd;
+      }
+    }
+    for(uint32_t i = num; i > 0; --i) sorted[i-1].resource->lock_.unlock();
+
+    for(uint32_t i = 0; i < num; ++i) {
+      if (sorted[i].write) continue;
+      if (spares[i]) unrefCounter(spares[i]);
+      // the task isn't linked yet, task_sync can't be released
+      linkTask(edges[i], task_sync.hnd, 0);
+    }
+    if (sync_obj) chainSync(task_sync, sync_obj);
+    // chaining a released sync object does nothing, the ones that finished
+    // since they were swapped out are simply not waited for
+    if (num_triggers == 1) {
+      if (!linkTask(t_ref, triggers[0].hnd, task_params.deadline)) pushReady(t_ref);
+      return;
+    }
+    Sync gate;
+    incrementSync(&gate);
+    for(uint32_t i = 0; i < num_triggers; ++i) chainSync(triggers[i], &gate);
+    if (!linkTask(t_ref, gate.hnd, task_params.deadline)) pushReady(t_ref);
+    decrementSync(&gate);
+  }
+
+  void Scheduler::run(const Job &job, Sync *sync_obj, uint16_t worker_group) {
+    TaskParams task_params;
+    task_params.worker_group = worker_group;
+    run(job, sync_obj, task_params);
+  }
+
+  void Scheduler::runAfter(Sync trigger, const Job &job, Sync *sync_obj, uint16_t worker_group) {
+    TaskParams task_params;
+    task_params.worker_group = worker_group;
+    runAfter(trigger, job, sync_obj, task_params);
+  }
+
+  void Scheduler::executeTask(Task *task) {
+    const uint32_t trace_id = task->trace_id;
+    if (trace_id) traceEvent(trace_id, TraceEvent::kStart);
+    if (cancelRequested(task->cancel_token)) {
+      // skipped, the task is finished (and its sync object released) as usual
+      if (task->drop) task->drop(task->call_arg);
+      tasks_cancelled_.fetch_add(1);
+      if (trace_id) traceEvent(trace_id, TraceEvent::kEnd);
+      return;
+    }
+    TLS *d = tls();
+    Scheduler *prev_scheduler = d->task_scheduler;
+    uint32_t prev_token = d->task_cancel_token;
+    uint32_t prev_counter = d->task_counter;
+    d->task_scheduler = this;
+    d->task_cancel_token = task->cancel_token;
+    d->task_counter = task->counter_id;
+    const uint64_t deadline = effectiveDeadline(*task);
+    const uint64_t start_time = deadline? now() : 0;
+    // CPU time accounting, only needed to share it between groups
+    const bool account = params_.num_share_groups > 1;
+    uint64_t start = account? threadCpuTime() : 0;
+    if (task->call) {
+      task->call(this, task->call_arg);
+    } else {
+      task->job();
+    }
+    if (account) {
+      uint64_t elapsed = threadCpuTime() - start;
+      ShareGroup &sg = share_groups_[task->share_group];
+      sg.cpu_time_ns.fetch_add(elapsed);
+      sg.tasks_executed.fetch_add(1);
+      // weights are relative, scaled to keep precision with big weights
+      sg.vtime.fetch_add(SchedulingPolicy::shareVTime(elapsed, params_.share_groups[task->share_group].weight));
+    }
+    if (deadline) {
+      uint64_t finish_time = now();
+      if (finish_time > deadline) {
+        DeadlineMiss miss;
+        miss.name = task->name;
+        miss.deadline = deadline;
+        miss.ready_time = task->ready_time? task->ready_time : start_time;
+        miss.start_time = start_time;
+        miss.finish_time = finish_time;
+        for(uint32_t i = 0; i < task->num_upstream; ++i) miss.upstream[i] = task->upstream[i];
+        miss.num_upstream = task->num_upstream;
+        if (miss.ready_time > deadline) {
+          miss.cause = DeadlineMiss::kReadyLate;
+        } else if (start_time > deadline) {
+          miss.cause = DeadlineMiss::kStartedLate;
+        } else {
+          miss.cause = DeadlineMiss::kRanLong;
+        }
+        DeadlineMisses &m = deadline_misses_;
+        while (m.lock_.test_and_set(std::memory_order_acquire)) { std::this_thread::yield(); }
+        m.list[m.next] = miss;
+        m.next = (m.next + 1)%PX_SCHED_DEADLINE_MISSES;
+        m.count.fetch_add(1);
+        m.lock_.clear(std::memory_order_release);
+      }
+    }
+    d->task_scheduler = prev_scheduler;
+    d->task_cancel_token = prev_token;
+    d->task_counter = prev_counter;
+    if (trace_id) traceEvent(trace_id, TraceEvent::kEnd);
+  }
+
+  void *Scheduler::arenaAlloc(Sync sync, size_t size, size_t align) {
+    if (!counters_.ref(sync.hnd)) return nullptr;
+    void *result = arenaAlloc(sync.hnd, size, align);
+    unrefCounter(sync.hnd);
+    return result;
+  }
+
+  void *Scheduler::arenaAlloc(size_t size, size_t align) {
+    TLS *d = tls();
+    if (!d->task_scheduler || !d->task_counter) return nullptr;
+    // the counter is referenced by the task being executed
+    return d->task_scheduler->arenaAlloc(d->task_counter, size, align);
+  }
+
+  // only valid for referenced counters
+  void *Scheduler::arenaAlloc(uint32_t counter_hnd, size_t size, size_t align) {
+    PX_SCHED_TRACE_FN("ArenaAlloc");
+    PX_SCHED_CHECK_FN(align && (align & (align-1)) == 0, "Invalid alignment %zu", align);
+    const size_t header = sizeof(ArenaBlock);
+    TLS *d = tls();
+    // a task can alternate between sync objects (i.e. its own and the
+    // frame), each one keeps its block until it is full
+    TLS::ArenaCursor *cursor = nullptr;
+    for(uint32_t i = 0; i < PX_SCHED_ARENA_CURSORS && !cursor; ++i) {
+      if (d->arena[i].scheduler == this && d->arena[i].counter == counter_hnd) cursor = &d->arena[i];
+    }
+    ArenaBlock *block = cursor? static_cast<ArenaBlock*>(cursor->block) : nullptr;
+    if (block) {
+      uintptr_t base = reinterpret_cast<uintptr_t>(block) + header;
+      uintptr_t ptr = (base + block->used + align - 1) & ~uintptr_t(align - 1);
+      if (ptr + size <= base + block->capacity) {
+        block->used = ptr + size - base;
+        return reinterpret_cast<void*>(ptr);
+      }
+    }
+    Counter &c = counters_.get(counter_hnd);
+    const size_t needed = size + align - 1;
+    if (needed > params_.arena_block_size) {
+      // oversized, it gets its own memory (freed with the counter)
+      block = static_cast<ArenaBlock*>(params_.mem_callbacks.alloc_fn(header + needed));
+      block->capacity = needed;
+      block->used = needed;
+      ArenaBlock *head = c.arena_large.load();
+      do { block->next = head; } while (!c.arena_large.compare_exchange_weak(head, block));
+      uintptr_t base = reinterpret_cast<uintptr_t>(block) + header;
+      return reinterpret_cast<void*>((base + align - 1) & ~uintptr_t(align - 1));
+    }
+    arena_.lock();
+    block = arena_.free_list;
+    if (block) {
+      arena_.free_list = block->next;
+    } else {
+      arena_.num_blocks.fetch_add(1);
+    }
+    arena_.unlock();
+    if (!block) {
+      block = static_cast<ArenaBlock*>(params_.mem_callbacks.alloc_fn(header + params_.arena_block_size));
+      block->capacity = params_.arena_block_size;
+    }
+    block->used = 0;
+    ArenaBlock *head = c.arena_blocks.load();
+    do { block->next = head; } while (!c.arena_blocks.compare_exchange_weak(head, block));
+    if (!head) c.arena_tail = block;
+    if (!cursor) {
+      cursor = &d->arena[d->arena_next];
+      d->arena_next = (d->arena_next + 1) % PX_SCHED_ARENA_CURSORS;
+    }
+    cursor->scheduler = this;
+    cursor->counter = counter_hnd;
+    cursor->block = block;
+    uintptr_t base = reinterpret_cast<uintptr_t>(block) + header;
+    uintptr_t ptr = (base + align - 1) & ~uintptr_t(align - 1);
+    block->used = ptr + size - base;
+    return reinterpret_cast<void*>(ptr);
+  }
+
+  // called once the counter is released, all its blocks go back to the pool
+  void Scheduler::releaseArena(Counter *c) {
+    ArenaBlock *head = c->arena_blocks.load();
+    if (head) {
+      arena_.lock();
+      c->arena_tail->next = arena_.free_list;
+      arena_.free_list = head;
+      arena_.unlock();
+      c->arena_blocks.store(nullptr);
+    }
+    ArenaBlock *large = c->arena_large.load();
+    while (large) {
+      ArenaBlock *next = large->next;
+      params_.mem_callbacks.free_fn(large);
+      large = next;
+    }
+    c->arena_large.store(nullptr);
+  }
+
+  void Scheduler::resetArenaPool() {
+    arena_.lock();
+    uint32_t num_free = 0;
+    while (arena_.free_list) {
+      ArenaBlock *next = arena_.free_list->next;
+      params_.mem_callbacks.free_fn(arena_.free_list);
+      arena_.free_list = next;
+      num_free++;
+    }
+    PX_SCHED_CHECK_FN(num_free == arena_.num_blocks.load(),
+        "Arena blocks leaked %u (of %u)", arena_.num_blocks.load() - num_free, arena_.num_blocks.load());
+    arena_.num_blocks.store(0);
+    arena_.unlock();
+  }
+
+  int64_t Scheduler::ReadBlocking(IORequest *req) {
+    char *dst = static_cast<char*>(req->buffer);
+    while (req->done < req->size) {
+      size_t pending = req->size - req->done;
+#ifdef _WIN32
+      HANDLE h = reinterpret_cast<HANDLE>(_get_osfhandle(req->fd));
+      uint64_t pos = req->offset + req->done;
+      OVERLAPPED ov = {};
+      ov.Offset = static_cast<DWORD>(pos);
+      ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+      DWORD amount = (pending > 0x40000000u)? 0x40000000u : static_cast<DWORD>(pending);
+      DWORD n = 0;
+      if (!ReadFile(h, dst + req->done, amount, &n, &ov)) {
+        DWORD err = GetLastError();
+        if (err == ERROR_HANDLE_EOF) break;
+        return -static_cast<int64_t>(err);
+      }
+#else
+      ssize_t n = pread(req->fd, dst + req->done, pending, static_cast<off_t>(req->offset + req->done));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return -static_cast<int64_t>(errno);
+      }
+#endif
+      if (n == 0) break; // EOF
+      req->done += static_cast<size_t>(n);
+    }
+    return static_cast<int64_t>(req->done);
+  }
+
+  void Scheduler::ReadBlockingTask(Scheduler *schd, uintptr_t request_hnd) {
+    PX_SCHED_TRACE_FN("ReadBlocking");
+    uint32_t hnd = static_cast<uint32_t>(request_hnd);
+    IORequest &req = schd->io_requests_.get(hnd);
+    int64_t result = ReadBlocking(&req);
+    if (req.result) *req.result = result;
+    // the sync object is released by the task itself (see readBlockingLater)
+    schd->io_requests_.unref(hnd);
+    if (schd->pool_waiters_.load()) schd->notifyPoolWaiters();
+  }
+
+  void Scheduler::incrementSync(Sync *s) {
+    PX_SCHED_TRACE_FN("IncrementSync");
+    if (!counters_.ref(s->hnd)) {
+      s->hnd = createCounter();
+    }
+    Counter &c = counters_.get(s->hnd);
+    uint32_t prev = c.user_count.fetch_add(1);
+    if (prev != 0) {
+      unrefCounter(s->hnd);
+    }
+  }
+
+  uint16_t Scheduler::findWorkerGroup(const char *name) const {
+    if (!name) return kInvalidWorkerGroup;
+    for(uint16_t i = 0; i < params_.num_worker_groups; ++i) {
+      const char *g = params_.worker_groups[i].name;
+      if (g && strcmp(g, name) == 0) return i;
+    }
+    return kInvalidWorkerGroup;
+  }
+
+  uint64_t Scheduler::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  void Scheduler::releaseTask(uint32_t task_ref) {
+    Task &task = tasks_.get(task_ref);
+    uint32_t counter = task.counter_id;
+    if (counter) noteFinished(counter, task);
+    uint32_t token = task.cancel_token;
+    tasks_.unref(task_ref);
+    if (token) cancel_tokens_.unref(token);
+    if (pool_waiters_.load()) notifyPoolWaiters();
+    releaseCounter(counter);
+  }
+
+  // called once the task has been executed, periodic tasks are re-armed
+  void Scheduler::finishTask(uint32_t task_ref) {
+    Task &task = tasks_.get(task_ref);
+    if (task.timer_period && !task.timer_stopped.load() &&
+        !cancelRequested(task.cancel_token)) {
+      uint64_t now_tick = now()/timers_.resolution;
+      task.timer_expiry += task.timer_period;
+      // if we are late skip the lost periods
+      if (task.timer_expiry <= now_tick) task.timer_expiry = now_tick + task.timer_period;
+      addTimer(task_ref);
+    } else {
+      releaseTask(task_ref);
+    }
+  }
+
+  // CPU time of the calling thread in nanoseconds (time preempted by the OS
+  // doesn't count), on windows wall time is used
+  uint64_t Scheduler::threadCpuTime() {
+#if defined(_WIN32) || !defined(CLOCK_THREAD_CPUTIME_ID)
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000u + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+  }
+
+  // share groups, deadline misses and pool pressure
+  void Scheduler::initAccounting() {
+    params_.share_groups[0].name = "Default";
+    for(uint16_t i = 0; i < PX_SCHED_MAX_SHARE_GROUPS; ++i) {
+      ShareGroup &sg = share_groups_[i];
+      sg.vtime.store(0);
+      sg.cpu_time_ns.store(0);
+      sg.tasks_executed.store(0);
+      sg.running_tasks.store(0);
+    }
+    share_vtime_floor_.store(0);
+    deadline_misses_.next = 0;
+    deadline_misses_.count.store(0);
+    task_pool_waits_.store(0);
+    sync_pool_waits_.store(0);
   }
 
-  template< class T>
-  inline void ObjectPool<T>::unref(uint32_t hnd) const {
-    uint32_t pos = hnd & kPosMask;
-    uint32_t ver = (hnd & kVerMask);
-    D& d = data_[pos];
+  void Scheduler::getShareGroupStats(uint16_t share_group, ShareGroupStats *out) const {
+    PX_SCHED_CHECK_FN(share_group < params_.num_share_groups,
+        "Invalid share group %u (num groups %u)", share_group, params_.num_share_groups);
+    const ShareGroup &sg = share_groups_[share_group];
+    out->cpu_time_ns = sg.cpu_time_ns.load();
+    out->tasks_executed = sg.tasks_executed.load();
+    out->running_tasks = sg.running_tasks.load();
+  }
+
+  void Scheduler::initTimers() {
+    memset(timers_.slots, 0, sizeof(timers_.slots));
+    timers_.resolution = params_.timer_resolution_in_microseconds? params_.timer_resolution_in_microseconds : 1;
+    timers_.current_tick = now()/timers_.resolution;
+    timers_.count.store(0);
+    timers_.watch_tick.store(~uint64_t(0));
+  }
+
+  // returns false if the timer already expired (not inserted)
+  bool Scheduler::insertTimerLocked(uint32_t task_ref) {
+    Task &task = tasks_.get(task_ref);
+    uint64_t current = timers_.current_tick;
+    if (task.timer_expiry <= current) return false;
+    uint64_t delta = task.timer_expiry - current;
+    uint32_t level = 0;
+    uint64_t slot = 0;
     for(;;) {
-      uint32_t prev = d.state.load();
-      uint32_t next = prev - 1;
-      PX_SCHED_CHECK_FN((prev & kVerMask) == ver,
-          "Invalid unref HND = %u(%u), Versions: %u vs %u",
-          pos, hnd, prev & kVerMask, ver);
-      PX_SCHED_CHECK_FN((prev & kRefMask) > 1,
-          "Invalid unref HND = %u(%u), invalid ref count",
-          pos, hnd);
-      if (d.state.compare_exchange_strong(prev, next)) {
-        if ((next & kRefMask) == 1) {
-          deleteElement(pos);
-          d.state.store(0);
-        }
-        return;
+      uint32_t bits = TimerWheel::kSlotBits*(level+1);
+      if (delta < (uint64_t(1) << bits)) {
+        slot = (task.timer_expiry >> (bits - TimerWheel::kSlotBits)) & TimerWheel::kSlotMask;
+        break;
+      }
+      if (level == TimerWheel::kLevels-1) {
+        // too far away, place it in the last slot to be cascaded, it will be
+        // reinserted later with the right remaining time
+        slot = ((current >> (bits - TimerWheel::kSlotBits)) - 1) & TimerWheel::kSlotMask;
+        break;
       }
+      level++;
     }
+    task.next_sibling_task.store(timers_.slots[level][slot]);
+    timers_.slots[level][slot] = task_ref;
+    return true;
   }
 
-  // decrements the counter, if the objet is no longer valid (las ref)
-  // the given function will be executed with the element
-  template<class T>
-  template<class F>
-  inline void ObjectPool<T>::unref(uint32_t hnd, F f) const {
-    uint32_t pos = hnd & kPosMask;
-    uint32_t ver = (hnd & kVerMask);
-    D& d = data_[pos];
-    for(;;) {
-      uint32_t prev = d.state.load();
-      uint32_t next = prev - 1;
-      PX_SCHED_CHECK_FN((prev & kVerMask) == ver,
-          "Invalid unref HND = %u(%u), Versions: %u vs %u",
-          pos, hnd, prev & kVerMask, ver);
-      PX_SCHED_CHECK_FN((prev & kRefMask) > 1,
-          "Invalid unref HND = %u(%u), invalid ref count",
-          pos, hnd);
-      if (d.state.compare_exchange_strong(prev, next)) {
-        if ((next & kRefMask) == 1) {
-          f(d.element);
-          deleteElement(pos);
-          d.state.store(0);
-        }
-        return;
-      }
+  void Scheduler::addTimer(uint32_t task_ref) {
+    PX_SCHED_TRACE_FN("AddTimer");
+    uint64_t expiry = tasks_.get(task_ref).timer_expiry;
+    timers_.lock();
+    bool inserted = insertTimerLocked(task_ref);
+    if (inserted) timers_.count.fetch_add(1);
+    timers_.unlock();
+    if (inserted) {
+      onTimerAdded(expiry);
+    } else {
+      pushReady(task_ref);
     }
   }
 
-  template< class T>
-  inline bool ObjectPool<T>::ref(uint32_t hnd) const{
-    if (!hnd) return false;
-    uint32_t pos = hnd & kPosMask;
-    uint32_t ver = (hnd & kVerMask);
-    D& d = data_[pos];
-    for (;;) {
-      uint32_t prev = d.state.load();
-      uint32_t next_c =((prev & kRefMask) +1);
-      if ((prev & kVerMask) != ver || next_c <= 2) return false;
-      PX_SCHED_CHECK_FN(next_c  == (next_c & kRefMask), "Too many references...");
-      uint32_t next = (prev & kVerMask) | next_c ;
-      if (d.state.compare_exchange_strong(prev, next)) {
-        return true;
+  // advances the timer wheel up to the current time, and launches all the
+  // tasks that expired
+  void Scheduler::processTimers() {
+    if (timers_.count.load() == 0) return;
+    PX_SCHED_TRACE_FN("ProcessTimers");
+    const uint64_t now_tick = now()/timers_.resolution;
+    uint32_t expired = 0;
+    timers_.lock();
+    while (timers_.current_tick < now_tick && timers_.count.load()) {
+      uint64_t tick = ++timers_.current_tick;
+      // cascade higher levels first, when their period starts
+      for(uint32_t level = TimerWheel::kLevels-1; level > 0; --level) {
+        uint32_t bits = TimerWheel::kSlotBits*level;
+        if ((tick & ((uint64_t(1) << bits) - 1)) != 0) continue;
+        uint32_t &head = timers_.slots[level][(tick >> bits) & TimerWheel::kSlotMask];
+        uint32_t tid = head;
+        head = 0;
+        while (tid) {
+          uint32_t next = tasks_.get(tid).next_sibling_task.load();
+          if (!insertTimerLocked(tid)) {
+            tasks_.get(tid).next_sibling_task.store(expired);
+            expired = tid;
+          }
+          tid = next;
+        }
       }
+      // expire level 0
+      uint32_t &head = timers_.slots[0][tick & TimerWheel::kSlotMask];
+      uint32_t tid = head;
+      head = 0;
+      while (tid) {
+        uint32_t next = tasks_.get(tid).next_sibling_task.load();
+        tasks_.get(tid).next_sibling_task.store(expired);
+        expired = tid;
+        tid = next;
+      }
+    }
+    if (timers_.current_tick < now_tick) timers_.current_tick = now_tick;
+    timers_.unlock();
+    while (expired) {
+      Task &task = tasks_.get(expired);
+      uint32_t next = task.next_sibling_task.load();
+      task.next_sibling_task.store(0);
+      timers_.count.fetch_sub(1);
+      if (task.timer_stopped.load()) {
+        releaseTask(expired);
+      } else {
+        pushReady(expired);
+      }
+      expired = next;
     }
   }
 
-  template< class T>
-  inline uint32_t ObjectPool<T>::refCount(uint32_t hnd) const{
-    if (!hnd) return 0;
-    uint32_t pos = hnd & kPosMask;
-    uint32_t ver = (hnd & kVerMask);
-    D& d = data_[pos];
-    uint32_t current = d.state.load();
-    if ((current & kVerMask) != ver ) return 0;
-    return (current & kRefMask);
+  // returns the tick where the timers should be processed again (this is,
+  // the next non-empty slot, or the next cascade), 0 if there are no timers
+  uint64_t Scheduler::nextTimerTick() {
+    if (timers_.count.load() == 0) return 0;
+    timers_.lock();
+    uint64_t tick = timers_.current_tick;
+    for(uint32_t i = 0; i < TimerWheel::kSlots; ++i) {
+      tick++;
+      if (timers_.slots[0][tick & TimerWheel::kSlotMask] ||
+          (tick & TimerWheel::kSlotMask) == 0) break;
+    }
+    timers_.unlock();
+    return tick;
   }
 
+  void Scheduler::runAfterDelay(uint64_t delay, const Job &job, Sync *sync_obj, const TaskParams &task_params) {
+    runAt(now() + delay, job, sync_obj, task_params);
+  }
 
-} // end of px namespace
-#endif // PX_SCHED
-
-//----------------------------------------------------------------------------
-// -- IMPLEMENTATION ---------------------------------------------------------
-//----------------------------------------------------------------------------
-
-#ifdef PX_SCHED_IMPLEMENTATION
+  void Scheduler::runAt(uint64_t time, const Job &job, Sync *sync_obj, const TaskParams &task_params) {
+    PX_SCHED_TRACE_FN("RunAt");
+    uint32_t t_ref = createTask(job, sync_obj, task_params);
+    // round up, never execute a task before its time
+    tasks_.get(t_ref).timer_expiry = (time + timers_.resolution - 1)/timers_.resolution;
+    addTimer(t_ref);
+  }
 
-#ifndef PX_SCHED_IMPLEMENTATION_DONE
-#define PX_SCHED_IMPLEMENTATION_DONE 1
+  void Scheduler::runEvery(uint64_t period, const Job &job, Timer *out_timer, const TaskParams &task_params) {
+    PX_SCHED_TRACE_FN("RunEvery");
+    uint32_t t_ref = createTask(job, nullptr, task_params);
+    Task &task = tasks_.get(t_ref);
+    task.timer_period = period/timers_.resolution;
+    if (task.timer_period == 0) task.timer_period = 1;
+    task.timer_expiry = now()/timers_.resolution + task.timer_period;
+    task.timer_stopped.store(0);
+    if (out_timer) out_timer->hnd = t_ref;
+    addTimer(t_ref);
+  }
 
-#ifdef PX_SCHED_ATLERNATIVE_TLS
-// used to store custom TLS... some platform might have problems with
-// TLS (iOS used to be one)
-#include <unordered_map>
-#endif
+  void Scheduler::stopTimer(Timer timer) {
+    // the task is released the next time it expires
+    if (tasks_.ref(timer.hnd)) {
+      tasks_.get(timer.hnd).timer_stopped.store(1);
+      tasks_.unref(timer.hnd);
+    }
+  }
 
-#if PX_SCHED_CHECK_DEADLOCKS
-#include <vector>
-#include <algorithm>
-#endif
+  void SpawnScope::spawn(const Job &job) {
+    schd_->spawnChild(this, job);
+  }
 
+  void SpawnScope::sync() {
+    schd_->syncScope(this);
+  }
 
-namespace px_sched {
+  Pipeline::~Pipeline() {
+    PX_SCHED_CHECK_FN(!running_, "Pipeline destroyed while running");
+    if (slots_) {
+      schd_->params().mem_callbacks.free_fn(slots_);
+      slots_ = nullptr;
+    }
+  #if PX_SCHED_IMP_SINGLE_THREAD
+    if (queue_) {
+      schd_->params().mem_callbacks.free_fn(queue_);
+      queue_ = nullptr;
+    }
+  #endif
+  }
 
-  struct Scheduler::TLS {
-    const char *name = nullptr;
-    Scheduler *scheduler = nullptr;
-    struct Resource {
-      const void *ptr;
-      const char *name;
-    };
-    Resource next_lock = {nullptr, nullptr};
-#if PX_SCHED_CHECK_DEADLOCKS
-    std::mutex adquired_locks_m;
-    std::vector<Resource> adquired_locks;
-#endif
-  };
+  void Pipeline::addStage(StageMode mode, const Job &job, uint16_t worker_group) {
+    PX_SCHED_CHECK_FN(!running_, "Pipeline stages can't be added while running");
+    PX_SCHED_CHECK_FN(num_stages_ < PX_SCHED_PIPELINE_MAX_STAGES,
+        "Too many pipeline stages (max %d), see PX_SCHED_PIPELINE_MAX_STAGES",
+        PX_SCHED_PIPELINE_MAX_STAGES);
+    Stage &stage = stages_[num_stages_++];
+    stage.job = job;
+    stage.mode = (num_stages_ == 1)? kSerial : mode;
+    stage.worker_group = worker_group;
+  }
 
-  Scheduler::TLS* Scheduler::tls() {
-#ifdef PX_SCHED_ATLERNATIVE_TLS
-    static std::unordered_map<std::thread::id, TLS> data;
-    static Atomic<uint32_t> in_use(0);
-    for(;;) {
-      uint32_t expected = 0;
-      if (in_use.compare_exchange_weak(expected, 1)) break;
+  void Pipeline::run(Scheduler *schd, uint32_t max_tokens, Sync *out_sync_obj) {
+    PX_SCHED_CHECK_FN(!running_, "Pipeline already running");
+    PX_SCHED_CHECK_FN(num_stages_ > 0, "Pipeline without stages");
+    PX_SCHED_CHECK_FN(max_tokens > 0, "Pipelines need at least one token");
+    if (slots_ && (schd != schd_ || max_tokens != max_tokens_)) {
+      schd_->params().mem_callbacks.free_fn(slots_);
+      slots_ = nullptr;
+    #if PX_SCHED_IMP_SINGLE_THREAD
+      schd_->params().mem_callbacks.free_fn(queue_);
+      queue_ = nullptr;
+    #endif
     }
-    auto result = &data[std::this_thread::get_id()];
-    in_use.store(0);
-    return result;
-#else
-    static thread_local TLS tls;
-    return &tls;
-#endif
+    schd_ = schd;
+    max_tokens_ = max_tokens;
+    if (!slots_) {
+      slots_ = static_cast<Slot*>(schd_->params().mem_callbacks.alloc_fn(sizeof(Slot)*max_tokens_));
+    #if PX_SCHED_IMP_SINGLE_THREAD
+      queue_ = static_cast<Slot**>(schd_->params().mem_callbacks.alloc_fn(sizeof(Slot*)*max_tokens_));
+    #endif
+    }
+    for(uint32_t i = 0; i < max_tokens_; ++i) {
+      new (&slots_[i]) Slot();
+      slots_[i].token.slot = i;
+      slots_[i].pipeline = this;
+    }
+    for(uint32_t i = 0; i < num_stages_; ++i) {
+      stages_[i].next_sequence = 0;
+      stages_[i].busy = false;
+    }
+    in_flight_ = 0;
+    next_input_ = 0;
+    input_end_ = false;
+    running_ = true;
+    sync_ = Sync();
+    if (out_sync_obj) {
+      schd_->incrementSync(out_sync_obj);
+      sync_ = *out_sync_obj;
+    }
+    Slot *launches[kMaxLaunches];
+    uint32_t num_launches = 0;
+    lock();
+    admit(launches, &num_launches);
+    unlock();
+    for(uint32_t i = 0; i < num_launches; ++i) launch(launches[i]);
   }
 
-  void Scheduler::set_current_thread_name(const char *name) {
-    TLS *d = tls();
-    d->name = name;
+  Pipeline::Token *Pipeline::current_token() {
+    return Scheduler::tls()->pipeline_token;
   }
 
-  const char *Scheduler::current_thread_name() {
-    TLS *d = tls();
-    return d->name;
+  void Pipeline::StageTask(Scheduler *schd, uintptr_t slot_ptr) {
+    PX_SCHED_TRACE_FN("PipelineStage");
+    Slot *slot = reinterpret_cast<Slot*>(slot_ptr);
+    Pipeline *pipeline = slot->pipeline;
+    Scheduler::TLS *d = schd->tls();
+    Token *prev_token = d->pipeline_token;
+    d->pipeline_token = &slot->token;
+    pipeline->stages_[slot->stage].job();
+    d->pipeline_token = prev_token;
+    pipeline->stageDone(slot);
   }
 
-  void Scheduler::CurrentThreadSleeps() {
-    CurrentThreadBeforeLockResource(nullptr);
+  // starts a new token on the input stage if there is room (lock held)
+  void Pipeline::admit(Slot **launches, uint32_t *num_launches) {
+    if (input_end_ || stages_[0].busy || in_flight_ == max_tokens_) return;
+    for(uint32_t i = 0; i < max_tokens_; ++i) {
+      Slot &slot = slots_[i];
+      if (slot.in_use) continue;
+      slot.in_use = true;
+      slot.waiting = false;
+      slot.stage = 0;
+      slot.token.sequence = next_input_++;
+      slot.token.end = false;
+      stages_[0].busy = true;
+      in_flight_++;
+      launches[(*num_launches)++] = &slot;
+      return;
+    }
   }
 
-  void Scheduler::CurrentThreadWakesUp() {
-    CurrentThreadAfterLockResource(false);
+  // starts the next token (in input order) of a serial stage (lock held)
+  void Pipeline::dispatch(uint32_t stage_index, Slot **launches, uint32_t *num_launches) {
+    Stage &stage = stages_[stage_index];
+    if (stage.busy) return;
+    for(uint32_t i = 0; i < max_tokens_; ++i) {
+      Slot &slot = slots_[i];
+      if (slot.in_use && slot.waiting && slot.stage == stage_index &&
+          slot.token.sequence == stage.next_sequence) {
+        slot.waiting = false;
+        stage.busy = true;
+        launches[(*num_launches)++] = &slot;
+        return;
+      }
+    }
   }
 
-  void Scheduler::CurrentThreadBeforeLockResource(const void *resource_ptr, const char *name) {
-    // if the lock might work, wake up one thread to replace this one
-    TLS *d = tls();
-    if (d->scheduler && d->scheduler->running_.load()) {
-      d->scheduler->active_threads_.fetch_sub(1);
-      d->scheduler->wakeUpOneThread();
+  void Pipeline::stageDone(Slot *slot) {
+    Slot *launches[kMaxLaunches];
+    uint32_t num_launches = 0;
+    lock();
+    const uint32_t stage_index = slot->stage;
+    Stage &stage = stages_[stage_index];
+    if (stage.mode == kSerial) {
+      stage.busy = false;
+      stage.next_sequence = slot->token.sequence + 1;
     }
-    d->next_lock = {resource_ptr, name};
+    if ((stage_index == 0 && slot->token.end) || stage_index + 1 == num_stages_) {
+      // the token leaves the pipeline
+      if (slot->token.end) input_end_ = true;
+      slot->in_use = false;
+      in_flight_--;
+    } else {
+      slot->stage = stage_index + 1;
+      if (stages_[slot->stage].mode == kParallel) {
+        launches[num_launches++] = slot;
+      } else {
+        slot->waiting = true;
+        dispatch(slot->stage, launches, &num_launches);
+      }
+    }
+    if (stage_index > 0 && stage.mode == kSerial) dispatch(stage_index, launches, &num_launches);
+    admit(launches, &num_launches);
+    const bool finished = input_end_ && in_flight_ == 0;
+    Scheduler *schd = schd_;
+    Sync sync = sync_;
+    if (finished) running_ = false;
+    unlock();
+    for(uint32_t i = 0; i < num_launches; ++i) launch(launches[i]);
+    // the pipeline might be destroyed after this
+    if (finished) schd->decrementSync(&sync);
   }
 
-  void Scheduler::CurrentThreadAfterLockResource(bool success) {
-    // mark this thread as active (so eventually one thread will step down)
-    TLS *d = tls();
-    if (d->scheduler && d->scheduler->running_.load()) {
-      d->scheduler->active_threads_.fetch_add(1);
+  void Pipeline::launch(Slot *slot) {
+  #if PX_SCHED_IMP_SINGLE_THREAD
+    if (draining_) {
+      queue_[(queue_begin_ + queue_size_++) % max_tokens_] = slot;
+      return;
     }
-    if (success && d->next_lock.ptr) {
-#if PX_SCHED_CHECK_DEADLOCKS
-      std::lock_guard<std::mutex> l(d->adquired_locks_m);
-      d->adquired_locks.push_back(d->next_lock);
-#endif
+    draining_ = true;
+    for(;;) {
+      TaskParams task_params;
+      task_params.worker_group = stages_[slot->stage].worker_group;
+      schd_->runCall(StageTask, reinterpret_cast<uintptr_t>(slot), task_params);
+      if (!queue_size_) break;
+      slot = queue_[queue_begin_];
+      queue_begin_ = (queue_begin_ + 1) % max_tokens_;
+      queue_size_--;
     }
-    d->next_lock = {nullptr,nullptr}; // reset
+    draining_ = false;
+  #else
+    TaskParams task_params;
+    task_params.worker_group = stages_[slot->stage].worker_group;
+    schd_->runCall(StageTask, reinterpret_cast<uintptr_t>(slot), task_params);
+  #endif
   }
 
-  void Scheduler::CurrentThreadReleasesResource(const void *resource_ptr) {
-#if PX_SCHED_CHECK_DEADLOCKS
-    TLS *d = tls();
-    if (resource_ptr) {
-      std::lock_guard<std::mutex> l(d->adquired_locks_m);
-      auto f = d->adquired_locks.begin();
-      while (f != d->adquired_locks.end()) {
-        if (f->ptr == resource_ptr) break;
-        f++;
-      };
-      PX_SCHED_CHECK_FN(f != d->adquired_locks.end(), "Can't find resource %p as adquired", resource_ptr);
-      // replace resource with last, and pop (to avoid shifting elements in the vector)
-      std::swap(*f, d->adquired_locks.back());
-      d->adquired_locks.pop_back();
-    }
-#else
-    (void)resource_ptr;
-#endif
+  struct Scheduler::TeamState {
+    explicit TeamState(uint32_t num_members) : barrier(num_members) {}
+    Job job;
+    Barrier barrier;
+    Team *members = nullptr;
+    TeamState *next = nullptr; // waiting for threads (see Scheduler::Teams)
+    Sync sync;
+    std::atomic<uint32_t> running = {0};
+    uint32_t size = 0;
+    uint16_t worker_group = 0;
+  };
+
+  uint32_t Team::size() const {
+    return state_->size;
   }
-}
 
-// Common to all implementations of px_sched (Single Threaded and Multi Threaded)
-namespace px_sched {
-  uint32_t Scheduler::createCounter() {
-    PX_SCHED_TRACE_FN("CreateCounter");
-    uint32_t hnd = counters_.adquireAndRef();
-    Counter *c = &counters_.get(hnd);
-    c->task_id.store(0);
-    c->user_count.store(0);
-    c->wait_ptr = nullptr;
-    return hnd;
+  void Team::barrier() {
+    state_->barrier.arriveAndWait();
   }
 
-  uint32_t Scheduler::createTask(const Job &job, Sync *sync_obj) {
-    PX_SCHED_TRACE_FN("CreateTask");
-    uint32_t ref = tasks_.adquireAndRef();
-    Task *task = &tasks_.get(ref);
-    task->job = job;
-    task->counter_id = 0;
-    task->next_sibling_task.store(0);
-    if (sync_obj) {
-      bool new_counter = !counters_.ref(sync_obj->hnd);
-      if (new_counter) {
-        sync_obj->hnd = createCounter();
-      }
-      task->counter_id = sync_obj->hnd;
+  Team *Team::current() {
+    return Scheduler::tls()->team;
+  }
+
+  uint32_t Scheduler::runTeam(uint32_t num_members, const Job &job, Sync *out_sync_obj,
+                              uint16_t worker_group) {
+    PX_SCHED_CHECK_FN(num_members > 0, "Teams need at least one member");
+    PX_SCHED_CHECK_FN(worker_group < params_.num_worker_groups,
+        "Invalid worker group %u (num groups %u)", worker_group, params_.num_worker_groups);
+    const uint32_t capacity = teamCapacity(worker_group);
+    if (num_members > capacity) num_members = capacity;
+    const size_t offset = (sizeof(TeamState) + alignof(Team) - 1)/alignof(Team)*alignof(Team);
+    void *mem = params_.mem_callbacks.alloc_fn(offset + sizeof(Team)*num_members);
+    TeamState *team = new (mem) TeamState(num_members);
+    team->members = static_cast<Team*>(static_cast<void*>(static_cast<char*>(mem) + offset));
+    for(uint32_t i = 0; i < num_members; ++i) {
+      Team *member = new (&team->members[i]) Team();
+      member->state_ = team;
+      member->index_ = i;
     }
-    return ref;
+    team->job = job;
+    team->size = num_members;
+    team->worker_group = worker_group;
+    team->running.store(num_members);
+    if (out_sync_obj) {
+      incrementSync(out_sync_obj);
+      team->sync = *out_sync_obj;
+    }
+    teams_.lock();
+    const bool launch = !teams_.head[worker_group] &&
+                        teams_.reserved[worker_group] + num_members <= capacity;
+    if (launch) {
+      teams_.reserved[worker_group] += num_members;
+    } else if (teams_.tail[worker_group]) {
+      teams_.tail[worker_group]->next = team;
+      teams_.tail[worker_group] = team;
+    } else {
+      teams_.head[worker_group] = team;
+      teams_.tail[worker_group] = team;
+    }
+    teams_.unlock();
+    if (launch) launchTeam(team);
+    return num_members;
   }
 
-  void Scheduler::incrementSync(Sync *s) {
-    PX_SCHED_TRACE_FN("IncrementSync");
-    if (!counters_.ref(s->hnd)) {
-      s->hnd = createCounter();
+  void Scheduler::launchTeam(TeamState *team) {
+    // the team might be released once the last member is launched
+    const uint32_t size = team->size;
+    Team *members = team->members;
+    TaskParams task_params;
+    task_params.worker_group = team->worker_group;
+    for(uint32_t i = 0; i < size; ++i) {
+      runCall(TeamTask, reinterpret_cast<uintptr_t>(&members[i]), task_params);
     }
-    Counter &c = counters_.get(s->hnd);
-    uint32_t prev = c.user_count.fetch_add(1);
-    if (prev != 0) {
-      unrefCounter(s->hnd);
+  }
+
+  void Scheduler::TeamTask(Scheduler *schd, uintptr_t member_ptr) {
+    PX_SCHED_TRACE_FN("TeamMember");
+    Team *member = reinterpret_cast<Team*>(member_ptr);
+    TLS *d = tls();
+    Team *prev_team = d->team;
+    d->team = member;
+    member->state_->job();
+    d->team = prev_team;
+    schd->teamDone(member->state_);
+  }
+
+  void Scheduler::teamDone(TeamState *team) {
+    if (team->running.fetch_sub(1) != 1) return;
+    const uint16_t g = team->worker_group;
+    const uint32_t capacity = teamCapacity(g);
+    Sync sync = team->sync;
+    TeamState *launches = nullptr;
+    TeamState *last_launch = nullptr;
+    teams_.lock();
+    teams_.reserved[g] -= team->size;
+    // waiting teams are launched in order, as long as they fit
+    while (teams_.head[g] && teams_.reserved[g] + teams_.head[g]->size <= capacity) {
+      TeamState *next = teams_.head[g];
+      teams_.head[g] = next->next;
+      if (!teams_.head[g]) teams_.tail[g] = nullptr;
+      next->next = nullptr;
+      teams_.reserved[g] += next->size;
+      if (last_launch) last_launch->next = next; else launches = next;
+      last_launch = next;
     }
+    teams_.unlock();
+    for(uint32_t i = 0; i < team->size; ++i) team->members[i].~Team();
+    team->~TeamState();
+    params_.mem_callbacks.free_fn(team);
+    while (launches) {
+      TeamState *next = launches->next;
+      launches->next = nullptr;
+      launchTeam(launches);
+      launches = next;
+    }
+    decrementSync(&sync);
   }
 
   void Scheduler::decrementSync(Sync *s) {
@@ -956,25 +4871,63 @@ namespace px_sched {
 
 namespace px_sched {
   Scheduler::Scheduler() {}
-  Scheduler::~Scheduler() {}
+  Scheduler::~Scheduler() { stop(); }
   void Scheduler::init(const SchedulerParams &params) {
+    stop();
     params_ = params;
+    params_.worker_groups[0].name = "Worker";
+    params_.worker_groups[0].num_threads = params_.num_threads;
+    params_.worker_groups[0].max_running_threads = params_.max_running_threads;
     tasks_.init(params_.max_number_tasks, params_.mem_callbacks);
     counters_.init(params_.max_number_tasks, params_.mem_callbacks);
+    cancel_tokens_.init(params_.max_number_tasks, params_.mem_callbacks);
+    ready_ = static_cast<uint32_t*>(params_.mem_callbacks.alloc_fn(sizeof(uint32_t)*params_.max_number_tasks));
+    ready_begin_ = 0;
+    ready_count_ = 0;
+    initTimers();
+    initAccounting();
+    openSnapshot();
   }
   void Scheduler::stop() {
+    closeSnapshot();
+    stopTrace();
+    releaseTrace();
+    if (ready_) {
+      params_.mem_callbacks.free_fn(ready_);
+      ready_ = nullptr;
+    }
+    ready_count_ = 0;
     tasks_.reset();
     counters_.reset();
+    cancel_tokens_.reset();
+    resetArenaPool();
   }
-  void Scheduler::run(const Job &job, Sync *s) {
-    Job j(job);
-    j();
-    if (s) decrementSync(s);
+
+  void Scheduler::readAsync(int fd, uint64_t offset, void *buffer, size_t size,
+                            Sync *, int64_t *out_result) {
+    // no threads to wait for, read now (the sync object is never pending)
+    IORequest req;
+    req.fd = fd;
+    req.offset = offset;
+    req.buffer = buffer;
+    req.size = size;
+    int64_t result = ReadBlocking(&req);
+    if (out_result) *out_result = result;
+  }
+  void Scheduler::run(const Job &job, Sync *s, const TaskParams &task_params) {
+    processTimers();
+    // no threads, the task is queued (see pushReady)
+    uint32_t t_ref = createTask(job, s, task_params);
+    pushReady(t_ref);
   }
 
-  void Scheduler::runAfter(Sync trigger, const Job &job, Sync *s) {
+  void Scheduler::runAfter(Sync trigger, const Job &job, Sync *s, const TaskParams &task_params) {
+    processTimers();
     if (counters_.ref(trigger.hnd)) {
-      uint32_t t_ref = createTask(job, s);
+      uint32_t t_ref = createTask(job, s, task_params);
+      uint32_t trace_id = tasks_.get(t_ref).trace_id;
+      if (trace_id) traceEvent(trace_id, TraceEvent::kDepends, trigger.hnd);
+      linkUpstream(tasks_.get(t_ref).counter_id, trigger.hnd, task_params.deadline);
       Counter *c = &counters_.get(trigger.hnd);
       for(;;) {
         uint32_t current = c->task_id.load();
@@ -986,12 +4939,39 @@ namespace px_sched {
       }
       unrefCounter(trigger.hnd);
     } else {
-      run(job, s);
+      run(job, s, task_params);
     }
   }
 
   void Scheduler::waitFor(Sync s) {
-    PX_SCHED_CHECK_FN(!(counters_.ref(s.hnd)), "Invalid, on SingleThreaded mode we can not wait for a sync object...");
+    // execute ready tasks until the sync object is released, then only
+    // delayed tasks can release it: sleep until they are executed
+    while (counters_.refCount(s.hnd)) {
+      processTimers();
+      if (drain(1)) continue;
+      uint64_t tick = nextTimerTick();
+      PX_SCHED_CHECK_FN(tick, "Invalid, on SingleThreaded mode nothing can release the sync object...");
+      uint64_t t = now();
+      if (tick*timers_.resolution > t) {
+        std::this_thread::sleep_for(std::chrono::microseconds(tick*timers_.resolution - t));
+      }
+      processTimers();
+    }
+  }
+
+  uint32_t Scheduler::pump(uint32_t max_tasks) {
+    processTimers();
+    return drain(max_tasks);
+  }
+
+  uint32_t Scheduler::runUntilIdle() {
+    uint32_t total = 0;
+    for(;;) {
+      processTimers();
+      uint32_t executed = drain(UINT32_MAX);
+      if (!executed) return total;
+      total += executed;
+    }
   }
 
   uint32_t Scheduler::numPendingTasks(Sync s){
@@ -1002,28 +4982,112 @@ namespace px_sched {
     if (buffer_size) buffer[0] = 0;
   }
 
-  void Scheduler::unrefCounter(uint32_t hnd) {
-    if (counters_.ref(hnd)) {
-      counters_.unref(hnd);
+  void Scheduler::releaseCounter(uint32_t hnd) {
+    unrefCounter(hnd);
+  }
+
+  // the caller must hold the references
+  void Scheduler::unrefCounter(uint32_t hnd, uint32_t count) {
+    if (hnd) {
       Scheduler *schd = this;
-      counters_.unref(hnd, [schd](Counter &c) {
+      counters_.unref(hnd, count, [schd](Counter &c) {
+        schd->releaseArena(&c);
         // wake up all tasks 
         uint32_t tid = c.task_id.load();
         while (schd->tasks_.ref(tid)) {
           Task &task = schd->tasks_.get(tid);
           uint32_t next_tid = task.next_sibling_task.load(); 
-          uint32_t counter_id = task.counter_id;
           task.next_sibling_task.store(0);
-          task.job(); // execute the task
+          schd->inheritUpstream(&c, &task);
           schd->tasks_.unref(tid);
-          schd->unrefCounter(counter_id);
+          schd->pushReady(tid);
           tid = next_tid;
         }
       });
+      if (pool_waiters_.load()) notifyPoolWaiters();
     }
   }
 
-  void Scheduler::wakeUpOneThread() {}
+  void Scheduler::wakeUpOneThread(uint16_t, uint8_t) {}
+
+  // a single thread, nothing to place
+  void Scheduler::getPlacementStats(PlacementStats *out) const {
+    *out = PlacementStats();
+  }
+
+  uint32_t Scheduler::detectCpuCapacities(uint32_t *, uint32_t) { return 0; }
+  void Scheduler::onTimerAdded(uint64_t) {}
+
+  void Scheduler::spawnChild(SpawnScope *scope, const Job &job) {
+    run(job, &scope->tasks_);
+  }
+
+  void Scheduler::syncScope(SpawnScope *scope) {
+    // children spawned from a task are still in the ready queue
+    waitFor(scope->tasks_);
+  }
+
+  void Scheduler::pushReady(uint32_t t_ref) {
+    Task &task = tasks_.get(t_ref);
+    if (task.trace_id) traceEvent(task.trace_id, TraceEvent::kReady);
+    if (task.limiter && !adquireLimiter(t_ref)) return;
+    queueReady(t_ref);
+  }
+
+  void Scheduler::queueReady(uint32_t t_ref) {
+    // no threads, the queue is drained by the caller unless it is already
+    // executing tasks (no recursion) or the user pumps it
+    PX_SCHED_CHECK_FN(ready_count_ < params_.max_number_tasks, "Ready queue overflow");
+    ready_[(ready_begin_ + ready_count_++) % params_.max_number_tasks] = t_ref;
+    if (!draining_ && !params_.manual_pump) drain(UINT32_MAX);
+  }
+
+  uint32_t Scheduler::drain(uint32_t max_tasks) {
+    const bool prev_draining = draining_;
+    draining_ = true;
+    uint32_t executed = 0;
+    while (executed < max_tasks && ready_count_) {
+      uint32_t t_ref = ready_[ready_begin_];
+      ready_begin_ = (ready_begin_ + 1) % params_.max_number_tasks;
+      ready_count_--;
+      Task &task = tasks_.get(t_ref);
+      Limiter *limiter = task.limiter;
+      executeTask(&task);
+      // the slot passes to a waiting task
+      uint32_t next = limiter? releaseLimiter(limiter) : 0;
+      finishTask(t_ref);
+      if (next) queueReady(next);
+      executed++;
+    }
+    draining_ = prev_draining;
+    return executed;
+  }
+  // no threads, tasks are executed by the calling thread
+  uint16_t Scheduler::traceWorker() const { return 0; }
+
+  // no threads, one instance for the thread that executes the tasks
+  uint32_t Scheduler::workerLocalSlots() const { return 1; }
+  uint32_t Scheduler::workerLocalIndex() { return 0; }
+
+  // no threads, only the pools and counters are published
+  void Scheduler::fillSnapshot(Snapshot::Data *) {}
+
+  // no threads, only ready tasks and timers can release elements (even if
+  // the thread holds locks, there is no other thread to wait for)
+  bool Scheduler::helpPool() {
+    const uint32_t in_use = tasks_.in_use() + counters_.in_use() + cancel_tokens_.in_use();
+    processTimers();
+    if (tasks_.in_use() + counters_.in_use() + cancel_tokens_.in_use() < in_use) return true;
+    if (drain(1)) return true;
+    PX_SCHED_CHECK_FN(false, "Pool exhausted (%u tasks) without threads, see SchedulerParams::max_number_tasks",
+        tasks_.size());
+    return false;
+  }
+
+  // no threads, members are executed one after another
+  uint32_t Scheduler::teamCapacity(uint16_t) const { return 1; }
+  uint32_t Scheduler::active_threads() const { return 0; }
+  uint32_t Scheduler::num_tasks_ready() { return ready_count_; }
 } // end of px namespace
 #endif // PX_SCHED_IMP_SINGLE_THREAD
 
@@ -1031,9 +5095,175 @@ namespace px_sched {
 // Default implementation using threads 
 #include <thread>
 namespace px_sched {
-  Scheduler::Scheduler() {
-    active_threads_.store(0);
-  }
+
+#if PX_SCHED_CONFIG_IO_URING
+  // Minimal io_uring wrapper (raw syscalls, no liburing dependency). Reads are
+  // submitted from any thread, and completions are reaped by a dedicated
+  // thread that releases the sync objects as a finished task would do.
+  struct Scheduler::IORing {
+    int ring_fd = -1;
+    void *sq_ptr = nullptr;
+    void *cq_ptr = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    size_t sqes_size = 0;
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    io_uring_sqe *sqes = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    unsigned cq_entries = 0;
+    io_uring_cqe *cqes = nullptr;
+    Atomic<uint32_t> in_flight;
+    std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+    std::thread thread;
+
+    bool init(uint32_t entries) {
+      io_uring_params p;
+      memset(&p, 0, sizeof(p));
+      int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+      if (fd < 0) return false;
+      ring_fd = fd;
+      sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+      cq_size = p.cq_off.cqes + p.cq_entries*sizeof(io_uring_cqe);
+      bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (single_mmap) {
+        if (cq_size > sq_size) sq_size = cq_size;
+        cq_size = sq_size;
+      }
+      sq_ptr = mmap(nullptr, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                    fd, static_cast<off_t>(IORING_OFF_SQ_RING));
+      if (sq_ptr == MAP_FAILED) { sq_ptr = nullptr; release(); return false; }
+      if (single_mmap) {
+        cq_ptr = sq_ptr;
+      } else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                      fd, static_cast<off_t>(IORING_OFF_CQ_RING));
+        if (cq_ptr == MAP_FAILED) { cq_ptr = nullptr; release(); return false; }
+      }
+      sqes_size = p.sq_entries*sizeof(io_uring_sqe);
+      void *sqes_ptr = mmap(nullptr, sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                            fd, static_cast<off_t>(IORING_OFF_SQES));
+      if (sqes_ptr == MAP_FAILED) { release(); return false; }
+      sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+      char *sq = static_cast<char*>(sq_ptr);
+      char *cq = static_cast<char*>(cq_ptr);
+      sq_head  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+      sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+      sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+      sq_mask  = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+      sq_entries = p.sq_entries;
+      cq_head  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+      cq_tail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+      cq_mask  = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+      cq_entries = p.cq_entries;
+      cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+      in_flight.store(0);
+      return true;
+    }
+
+    void release() {
+      if (sqes) munmap(sqes, sqes_size);
+      if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+      if (sq_ptr) munmap(sq_ptr, sq_size);
+      if (ring_fd >= 0) close(ring_fd);
+      sqes = nullptr;
+      sq_ptr = cq_ptr = nullptr;
+      ring_fd = -1;
+    }
+
+    // returns false if the ring is full, user_data 0 is reserved to stop the
+    // reaping thread
+    bool submit(uint8_t opcode, uint64_t user_data, const IORequest *req) {
+      // never allow more reads in flight than entries in the completion queue
+      if (req && in_flight.fetch_add(1) >= cq_entries) {
+        in_flight.fetch_sub(1);
+        return false;
+      }
+      while(lock_.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      unsigned tail = *sq_tail;
+      unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      if (tail - head >= sq_entries) {
+        lock_.clear(std::memory_order_release);
+        if (req) in_flight.fetch_sub(1);
+        return false;
+      }
+      unsigned index = tail & sq_mask;
+      io_uring_sqe *sqe = &sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = opcode;
+      sqe->user_data = user_data;
+      if (req) {
+        size_t pending = req->size - req->done;
+        sqe->fd = req->fd;
+        sqe->off = req->offset + req->done;
+        sqe->addr = reinterpret_cast<uintptr_t>(static_cast<char*>(req->buffer) + req->done);
+        sqe->len = (pending > 0x40000000u)? 0x40000000u : static_cast<uint32_t>(pending);
+      }
+      sq_array[index] = index;
+      __atomic_store_n(sq_tail, tail+1, __ATOMIC_RELEASE);
+      for(;;) {
+        long r = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+        if (r >= 0 || errno != EINTR) break;
+      }
+      lock_.clear(std::memory_order_release);
+      return true;
+    }
+
+    static void ThreadMain(Scheduler *schd, IORing *ring) {
+      PX_SCHED_TRACE_FN("IORingThread");
+      set_current_thread_name("IO-Ring");
+      for(;;) {
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        bool quit = false;
+        while (head != tail) {
+          const io_uring_cqe &cqe = ring->cqes[head & ring->cq_mask];
+          uint64_t user_data = cqe.user_data;
+          int32_t res = cqe.res;
+          __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+          if (user_data == 0) {
+            quit = true;
+          } else {
+            ring->in_flight.fetch_sub(1);
+            ring->completed(schd, static_cast<uint32_t>(user_data), res);
+          }
+        }
+        if (quit) break;
+        syscall(__NR_io_uring_enter, ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      }
+      set_current_thread_name(nullptr);
+    }
+
+    void completed(Scheduler *schd, uint32_t hnd, int32_t res) {
+      IORequest &req = schd->io_requests_.get(hnd);
+      if (res == -EINVAL || res == -EOPNOTSUPP) {
+        // old kernel (no IORING_OP_READ) or a file that doesn't support it
+        schd->readBlockingLater(hnd);
+        return;
+      }
+      if (res == -EAGAIN || res == -EINTR ||
+          (res > 0 && req.done + static_cast<size_t>(res) < req.size)) {
+        // short read, or retry: submit the rest
+        if (res > 0) req.done += static_cast<size_t>(res);
+        if (!submit(IORING_OP_READ, hnd, &req)) schd->readBlockingLater(hnd);
+        return;
+      }
+      if (res > 0) req.done += static_cast<size_t>(res);
+      schd->completeRead(hnd, (res < 0)? res : static_cast<int64_t>(req.done));
+    }
+  };
+#else
+  struct Scheduler::IORing {};
+#endif
+
+  Scheduler::Scheduler() {}
 
   Scheduler::~Scheduler() { stop(); }
 
@@ -1045,19 +5275,120 @@ namespace px_sched {
     if (params_.max_running_threads == 0) {
       params_.max_running_threads = static_cast<uint16_t>(std::thread::hardware_concurrency());
     }
+    params_.worker_groups[0].name = "Worker";
+    params_.worker_groups[0].num_threads = params_.num_threads;
+    params_.worker_groups[0].max_running_threads = params_.max_running_threads;
     // create tasks
     tasks_.init(params_.max_number_tasks, params_.mem_callbacks);
     counters_.init(params_.max_number_tasks, params_.mem_callbacks);
-    ready_tasks_.init(params_.max_number_tasks, params_.mem_callbacks);
+    cancel_tokens_.init(params_.max_number_tasks, params_.mem_callbacks);
+    initTimers();
+    initAccounting();
+    timer_watcher_.store(nullptr);
+    external_slots_.store(0);
+    external_generation_++;
+    // create groups, each one with its own ready queue
+    PX_SCHED_CHECK_FN(groups_ == nullptr, "groups_ ptr should be null here...");
+    const uint16_t num_groups = params_.num_worker_groups;
+    groups_ = static_cast<WorkerGroup*>(params_.mem_callbacks.alloc_fn(sizeof(WorkerGroup)*num_groups));
+    num_workers_ = 0;
+    // hybrid CPUs, class of core of each cpu
+    uint32_t capacities[PX_SCHED_MAX_CPUS];
+    uint32_t num_cpus = 0;
+    if (params_.cpu_capacities) {
+      num_cpus = (params_.num_cpus < PX_SCHED_MAX_CPUS)? params_.num_cpus : PX_SCHED_MAX_CPUS;
+      memcpy(capacities, params_.cpu_capacities, sizeof(uint32_t)*num_cpus);
+    } else if (params_.core_aware) {
+      num_cpus = detectCpuCapacities(capacities, PX_SCHED_MAX_CPUS);
+    }
+    uint32_t class_cpus[PlacementStats::kNumCoreClasses][PX_SCHED_MAX_CPUS];
+    uint32_t num_class_cpus[PlacementStats::kNumCoreClasses] = {};
+    uint32_t min_capacity = ~0u;
+    uint32_t max_capacity = 0;
+    for(uint32_t cpu = 0; cpu < num_cpus; ++cpu) {
+      if (!capacities[cpu]) continue;
+      if (capacities[cpu] < min_capacity) min_capacity = capacities[cpu];
+      if (capacities[cpu] > max_capacity) max_capacity = capacities[cpu];
+    }
+    // a real gap between classes, favored cores of homogeneous CPUs (turbo
+    // boost max, preferred cores) only differ in a few percent
+    hybrid_ = params_.core_aware && max_capacity &&
+        uint64_t(min_capacity)*5 < uint64_t(max_capacity)*4;
+    for(uint32_t cpu = 0; hybrid_ && cpu < num_cpus; ++cpu) {
+      if (!capacities[cpu]) continue;
+      // closer to the biggest capacity --> performance core
+      uint8_t c = (uint64_t(capacities[cpu])*2 >= uint64_t(min_capacity) + max_capacity)?
+          PlacementStats::kPerformance : PlacementStats::kEfficiency;
+      class_cpus[c][num_class_cpus[c]++] = cpu;
+    }
+    for(uint16_t g = 0; g < num_groups; ++g) {
+      WorkerGroupParams &gp = params_.worker_groups[g];
+      if (gp.max_running_threads == 0) gp.max_running_threads = gp.num_threads;
+      new (&groups_[g]) WorkerGroup();
+      for(uint16_t sg = 0; sg < params_.num_share_groups; ++sg) {
+        groups_[g].ready_tasks[sg].init(params_.max_number_tasks, params_.mem_callbacks);
+      }
+      groups_[g].deadline_tasks.init(params_.max_number_tasks, params_.mem_callbacks);
+      if (hybrid_) {
+        for(uint8_t c = 0; c < PlacementStats::kNumCoreClasses; ++c) {
+          groups_[g].placed_tasks[c].init(params_.max_number_tasks, params_.mem_callbacks);
+        }
+      }
+      groups_[g].first_worker = num_workers_;
+      groups_[g].num_threads = gp.num_threads;
+      groups_[g].max_running_threads = gp.max_running_threads;
+      num_workers_ = static_cast<uint16_t>(num_workers_ + gp.num_threads);
+    }
     PX_SCHED_CHECK_FN(workers_ == nullptr, "workers_ ptr should be null here...");
-    workers_ = static_cast<Worker*>(params_.mem_callbacks.alloc_fn(sizeof(Worker)*params_.num_threads));
-    for(uint16_t i = 0; i < params_.num_threads; ++i) {
-      new (&workers_[i]) Worker();
-      workers_[i].thread_index = i;
+    workers_ = static_cast<Worker*>(params_.mem_callbacks.alloc_fn(sizeof(Worker)*num_workers_));
+    uint32_t spawn_deque_size = 1;
+    while (spawn_deque_size < params_.spawn_deque_size) spawn_deque_size <<= 1;
+    for(uint16_t g = 0; g < num_groups; ++g) {
+      for(uint16_t i = 0; i < groups_[g].num_threads; ++i) {
+        Worker *w = &workers_[groups_[g].first_worker + i];
+        new (w) Worker();
+        w->thread_index = i;
+        w->worker_group = g;
+        w->spawn_deque.init(spawn_deque_size, params_.mem_callbacks);
+      }
+    }
+    if (hybrid_) splitCoreClasses(num_class_cpus);
+    // counters are batched only while all the workers together can't take
+    // them to zero
+    counter_batch_threshold_ = params_.counter_batch_size?
+        uint32_t(num_workers_)*params_.counter_batch_size + 2 : 0;
+    for(uint16_t i = 0; i < num_workers_; ++i) {
+      Worker &w = workers_[i];
+      w.thread = std::thread(WorkerThreadMain, this, &w);
+      const int32_t first_cpu = params_.worker_groups[w.worker_group].first_cpu;
+      if (first_cpu >= 0) {
+        const uint32_t cpu = static_cast<uint32_t>(first_cpu) + w.thread_index;
+        PinThread(&w.thread, &cpu, 1);
+      } else if (w.core_class < PlacementStats::kNumCoreClasses) {
+        PinThread(&w.thread, class_cpus[w.core_class], num_class_cpus[w.core_class]);
+      }
+    }
+    // async I/O
+    PX_SCHED_CHECK_FN(params_.io_worker_group < num_groups,
+        "Invalid io_worker_group %u (num groups %u)", params_.io_worker_group, num_groups);
+    io_requests_.init(params_.max_number_tasks, params_.mem_callbacks);
+#if PX_SCHED_CONFIG_IO_URING
+    PX_SCHED_CHECK_FN(io_ring_ == nullptr, "io_ring_ ptr should be null here...");
+    if (params_.io_queue_depth) {
+      io_ring_ = new (params_.mem_callbacks.alloc_fn(sizeof(IORing))) IORing();
+      if (io_ring_->init(params_.io_queue_depth)) {
+        io_ring_->thread = std::thread(IORing::ThreadMain, this, io_ring_);
+      } else {
+        // not available (old kernel, disabled, seccomp...) use blocking tasks
+        io_ring_->~IORing();
+        params_.mem_callbacks.free_fn(io_ring_);
+        io_ring_ = nullptr;
+      }
     }
-    PX_SCHED_CHECK_FN(active_threads_.load() == 0, "Invalid active threads num");
-    for(uint16_t i = 0; i < params_.num_threads; ++i) {
-      workers_[i].thread = std::thread(WorkerThreadMain, this, &workers_[i]);
+#endif
+    openSnapshot();
+    if (snapshot_.shared) {
+      snapshot_.thread = std::thread(SnapshotThreadMain, this);
     }
   }
 
@@ -1065,20 +5396,121 @@ namespace px_sched {
     PX_SCHED_TRACE_FN("Stop");
     if (running_.load()) {
       running_.store(false);
-      for(uint16_t i = 0; i < params_.num_threads; ++i) {
-        wakeUpThreads(params_.num_threads);
+      if (snapshot_.shared) {
+        {
+          std::lock_guard<std::mutex> lk(snapshot_.mutex);
+          snapshot_.cv.notify_all();
+        }
+        snapshot_.thread.join();
+        closeSnapshot();
+      }
+#if PX_SCHED_CONFIG_IO_URING
+      if (io_ring_) {
+        // stop reaping completions before the workers go away
+        while(!io_ring_->submit(IORING_OP_NOP, 0, nullptr)) {
+          std::this_thread::yield();
+        }
+        io_ring_->thread.join();
+        io_ring_->release();
+        io_ring_->~IORing();
+        params_.mem_callbacks.free_fn(io_ring_);
+        io_ring_ = nullptr;
       }
-      for(uint16_t i = 0; i < params_.num_threads; ++i) {
+#endif
+      for(uint16_t i = 0; i < num_workers_; ++i) {
+        for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+          wakeUpThreads(g, groups_[g].num_threads);
+        }
+      }
+      for(uint16_t i = 0; i < num_workers_; ++i) {
         workers_[i].thread.join();
+        workers_[i].spawn_deque.reset();
         workers_[i].~Worker();
       }
       params_.mem_callbacks.free_fn(workers_);
       workers_ = nullptr;
+      num_workers_ = 0;
+      stopTrace();
+      releaseTrace();
       tasks_.reset();
       counters_.reset();
-      ready_tasks_.reset();
-      PX_SCHED_CHECK_FN(active_threads_.load() == 0, "Invalid active threads num --> %u", active_threads_.load());
+      cancel_tokens_.reset();
+      io_requests_.reset();
+      resetArenaPool();
+      for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+        for(uint16_t sg = 0; sg < params_.num_share_groups; ++sg) {
+          groups_[g].ready_tasks[sg].reset();
+        }
+        groups_[g].deadline_tasks.reset();
+        if (hybrid_) {
+          for(uint8_t c = 0; c < PlacementStats::kNumCoreClasses; ++c) {
+            groups_[g].placed_tasks[c].reset();
+          }
+        }
+        PX_SCHED_CHECK_FN(groups_[g].active_threads.load() == 0,
+            "Invalid active threads num --> %u (group %u)",
+            groups_[g].active_threads.load(), g);
+        groups_[g].~WorkerGroup();
+      }
+      params_.mem_callbacks.free_fn(groups_);
+      groups_ = nullptr;
+    }
+  }
+
+  void Scheduler::readAsync(int fd, uint64_t offset, void *buffer, size_t size,
+                            Sync *sync_obj, int64_t *out_result) {
+    PX_SCHED_TRACE_FN("ReadAsync");
+    PX_SCHED_CHECK_FN(running_.load(), "Scheduler not running");
+    uint32_t hnd = adquireFromPool(&io_requests_, nullptr);
+    IORequest &req = io_requests_.get(hnd);
+    req.fd = fd;
+    req.offset = offset;
+    req.buffer = buffer;
+    req.size = size;
+    req.done = 0;
+    req.result = out_result;
+    req.counter_id = refCounter(sync_obj);
+#if PX_SCHED_CONFIG_IO_URING
+    if (io_ring_ && io_ring_->submit(IORING_OP_READ, hnd, &req)) return;
+#endif
+    readBlockingLater(hnd);
+  }
+
+  void Scheduler::readBlockingLater(uint32_t request_hnd) {
+    // the task takes the reference of the request to the sync object
+    TaskParams task_params;
+    task_params.worker_group = params_.io_worker_group;
+    uint32_t t_ref = allocTask(nullptr, task_params);
+    Task &task = tasks_.get(t_ref);
+    task.call = ReadBlockingTask;
+    task.call_arg = request_hnd;
+    task.counter_id = io_requests_.get(request_hnd).counter_id;
+    pushReady(t_ref);
+  }
+
+  void Scheduler::completeRead(uint32_t request_hnd, int64_t result) {
+    IORequest &req = io_requests_.get(request_hnd);
+    if (req.result) *req.result = result;
+    uint32_t counter = req.counter_id;
+    io_requests_.unref(request_hnd);
+    if (pool_waiters_.load()) notifyPoolWaiters();
+    unrefCounter(counter);
+  }
+
+  uint32_t Scheduler::active_threads() const {
+    uint32_t total = 0;
+    for(uint16_t g = 0; groups_ && g < params_.num_worker_groups; ++g) {
+      total += groups_[g].active_threads.load();
+    }
+    return total;
+  }
+
+  uint32_t Scheduler::num_tasks_ready() {
+    uint32_t total = 0;
+    for(uint16_t g = 0; groups_ && g < params_.num_worker_groups; ++g) {
+      total += numReady(&groups_[g]);
     }
+    return total;
   }
   
   void Scheduler::getDebugStatus(char *buffer, size_t buffer_size) {
@@ -1087,12 +5519,16 @@ namespace px_sched {
     int n = 0;
     #define _ADD(...) {p += static_cast<size_t>(n); (p < buffer_size) && (n = snprintf(buffer+p, buffer_size-p,__VA_ARGS__));}
     _ADD("Workers:0    5    10   15   20   25   30   35   40   45   50   55   60   65   70   75\n");
-    _ADD("%3u/%3u:", active_threads_.load(), params_.max_running_threads);
-    for(size_t i = 0; i < params_.num_threads; ++i) {
-      _ADD( (workers_[i].wake_up.load() == nullptr)?"*":".");
+    for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+      const WorkerGroup &group = groups_[g];
+      _ADD("%3u/%3u:", group.active_threads.load(), group.max_running_threads);
+      for(size_t i = 0; i < group.num_threads; ++i) {
+        _ADD( (workers_[group.first_worker+i].wake_up.load() == nullptr)?"*":".");
+      }
+      _ADD(" %s\n", params_.worker_groups[g].name? params_.worker_groups[g].name : "-no-name-");
     }
-    _ADD("\nWorkers(%d):", params_.num_threads);
-    for(size_t i = 0; i < params_.num_threads; ++i) {
+    _ADD("Workers(%d):", num_workers_);
+    for(size_t i = 0; i < num_workers_; ++i) {
       auto &w = workers_[i];
       bool is_on =(w.wake_up.load() == nullptr);
       bool has_something_to_show = w.thread_tls->next_lock.ptr;
@@ -1127,10 +5563,79 @@ namespace px_sched {
         }
       }
     }
-    _ADD("\nReady: ");
-    for(uint32_t i = 0; i < ready_tasks_.in_use_; ++i) {
-      _ADD("%d,",ready_tasks_.list_[i]);
+    for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+      if (groups_[g].deadline_tasks.count.load()) {
+        _ADD("\nDeadline(%u): %u tasks", g, groups_[g].deadline_tasks.count.load());
+      }
+      for(uint16_t sg = 0; sg < params_.num_share_groups; ++sg) {
+        IndexQueue &ready = groups_[g].ready_tasks[sg];
+        if (sg == 0) {
+          _ADD("\nReady(%u): ", g);
+        } else {
+          _ADD("\nReady(%u/%s): ", g, params_.share_groups[sg].name? params_.share_groups[sg].name : "-no-name-");
+        }
+        for(uint32_t i = 0; i < ready.in_use_; ++i) {
+          _ADD("%d,",ready.list_[(ready.current_+i)%ready.size_]);
+        }
+      }
+    }
+    if (params_.num_share_groups > 1) {
+      for(uint16_t sg = 0; sg < params_.num_share_groups; ++sg) {
+        const ShareGroup &share = share_groups_[sg];
+        _ADD("\nShare %s: weight %u, %u running, %llu tasks, %llu us",
+            params_.share_groups[sg].name? params_.share_groups[sg].name : "-no-name-",
+            params_.share_groups[sg].weight, share.running_tasks.load(),
+            static_cast<unsigned long long>(share.tasks_executed.load()),
+            static_cast<unsigned long long>(share.cpu_time_ns.load()/1000));
+      }
+    }
+#if PX_SCHED_CONFIG_IO_URING
+    if (io_ring_) {
+      _ADD("\nIO: io_uring, %u reads in flight", io_ring_->in_flight.load());
+    } else
+#endif
+    {
+      _ADD("\nIO: blocking reads on group %u", params_.io_worker_group);
+    }
+    _ADD("\nTimers: %u", timers_.count.load());
+    _ADD("\nArena: %u blocks of %u bytes", arena_.num_blocks.load(), params_.arena_block_size);
+    _ADD("\nCancelled: %u tasks skipped, %u tokens", tasks_cancelled_.load(), cancel_tokens_.in_use());
+    _ADD("\nPools: tasks %u/%u (%u waits), sync objects %u/%u (%u waits), %u threads waiting",
+        tasks_.in_use(), tasks_.size(), task_pool_waits_.load(),
+        counters_.in_use(), counters_.size(), sync_pool_waits_.load(), pool_waiters_.load());
+    {
+      DeadlineMiss misses[4];
+      uint32_t num_misses = getDeadlineMisses(misses, 4);
+      _ADD("\nDeadlines: %u missed", deadline_misses_.count.load());
+      for(uint32_t i = 0; i < num_misses; ++i) {
+        static const char *causes[] = {"ready late", "started late", "ran long"};
+        const DeadlineMiss &m = misses[i];
+        _ADD("\n  %s: %s, finished %llu us late", m.name? m.name : "-no-name-", causes[m.cause],
+            static_cast<unsigned long long>(m.finish_time - m.deadline));
+        for(uint32_t j = 0; j < m.num_upstream; ++j) {
+          _ADD("\n    after %s, finished %lld us after the deadline",
+              m.upstream[j].name? m.upstream[j].name : "-no-name-",
+              static_cast<long long>(m.upstream[j].finish_time) - static_cast<long long>(m.deadline));
+        }
+      }
+    }
+#if PX_SCHED_LOCK_PROFILER
+    {
+      LockProfile locks[8];
+      uint32_t num_locks = getLockProfile(locks, 8);
+      _ADD("\nLocks(%u):", num_locks);
+      for(uint32_t i = 0; i < num_locks; ++i) {
+        const LockProfile &lp = locks[i];
+        _ADD("\n  %p(%s) adquired %llu, contended %llu, wait %llu us (max %llu us), hold %llu us",
+            lp.resource, lp.name? lp.name : "-no-name-",
+            static_cast<unsigned long long>(lp.acquisitions),
+            static_cast<unsigned long long>(lp.contended),
+            static_cast<unsigned long long>(lp.wait_ns/1000),
+            static_cast<unsigned long long>(lp.max_wait_ns/1000),
+            static_cast<unsigned long long>(lp.hold_ns/1000));
+      }
     }
+#endif
     _ADD("\nTasks: ");
     for(uint32_t i = 0; i < tasks_.size(); ++i) {
       uint32_t c,v;
@@ -1147,69 +5652,444 @@ namespace px_sched {
     #undef _ADD
   }
 
-  uint16_t Scheduler::wakeUpThreads(uint16_t max_num_threads) {
+  uint16_t Scheduler::wakeUpThreads(uint16_t worker_group, uint16_t max_num_threads,
+                                    uint8_t core_class) {
     //PX_SCHED_TRACE_FN("WakeUpThreads");
+    WorkerGroup &group = groups_[worker_group];
     uint16_t total_woken_up = 0;
-    for(uint32_t i = 0; (i < params_.num_threads) && (total_woken_up < max_num_threads); ++i) {
-      WaitFor *wake_up = workers_[i].wake_up.exchange(nullptr);
-      if (wake_up) {
-        wake_up->signal();
-        total_woken_up++;
-        // Add one to the total active threads, for later substracting it, this
-        // will take the thread as awake before the thread actually is again working
-        active_threads_.fetch_add(1);
+    // first pass only for the workers of core_class (if any)
+    uint32_t pass = (core_class < PlacementStats::kNumCoreClasses)? 0 : 1;
+    for(; pass < 2 && total_woken_up < max_num_threads; ++pass) {
+      for(uint32_t i = 0; (i < group.num_threads) && (total_woken_up < max_num_threads); ++i) {
+        Worker &worker = workers_[group.first_worker+i];
+        if (pass == 0 && worker.core_class != core_class) continue;
+        WaitFor *wake_up = worker.wake_up.exchange(nullptr);
+        if (wake_up) {
+          wake_up->signal();
+          total_woken_up++;
+          // Add one to the total active threads, for later substracting it, this
+          // will take the thread as awake before the thread actually is again working
+          group.active_threads.fetch_add(1);
+        }
       }
     }
-    active_threads_.fetch_sub(total_woken_up);
+    group.active_threads.fetch_sub(total_woken_up);
     return total_woken_up;
   }
 
-  void Scheduler::wakeUpOneThread() {
+  // binds the thread to a set of cpus, false if it can not be done on this
+  // platform
+  bool Scheduler::PinThread(std::thread *thread, const uint32_t *cpus, uint32_t num_cpus) {
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for(uint32_t i = 0; i < num_cpus; ++i) {
+      if (cpus[i] < sizeof(DWORD_PTR)*8) mask |= DWORD_PTR(1) << cpus[i];
+    }
+    return mask && SetThreadAffinityMask(thread->native_handle(), mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(uint32_t i = 0; i < num_cpus; ++i) {
+      if (cpus[i] < CPU_SETSIZE) CPU_SET(cpus[i], &set);
+    }
+    return CPU_COUNT(&set) && pthread_setaffinity_np(thread->native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    (void)cpus;
+    (void)num_cpus;
+    return false;
+#endif
+  }
+
+  uint32_t Scheduler::detectCpuCapacities(uint32_t *out, uint32_t max_cpus) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return 0;
+    auto read_value = [](const char *path, uint32_t *value) {
+      FILE *f = fopen(path, "r");
+      if (!f) return false;
+      bool ok = fscanf(f, "%u", value) == 1;
+      fclose(f);
+      return ok;
+    };
+    char path[128];
+    uint32_t num = 0;
+    for(uint32_t cpu = 0; cpu < max_cpus && cpu < CPU_SETSIZE; ++cpu) {
+      out[cpu] = 0;
+      if (!CPU_ISSET(cpu, &allowed)) continue;
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpu_capacity", cpu);
+      if (!read_value(path, &out[cpu])) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpufreq/cpuinfo_max_freq", cpu);
+        if (!read_value(path, &out[cpu])) return 0;
+      }
+      num = cpu + 1;
+    }
+    return num;
+#else
+    (void)out;
+    (void)max_cpus;
+    return 0;
+#endif
+  }
+
+  // the first threads of each group go to performance cores, the rest to
+  // efficiency cores (at least one performance thread per group)
+  void Scheduler::splitCoreClasses(const uint32_t *num_class_cpus) {
+    const uint32_t total_cpus = num_class_cpus[PlacementStats::kPerformance] +
+        num_class_cpus[PlacementStats::kEfficiency];
+    for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+      const WorkerGroupParams &gp = params_.worker_groups[g];
+      WorkerGroup &group = groups_[g];
+      // latency groups have their own placement
+      if (gp.spinning || gp.first_cpu >= 0 || !group.num_threads) continue;
+      uint32_t performance = (uint32_t(group.num_threads)*num_class_cpus[PlacementStats::kPerformance] +
+          total_cpus/2)/total_cpus;
+      if (performance == 0) performance = 1;
+      if (performance > group.num_threads) performance = group.num_threads;
+      group.class_threads[PlacementStats::kPerformance] = static_cast<uint16_t>(performance);
+      group.class_threads[PlacementStats::kEfficiency] = static_cast<uint16_t>(group.num_threads - performance);
+      for(uint16_t i = 0; i < group.num_threads; ++i) {
+        workers_[group.first_worker + i].core_class = (i < performance)?
+            PlacementStats::kPerformance : PlacementStats::kEfficiency;
+      }
+    }
+  }
+
+  void Scheduler::getPlacementStats(PlacementStats *out) const {
+    *out = PlacementStats();
+    out->hybrid = hybrid_;
+    for(uint16_t i = 0; i < num_workers_; ++i) {
+      const Worker &w = workers_[i];
+      if (w.core_class >= PlacementStats::kNumCoreClasses) continue;
+      out->workers[w.core_class]++;
+      for(uint32_t c = 0; c < TaskParams::kNumCosts; ++c) {
+        out->tasks[w.core_class][c] += w.placed_tasks[c].load();
+        out->time_ns[w.core_class][c] += w.placed_ns[c].load();
+      }
+    }
+  }
+
+  uint32_t Scheduler::workerLocalSlots() const {
+    return num_workers_ + params_.max_external_threads;
+  }
+
+  uint32_t Scheduler::workerLocalIndex() {
+    TLS *d = tls();
+    if (d->scheduler == this && d->worker) return static_cast<uint32_t>(d->worker - workers_);
+    if (d->external_scheduler != this || d->external_generation != external_generation_) {
+      // the slot is kept by the thread until the scheduler is initialized again
+      uint32_t slot = external_slots_.fetch_add(1);
+      PX_SCHED_CHECK_FN(slot < params_.max_external_threads,
+          "Too many threads using WorkerLocal, see SchedulerParams::max_external_threads");
+      d->external_scheduler = this;
+      d->external_generation = external_generation_;
+      d->external_slot = slot;
+    }
+    return num_workers_ + d->external_slot;
+  }
+
+  uint16_t Scheduler::traceWorker() const {
+    TLS *d = tls();
+    if (d->scheduler != this || !d->worker) return TraceEvent::kNoWorker;
+    return static_cast<uint16_t>(d->worker - workers_);
+  }
+
+  void Scheduler::fillSnapshot(Snapshot::Data *data) {
+    for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+      data->groups[g].ready_tasks = numReady(&groups_[g]);
+      data->groups[g].active_threads = groups_[g].active_threads.load();
+    }
+    data->num_workers = (num_workers_ < Snapshot::kMaxWorkers)? num_workers_ : Snapshot::kMaxWorkers;
+    for(uint32_t i = 0; i < data->num_workers; ++i) {
+      Worker &w = workers_[i];
+      Snapshot::Worker &out = data->workers[i];
+      const char *group_name = params_.worker_groups[w.worker_group].name;
+      snprintf(out.name, Snapshot::kNameSize, "%s-%u", group_name? group_name : "Group", w.thread_index);
+      out.group = w.worker_group;
+      out.tasks_executed = w.tasks_executed.load();
+      out.task_start = w.task_start.load();
+      if (out.task_start) {
+        const char *task_name = w.task_name.load();
+        snprintf(out.task, Snapshot::kNameSize, "%s", task_name? task_name : "-");
+        out.state = Snapshot::kRunning;
+      } else {
+        out.state = (w.wake_up.load() != nullptr)? Snapshot::kParked : Snapshot::kIdle;
+      }
+    }
+  }
+
+  void Scheduler::SnapshotThreadMain(Scheduler *schd) {
+    set_current_thread_name("Snapshot");
+    const std::chrono::microseconds period(schd->params_.snapshot_period_in_microseconds);
+    std::unique_lock<std::mutex> lk(schd->snapshot_.mutex);
+    while (schd->running_.load()) {
+      schd->publishSnapshot();
+      schd->snapshot_.cv.wait_for(lk, period);
+    }
+  }
+
+  // Workers execute ready tasks of their group until an element of the full
+  // pool is released, they never park (the tasks that would release it might
+  // be queued behind them). Returns false if the thread must park: it isn't
+  // a worker, or it holds locks the tasks executed here could need (another
+  // worker is woken up to take its place while it is parked).
+  bool Scheduler::helpPool() {
+    TLS *d = tls();
+    if (d->scheduler != this || !d->worker || d->locks_held) return false;
+    flushCounterBatch(d);
+    uint32_t task_ref;
+    if (popReady(&groups_[d->worker_group], &task_ref, d->worker)) {
+      runReadyTask(task_ref);
+    } else {
+      processTimers();
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  // members of a team must be able to run at the same time
+  uint32_t Scheduler::teamCapacity(uint16_t worker_group) const {
+    const WorkerGroup &group = groups_[worker_group];
+    return (group.max_running_threads < group.num_threads)? group.max_running_threads : group.num_threads;
+  }
+
+  void Scheduler::wakeUpOneThread(uint16_t worker_group, uint8_t core_class) {
     PX_SCHED_TRACE_FN("WakeUpOneThread");
+    // spinning threads never park
+    if (params_.worker_groups[worker_group].spinning) return;
+    WorkerGroup &group = groups_[worker_group];
     // TODO: Investigate this, there is a situation where no matter how much we wait 
     //       it is unable to wakeup a single thread (Emscripten -> C++)
     for(int tries = 0; tries < 1; ++tries) {
-      uint32_t active =  active_threads_.load();
-      if ((active >= params_.max_running_threads) ||
-          wakeUpThreads(1)) return;
+      uint32_t active =  group.active_threads.load();
+      if (!SchedulingPolicy::wakeUpThread(active, group.max_running_threads) ||
+          wakeUpThreads(worker_group, 1, core_class)) return;
       // wait a bit...
       std::this_thread::yield();
     }
   }
 
-  void Scheduler::run(const Job &job, Sync *sync_obj) {
+  void Scheduler::onTimerAdded(uint64_t expiry_tick) {
+    // the parked worker in charge of the timers will wake up before
+    if (expiry_tick >= timers_.watch_tick.load()) return;
+    Worker *watcher = timer_watcher_.load();
+    if (watcher) {
+      WaitFor *wf = watcher->wake_up.exchange(nullptr);
+      if (wf) {
+        wf->signal();
+        return;
+      }
+    }
+    // nobody is watching the timers, if all threads are sleeping wake up one
+    for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+      if (groups_[g].active_threads.load() < groups_[g].max_running_threads &&
+          wakeUpThreads(g, 1)) return;
+    }
+  }
+
+  // latency mode, the thread never parks: wake ups are replaced by polling
+  // the ready queue (see SchedulerParams::addLatencyGroup)
+  void Scheduler::spinWorker(Worker *worker) {
+    WorkerGroup &group = groups_[worker->worker_group];
+    TLS *d = tls();
+    uint32_t idle_spins = 0;
+    group.idle_spinners.fetch_add(1);
+    while (running_.load()) {
+      uint32_t task_ref;
+      if (popReady(&group, &task_ref, worker)) {
+        group.idle_spinners.fetch_sub(1);
+        runReadyTask(task_ref);
+        group.idle_spinners.fetch_add(1);
+        idle_spins = 0;
+        continue;
+      }
+      flushCounterBatch(d);
+      if ((++idle_spins & 1023) == 0) processTimers();
+      PX_SCHED_CPU_PAUSE();
+    }
+    group.idle_spinners.fetch_sub(1);
+  }
+
+  // one of the parked workers is in charge of the timers, it only sleeps
+  // until the next timer expires, the rest sleep until they are woken up
+  void Scheduler::parkWorker(Worker *worker, WaitFor *wf) {
+    uint64_t tick = nextTimerTick();
+    Worker *expected = nullptr;
+    if (tick && timer_watcher_.compare_exchange_strong(expected, worker)) {
+      timers_.watch_tick.store(tick);
+      uint64_t wake_up_time = tick*timers_.resolution;
+      uint64_t t = now();
+      bool signaled = (wake_up_time > t) && wf->wait(wake_up_time - t);
+      timers_.watch_tick.store(~uint64_t(0));
+      timer_watcher_.store(nullptr);
+      if (!signaled && worker->wake_up.exchange(nullptr) == nullptr) {
+        // someone took the WaitFor object to wake us up, wait for the signal
+        wf->wait();
+      }
+    } else {
+      wf->wait();
+    }
+  }
+
+  void Scheduler::pushReady(uint32_t t_ref) {
+    Task &task = tasks_.get(t_ref);
+    if (task.trace_id) traceEvent(task.trace_id, TraceEvent::kReady);
+    if (task.limiter && !adquireLimiter(t_ref)) return;
+    queueReady(t_ref);
+  }
+
+  void Scheduler::queueReady(uint32_t t_ref) {
+    // read the group before pushing, once in the queue the task might be
+    // executed (and released) at any time
+    Task &task = tasks_.get(t_ref);
+    uint16_t worker_group = task.worker_group;
+    uint16_t share_group = task.share_group;
+    const uint16_t latency_group = params_.latency_group;
+    if (task.low_latency && latency_group && groups_[latency_group].idle_spinners.load()) {
+      worker_group = latency_group;
+    }
+    uint64_t deadline = effectiveDeadline(task);
+    if (deadline) {
+      task.ready_time = now();
+      groups_[worker_group].deadline_tasks.push(t_ref, deadline);
+      wakeUpOneThread(worker_group);
+      return;
+    }
+    if (hybrid_ && task.cost != TaskParams::kNormal &&
+        groups_[worker_group].class_threads[PlacementStats::kPerformance]) {
+      const uint8_t core_class = (task.cost == TaskParams::kHeavy)?
+          PlacementStats::kPerformance : PlacementStats::kEfficiency;
+      groups_[worker_group].placed_tasks[core_class].push(t_ref);
+      wakeUpOneThread(worker_group, core_class);
+      return;
+    }
+    IndexQueue &queue = groups_[worker_group].ready_tasks[share_group];
+    if (params_.num_share_groups > 1 && queue.in_use() == 0 &&
+        share_groups_[share_group].running_tasks.load() == 0) {
+      // the group was idle, it can't claim the time it didn't use
+      ShareGroup &sg = share_groups_[share_group];
+      uint64_t floor = share_vtime_floor_.load();
+      uint64_t v = sg.vtime.load();
+      while (v < floor && !sg.vtime.compare_exchange_weak(v, floor)) {}
+    }
+    queue.push(t_ref);
+    wakeUpOneThread(worker_group);
+  }
+
+  uint32_t Scheduler::numReady(WorkerGroup *group) {
+    uint32_t total = group->deadline_tasks.count.load();
+    for(uint16_t sg = 0; sg < params_.num_share_groups; ++sg) {
+      total += group->ready_tasks[sg].in_use();
+    }
+    if (hybrid_) {
+      for(uint8_t c = 0; c < PlacementStats::kNumCoreClasses; ++c) {
+        total += group->placed_tasks[c].in_use();
+      }
+    }
+    return total;
+  }
+
+  void Scheduler::finishShareTask(uint16_t share_group) {
+    uint32_t running = share_groups_[share_group].running_tasks.fetch_sub(1);
+    if (running == params_.share_groups[share_group].max_running_tasks) {
+      // the group was capped, tasks of other worker groups might be waiting
+      for(uint16_t g = 0; g < params_.num_worker_groups; ++g) {
+        if (groups_[g].ready_tasks[share_group].in_use()) wakeUpOneThread(g);
+        if (!hybrid_) continue;
+        for(uint8_t c = 0; c < PlacementStats::kNumCoreClasses; ++c) {
+          if (groups_[g].placed_tasks[c].in_use()) wakeUpOneThread(g, c);
+        }
+      }
+    }
+  }
+
+  bool Scheduler::popReady(WorkerGroup *group, uint32_t *task_ref,
+                           const Worker *worker, bool strict) {
+    const uint16_t num_shares = params_.num_share_groups;
+    // tasks with a deadline go first (they are not limited by share groups)
+    if (group->deadline_tasks.pop(task_ref)) {
+      if (num_shares > 1) share_groups_[tasks_.get(*task_ref).share_group].running_tasks.fetch_add(1);
+      return true;
+    }
+    if (!hybrid_) return popShareReady(group, task_ref);
+    // hybrid CPUs: the tasks placed for the class of the worker, the rest,
+    // and the tasks of the other class if its workers are busy
+    const uint8_t own_class = worker? worker->core_class : static_cast<uint8_t>(PlacementStats::kNumCoreClasses);
+    if (own_class < PlacementStats::kNumCoreClasses && popPlaced(group, own_class, task_ref)) return true;
+    if (popShareReady(group, task_ref)) return true;
+    for(uint8_t c = 0; c < PlacementStats::kNumCoreClasses; ++c) {
+      if (c == own_class) continue;
+      if (strict && group->class_busy[c].load() < group->class_threads[c]) continue;
+      if (popPlaced(group, c, task_ref)) return true;
+    }
+    return false;
+  }
+
+  // placed tasks keep the max_running_tasks of their share group, a task of
+  // a capped group goes back to the queue (they are picked in order, not by
+  // the virtual time of the group)
+  bool Scheduler::popPlaced(WorkerGroup *group, uint8_t core_class, uint32_t *task_ref) {
+    IndexQueue &queue = group->placed_tasks[core_class];
+    if (!queue.pop(task_ref)) return false;
+    if (params_.num_share_groups == 1) return true;
+    const uint16_t share_group = tasks_.get(*task_ref).share_group;
+    const uint16_t max_running = params_.share_groups[share_group].max_running_tasks;
+    uint32_t running = share_groups_[share_group].running_tasks.fetch_add(1);
+    if (max_running && running >= max_running) {
+      share_groups_[share_group].running_tasks.fetch_sub(1);
+      queue.push(*task_ref);
+      return false;
+    }
+    return true;
+  }
+
+  // picks the task of the share group with the lowest virtual time
+  bool Scheduler::popShareReady(WorkerGroup *group, uint32_t *task_ref) {
+    const uint16_t num_shares = params_.num_share_groups;
+    if (num_shares == 1) return group->ready_tasks[0].pop(task_ref);
+    uint32_t discarded = 0;
+    for(;;) {
+      uint16_t best = SchedulingPolicy::pickShareGroup(params_, discarded,
+          [group](uint16_t sg) { return group->ready_tasks[sg].in_use() != 0; },
+          [this](uint16_t sg) { return share_groups_[sg].running_tasks.load(); },
+          [this](uint16_t sg) { return share_groups_[sg].vtime.load(); });
+      if (best == num_shares) return false;
+      ShareGroup &share = share_groups_[best];
+      const uint64_t best_vtime = share.vtime.load();
+      uint16_t max_running = params_.share_groups[best].max_running_tasks;
+      uint32_t running = share.running_tasks.fetch_add(1);
+      if ((max_running && running >= max_running) || !group->ready_tasks[best].pop(task_ref)) {
+        share.running_tasks.fetch_sub(1);
+        discarded |= (1u << best);
+        continue;
+      }
+      uint64_t floor = share_vtime_floor_.load();
+      while (floor < best_vtime && !share_vtime_floor_.compare_exchange_weak(floor, best_vtime)) {}
+      return true;
+    }
+  }
+
+  void Scheduler::run(const Job &job, Sync *sync_obj, const TaskParams &task_params) {
     PX_SCHED_TRACE_FN("RunTask");
     PX_SCHED_CHECK_FN(running_.load(), "Scheduler not running");
-    uint32_t t_ref = createTask(job, sync_obj);
-    ready_tasks_.push(t_ref);
-    wakeUpOneThread();
+    uint32_t t_ref = createTask(job, sync_obj, task_params);
+    pushReady(t_ref);
   }
 
-  void Scheduler::runAfter(Sync _trigger, const Job& _job, Sync* _sync_obj) {
+  void Scheduler::runAfter(Sync _trigger, const Job& _job, Sync* _sync_obj, const TaskParams &task_params) {
     PX_SCHED_TRACE_FN("RunTaskAfter");
     PX_SCHED_CHECK_FN(running_.load(), "Scheduler not running");
-    uint32_t trigger = _trigger.hnd;
-    uint32_t t_ref = createTask(_job, _sync_obj);
-    bool valid = counters_.ref(trigger);
-    if (valid) {
-      Counter *c = &counters_.get(trigger);
-      for(;;) {
-        uint32_t current = c->task_id.load();
-        if (c->task_id.compare_exchange_strong(current, t_ref)) {
-          Task *task = &tasks_.get(t_ref);
-          task->next_sibling_task.store(current);
-          break;
-        }
-      }
-      unrefCounter(trigger);
-    } else {
-      ready_tasks_.push(t_ref);
-      wakeUpOneThread();
+    uint32_t t_ref = createTask(_job, _sync_obj, task_params);
+    if (!linkTask(t_ref, _trigger.hnd, task_params.deadline)) {
+      pushReady(t_ref);
     }
   }
 
   void Scheduler::waitFor(Sync s) {
     PX_SCHED_TRACE_FN("WaitFor");
+    // a worker could hold decrements of the same sync object
+    TLS *d = tls();
+    if (d->scheduler == this) flushCounterBatch(d);
     if (counters_.ref(s.hnd)) {
       Counter &counter = counters_.get(s.hnd);
       PX_SCHED_CHECK_FN(counter.wait_ptr == nullptr, "Sync object already used for waitFor operation, only one is permited");
@@ -1226,27 +6106,193 @@ namespace px_sched {
     return counters_.refCount(s.hnd);
   }
 
-  void Scheduler::unrefCounter(uint32_t hnd) {
+  // the caller must hold the references
+  void Scheduler::unrefCounter(uint32_t hnd, uint32_t count) {
     PX_SCHED_TRACE_FN("UnrefCounter");
-    if (counters_.ref(hnd)) {
-      counters_.unref(hnd);
+    if (hnd) {
       Scheduler *schd = this;
-      counters_.unref(hnd, [schd](Counter &c) {
+      counters_.unref(hnd, count, [schd](Counter &c) {
+        schd->releaseArena(&c);
         // wake up all tasks 
         uint32_t tid = c.task_id.load();
         while (schd->tasks_.ref(tid)) {
           Task &task = schd->tasks_.get(tid);
           uint32_t next_tid = task.next_sibling_task.load(); 
           task.next_sibling_task.store(0);
-          schd->ready_tasks_.push(tid);
-          schd->wakeUpOneThread();
-          schd->tasks_.unref(tid);
+          schd->inheritUpstream(&c, &task);
+          if (task.call == EdgeTask) {
+            // chained sync object, no need to go through the ready queue
+            if (task.trace_id) {
+              schd->traceEvent(task.trace_id, TraceEvent::kReady);
+              schd->traceEvent(task.trace_id, TraceEvent::kStart);
+              schd->traceEvent(task.trace_id, TraceEvent::kEnd);
+            }
+            schd->tasks_.unref(tid);
+            schd->finishTask(tid);
+          } else {
+            schd->pushReady(tid);
+            schd->tasks_.unref(tid);
+          }
           tid = next_tid;
         }
         if (c.wait_ptr) {
           c.wait_ptr->signal();
         }
       });
+      if (pool_waiters_.load()) notifyPoolWaiters();
+    }
+  }
+
+  // Wide sync objects (thousands of tasks) would make every worker fight for
+  // the same cache line, while the counter is far from zero each worker
+  // gathers its decrements and applies them at once. The batch is flushed
+  // before the worker executes a task of another sync object, or runs out of
+  // tasks, so the last decrements are never delayed.
+  void Scheduler::releaseCounter(uint32_t hnd) {
+    TLS *d = tls();
+    if (!hnd || !counter_batch_threshold_ || d->scheduler != this) {
+      unrefCounter(hnd);
+      return;
+    }
+    if (d->batch_counter != hnd) flushCounterBatch(d);
+    d->batch_counter = hnd;
+    d->batch_count++;
+    if (d->batch_count >= params_.counter_batch_size ||
+        counters_.refCount(hnd) <= counter_batch_threshold_) {
+      flushCounterBatch(d);
+    }
+  }
+
+  void Scheduler::flushCounterBatch(TLS *d) {
+    if (d->batch_count) {
+      PX_SCHED_TRACE_FN("FlushCounterBatch");
+      uint32_t hnd = d->batch_counter;
+      uint32_t count = d->batch_count;
+      d->batch_counter = 0;
+      d->batch_count = 0;
+      unrefCounter(hnd, count);
+    }
+  }
+
+  void Scheduler::spawnChild(SpawnScope *scope, const Job &job) {
+    TLS *d = tls();
+    Worker *worker = (d->scheduler == this)? d->worker : nullptr;
+    if (!worker) {
+      run(job, &scope->tasks_);
+      return;
+    }
+    if (scope->num_nodes_ < PX_SCHED_SPAWN_SCOPE_SIZE) {
+      SpawnScope::Node *node = &scope->nodes_[scope->num_nodes_];
+      node->job = job;
+      node->scope = scope;
+      scope->pending_.fetch_add(1);
+      bool was_empty = false;
+      if (worker->spawn_deque.push(node, &was_empty)) {
+        scope->num_nodes_++;
+        // someone might steal it
+        if (was_empty) wakeUpOneThread(worker->worker_group);
+        return;
+      }
+      scope->pending_.fetch_sub(1);
+    }
+    // no room, execute it right away
+    Job j(job);
+    j();
+  }
+
+  void Scheduler::syncScope(SpawnScope *scope) {
+    PX_SCHED_TRACE_FN("SyncScope");
+    if (scope->num_nodes_) {
+      Worker *worker = tls()->worker;
+      while (scope->pending_.load()) {
+        SpawnScope::Node *node = worker->spawn_deque.pop();
+        if (node) {
+          PX_SCHED_CHECK_FN(node->scope == scope, "Invalid spawned node, scopes must be synced in order");
+          runSpawned(node);
+        } else if (!stealSpawned(worker)) {
+          // children are being executed by other workers
+          std::this_thread::yield();
+        }
+      }
+      scope->num_nodes_ = 0;
+    }
+    if (counters_.refCount(scope->tasks_.hnd)) {
+      waitFor(scope->tasks_);
+    }
+  }
+
+  void Scheduler::runSpawned(SpawnScope::Node *node) {
+    PX_SCHED_TRACE_FN("RunSpawned");
+    SpawnScope *scope = node->scope;
+    node->job();
+    // the scope might be gone after this
+    scope->pending_.fetch_sub(1);
+  }
+
+  bool Scheduler::stealSpawned(Worker *thief, bool strict) {
+    const WorkerGroup &group = groups_[thief->worker_group];
+    // children spawned on performance cores stay there while it is possible
+    const bool skip_performance = strict && thief->core_class == PlacementStats::kEfficiency &&
+        group.class_busy[PlacementStats::kPerformance].load() < group.class_threads[PlacementStats::kPerformance];
+    for(uint16_t i = 1; i < group.num_threads; ++i) {
+      uint16_t victim = static_cast<uint16_t>((thief->thread_index + i) % group.num_threads);
+      Worker &victim_worker = workers_[group.first_worker + victim];
+      if (skip_performance && victim_worker.core_class == PlacementStats::kPerformance) continue;
+      SpawnScope::Node *node = victim_worker.spawn_deque.steal();
+      if (node) {
+        runSpawned(node);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // executes a task taken from the ready queue (by a worker)
+  void Scheduler::runReadyTask(uint32_t task_ref) {
+    TLS *d = tls();
+    Task &task = tasks_.get(task_ref);
+    if (d->batch_counter != task.counter_id) {
+      flushCounterBatch(d);
+    }
+    uint16_t share_group = task.share_group;
+    Limiter *limiter = task.limiter;
+    Worker *worker = d->worker;
+    const uint8_t core_class = (hybrid_ && worker)?
+        worker->core_class : static_cast<uint8_t>(PlacementStats::kNumCoreClasses);
+    const uint8_t cost = task.cost;
+    uint64_t placed_start = 0;
+    if (core_class < PlacementStats::kNumCoreClasses) {
+      groups_[worker->worker_group].class_busy[core_class].fetch_add(1);
+      placed_start = now();
+    }
+    const bool snapshot = snapshot_.shared != nullptr;
+    const char *prev_name = nullptr;
+    uint64_t prev_start = 0;
+    if (snapshot) {
+      // tasks can be nested (see helpPool)
+      prev_name = worker->task_name.load();
+      prev_start = worker->task_start.load();
+      worker->task_name.store(task.name);
+      worker->task_start.store(now());
+    }
+    executeTask(&task);
+    if (core_class < PlacementStats::kNumCoreClasses) {
+      worker->placed_ns[cost].fetch_add(now() - placed_start);
+      worker->placed_tasks[cost].fetch_add(1);
+      groups_[worker->worker_group].class_busy[core_class].fetch_sub(1);
+    }
+    if (snapshot) {
+      worker->task_name.store(prev_name);
+      worker->task_start.store(prev_start);
+      worker->tasks_executed.fetch_add(1);
+    }
+    if (limiter) {
+      uint32_t next = releaseLimiter(limiter);
+      if (next) queueReady(next);
+    }
+    finishTask(task_ref);
+    if (params_.num_share_groups > 1) {
+      finishShareTask(share_group);
     }
   }
 
@@ -1254,52 +6300,69 @@ namespace px_sched {
     char buffer[16];
 
     const uint16_t id = worker_data->thread_index;
+    const uint16_t group_id = worker_data->worker_group;
+    WorkerGroup &group = schd->groups_[group_id];
     TLS *local_storage = tls();
 
     local_storage->scheduler = schd;
+    local_storage->worker_group = group_id;
+    local_storage->worker = worker_data;
     worker_data->thread_tls = local_storage;
 
     auto const ttl_wait = schd->params_.thread_sleep_on_idle_in_microseconds;
     auto const ttl_value = schd->params_.thread_num_tries_on_idle? schd->params_.thread_num_tries_on_idle:1;
-    schd->active_threads_.fetch_add(1);
-    snprintf(buffer,16,"Worker-%u", id);
+    group.active_threads.fetch_add(1);
+    const char *group_name = schd->params_.worker_groups[group_id].name;
+    snprintf(buffer,16,"%s-%u", group_name? group_name : "Group", id);
     schd->set_current_thread_name(buffer);
+    if (schd->params_.worker_groups[group_id].spinning) {
+      schd->spinWorker(worker_data);
+      group.active_threads.fetch_sub(1);
+      return;
+    }
     for(;;) {
       { // wait for new activity
         PX_SCHED_TRACE_FN("WorkerGoToSleep");
-        auto current_num = schd->active_threads_.fetch_sub(1);
+        auto current_num = group.active_threads.fetch_sub(1);
         if (!schd->running_.load()) return;
-        if (schd->ready_tasks_.in_use() == 0 ||
-            current_num > schd->params_.max_running_threads) {
+        schd->processTimers();
+        schd->flushCounterBatch(local_storage);
+        if (schd->numReady(&group) == 0 ||
+            current_num > group.max_running_threads) {
           WaitFor wf;
-          schd->workers_[id].wake_up.store(&wf);
-          wf.wait();
+          worker_data->wake_up.store(&wf);
+          schd->parkWorker(worker_data, &wf);
           if (!schd->running_.load()) return;
         }
-        schd->active_threads_.fetch_add(1);
-        schd->workers_[id].wake_up.store(nullptr);
+        group.active_threads.fetch_add(1);
+        worker_data->wake_up.store(nullptr);
       }
       auto ttl = ttl_value;
       { // do some work
         PX_SCHED_TRACE_FN("WorkerRunning");
         uint32_t task_ref;
         while (ttl && schd->running_.load()) {
-          if (!schd->ready_tasks_.pop(&task_ref)) {
+          // the last try takes the tasks placed for the other class of cores
+          if (!schd->popReady(&group, &task_ref, worker_data, ttl > 1)) {
             PX_SCHED_TRACE_FN("No Task->sleep");
+            schd->flushCounterBatch(local_storage);
+            if (schd->stealSpawned(worker_data, ttl > 1)) {
+              ttl = ttl_value;
+              continue;
+            }
             ttl--;
+            schd->processTimers();
             if (ttl_wait) std::this_thread::sleep_for(std::chrono::microseconds(ttl_wait));
             continue;
           }
           ttl = ttl_value;
-          Task *t = &schd->tasks_.get(task_ref);
-          t->job();
-          uint32_t counter = t->counter_id;
-          schd->tasks_.unref(task_ref);
-          schd->unrefCounter(counter);
+          schd->runReadyTask(task_ref);
+          schd->processTimers();
         }
       }
     }
     worker_data->thread_tls = nullptr;
+    local_storage->worker = nullptr;
     local_storage->scheduler = nullptr;
     schd->set_current_thread_name(nullptr);
   }
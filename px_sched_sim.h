@@ -0,0 +1,459 @@
+/* -----------------------------------------------------------------------------
+Copyright (c) 2017-2019 Jose L. Hidalgo (PpluX)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+----------------------------------------------------------------------------- */
+
+// USAGE
+//
+// Virtual time simulation of px_sched: executes a task graph (synthetic or
+// recorded with px_sched_trace.h) with the cost of each task on N virtual
+// cores, to predict the effect of the scheduler parameters (threads, worker
+// and share groups, idle policy) on a machine you don't have. Tasks are
+// picked with the same SchedulingPolicy of the scheduler, with a simple
+// model of the cost of the ready queues (one lock per worker group) and of
+// waking up parked threads.
+//
+//   px_sched::Simulator sim;
+//   uint32_t root = sim.addTask(task);
+//   task.preds = {root};
+//   sim.addTask(task);
+//   px_sched::Simulator::Params params;
+//   params.scheduler.num_threads = 64;
+//   params.num_cores = 64;
+//   px_sched::Simulator::Result r = sim.run(params);
+//
+// Include px_sched_trace.h before this file to replay traces (addTrace).
+//
+// In *ONE* C++ file you need to declare
+// #define PX_SCHED_SIM_IMPLEMENTATION 1
+// before including the file that contains px_sched_sim.h
+//
+// px_sched_sim must be included *AFTER* px_sched.h
+
+#ifndef PX_SCHED_SIM
+#define PX_SCHED_SIM
+
+#ifndef PX_SCHED
+#error px_sched must be included before px_sched_sim (because sim plugin does not include px_sched.h)
+#endif
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace px_sched {
+
+  class Simulator {
+  public:
+    struct Task {
+      std::string name;
+      uint64_t cost_ns = 0;       //< execution time
+      uint64_t release_ns = 0;    //< not ready before (external events)
+      uint64_t deadline_ns = 0;   //< 0 --> no deadline (see TaskParams::deadline)
+      uint16_t worker_group = 0;
+      uint16_t share_group = 0;
+      std::vector<uint32_t> preds; //< tasks it waits for (indices of addTask)
+    };
+
+    struct Params {
+      // threads, groups and idle policy (thread_num_tries_on_idle and
+      // thread_sleep_on_idle_in_microseconds) to evaluate. max_running_threads
+      // 0 --> num_cores.
+      SchedulerParams scheduler;
+      uint16_t num_cores = 0;          //< 0 --> one per thread
+      uint64_t queue_op_ns = 50;       //< push/pop of a ready queue, under its lock
+      uint64_t wake_up_ns = 20000;     //< from waking up a parked thread until it runs
+      uint64_t task_overhead_ns = 200; //< per task (allocation, sync objects)
+    };
+
+    struct Result {
+      uint32_t num_tasks = 0;
+      uint32_t tasks_executed = 0;        //< the rest waited for tasks not in the graph
+      uint16_t num_cores = 0;
+      uint64_t makespan_ns = 0;
+      uint64_t busy_ns = 0;               //< cores executing tasks
+      double utilisation = 0;             //< busy/(cores*makespan)
+      uint64_t queue_contention_ns = 0;   //< waiting for the lock of a ready queue
+      uint64_t ready_latency_ns = 0;      //< sum of ready to start
+      uint64_t max_ready_latency_ns = 0;
+      uint32_t wake_ups = 0;
+      uint32_t deadline_misses = 0;
+      std::vector<uint64_t> worker_busy_ns;
+    };
+
+    uint32_t addTask(const Task &task);
+    Task &task(uint32_t index) { return tasks_[index]; }
+    uint32_t numTasks() const { return static_cast<uint32_t>(tasks_.size()); }
+    void clear() { tasks_.clear(); }
+
+#ifdef PX_SCHED_TRACE
+    // adds the executed tasks of a trace, with their recorded durations. Root
+    // tasks keep the time they were ready (relative to the first task).
+    void addTrace(const TraceAnalysis &analysis);
+#endif
+
+    Result run(const Params &params) const;
+    static void printResult(FILE *out, const Result &result);
+
+  private:
+    std::vector<Task> tasks_;
+  };
+
+} // px_sched namespace
+
+#endif // PX_SCHED_SIM
+
+//----------------------------------------------------------------------------
+#if defined(PX_SCHED_SIM_IMPLEMENTATION) && !defined(PX_SCHED_SIM_IMPLEMENTATION_DONE)
+
+#define PX_SCHED_SIM_IMPLEMENTATION_DONE 1
+#include <algorithm>
+#include <deque>
+#include <set>
+
+namespace px_sched {
+
+  namespace Simulator_Imp {
+    enum EventType {
+      kRelease, // dependencies done, the task is pushed to its ready queue
+      kReady,   // in the ready queue
+      kPoll,    // a thread looks for a task
+      kWake,    // a parked thread starts running
+      kEnd      // a thread finishes its task
+    };
+
+    struct Event {
+      uint64_t time;
+      uint64_t seq;
+      uint32_t type;
+      uint32_t index; // task (kRelease, kReady) or worker
+    };
+
+    struct Earlier {
+      bool operator()(const Event &a, const Event &b) const {
+        return (a.time != b.time)? a.time < b.time : a.seq < b.seq;
+      }
+    };
+
+    enum WorkerState {
+      kParked,
+      kWaking,
+      kLooking,     // polling the queue before parking
+      kWaitingCore, // with a task, but all cores are busy
+      kRunning
+    };
+
+    struct Worker {
+      uint16_t group = 0;
+      uint16_t state = kParked;
+      uint16_t tries = 0;
+      uint32_t task = 0;
+      uint64_t busy_ns = 0;
+    };
+
+    struct Group {
+      std::deque<uint32_t> ready[PX_SCHED_MAX_SHARE_GROUPS];
+      std::vector<uint32_t> deadline_tasks;
+      uint64_t lock_free_at = 0;
+      uint32_t active_threads = 0;
+      uint16_t max_running_threads = 0;
+      uint16_t first_worker = 0;
+      uint16_t num_threads = 0;
+    };
+
+    struct Share {
+      uint64_t vtime = 0;
+      uint32_t running = 0;
+    };
+
+    class State {
+    public:
+      State(const std::vector<Simulator::Task> &tasks, const Simulator::Params &params)
+        : tasks_(tasks), params_(params), sched_(params.scheduler) {
+        sched_.worker_groups[0].num_threads = sched_.num_threads;
+        sched_.worker_groups[0].max_running_threads = sched_.max_running_threads;
+        uint32_t num_workers = 0;
+        groups_.resize(sched_.num_worker_groups);
+        for(uint16_t g = 0; g < sched_.num_worker_groups; ++g) {
+          groups_[g].first_worker = static_cast<uint16_t>(num_workers);
+          groups_[g].num_threads = sched_.worker_groups[g].num_threads;
+          num_workers += groups_[g].num_threads;
+        }
+        cores_ = params.num_cores? params.num_cores : static_cast<uint16_t>(num_workers);
+        for(uint16_t g = 0; g < sched_.num_worker_groups; ++g) {
+          uint16_t max_running = sched_.worker_groups[g].max_running_threads;
+          if (max_running == 0) max_running = (g == 0)? cores_ : groups_[g].num_threads;
+          groups_[g].max_running_threads = max_running;
+        }
+        free_cores_ = cores_;
+        workers_.resize(num_workers);
+        for(uint16_t g = 0; g < sched_.num_worker_groups; ++g) {
+          for(uint16_t i = 0; i < groups_[g].num_threads; ++i) {
+            workers_[groups_[g].first_worker + i].group = g;
+          }
+        }
+        pending_.resize(tasks.size());
+        ready_time_.resize(tasks.size(), 0);
+        succs_.resize(tasks.size());
+        for(uint32_t t = 0; t < tasks.size(); ++t) {
+          for(uint32_t p : tasks[t].preds) {
+            PX_SCHED_CHECK_FN(p < tasks.size(), "Invalid dependency %u of task %u", p, t);
+            succs_[p].push_back(t);
+          }
+          pending_[t] = static_cast<uint32_t>(tasks[t].preds.size());
+        }
+        result_.num_tasks = static_cast<uint32_t>(tasks.size());
+        result_.num_cores = cores_;
+      }
+
+      Simulator::Result run() {
+        for(uint32_t t = 0; t < tasks_.size(); ++t) {
+          if (pending_[t] == 0) push(tasks_[t].release_ns, kRelease, t);
+        }
+        while (!events_.empty()) {
+          const Event e = *events_.begin();
+          events_.erase(events_.begin());
+          switch (e.type) {
+            case kRelease: release(e.time, e.index); break;
+            case kReady: ready(e.time, e.index); break;
+            case kPoll: poll(e.time, e.index); break;
+            case kWake:
+              workers_[e.index].state = kLooking;
+              workers_[e.index].tries = tries();
+              poll(e.time, e.index);
+              break;
+            case kEnd: end(e.time, e.index); break;
+            default: break;
+          }
+        }
+        result_.worker_busy_ns.resize(workers_.size());
+        for(size_t w = 0; w < workers_.size(); ++w) {
+          result_.worker_busy_ns[w] = workers_[w].busy_ns;
+          result_.busy_ns += workers_[w].busy_ns;
+        }
+        if (result_.makespan_ns && cores_) {
+          result_.utilisation = static_cast<double>(result_.busy_ns)/
+            (static_cast<double>(result_.makespan_ns)*cores_);
+        }
+        return result_;
+      }
+
+    private:
+      void push(uint64_t time, uint32_t type, uint32_t index) {
+        Event e = {time, seq_++, type, index};
+        events_.insert(e);
+      }
+
+      uint16_t tries() const {
+        return sched_.thread_num_tries_on_idle? sched_.thread_num_tries_on_idle : 1;
+      }
+
+      // the ready queues of a group are protected by a lock, returns the
+      // time the operation is done
+      uint64_t lock(uint64_t time, uint16_t group) {
+        Group &g = groups_[group];
+        uint64_t start = std::max(time, g.lock_free_at);
+        result_.queue_contention_ns += start - time;
+        g.lock_free_at = start + params_.queue_op_ns;
+        return g.lock_free_at;
+      }
+
+      void release(uint64_t time, uint32_t t) {
+        ready_time_[t] = time;
+        push(lock(time, tasks_[t].worker_group), kReady, t);
+      }
+
+      void ready(uint64_t time, uint32_t t) {
+        const Simulator::Task &task = tasks_[t];
+        Group &g = groups_[task.worker_group];
+        if (task.deadline_ns) {
+          g.deadline_tasks.push_back(t);
+        } else {
+          std::deque<uint32_t> &queue = g.ready[task.share_group];
+          Share &share = shares_[task.share_group];
+          // the group was idle, it can't claim the time it didn't use
+          if (sched_.num_share_groups > 1 && queue.empty() && share.running == 0) {
+            share.vtime = std::max(share.vtime, vtime_floor_);
+          }
+          queue.push_back(t);
+        }
+        // wakeUpOneThread
+        if (!SchedulingPolicy::wakeUpThread(g.active_threads, g.max_running_threads)) return;
+        for(uint16_t i = 0; i < g.num_threads; ++i) {
+          Worker &w = workers_[g.first_worker + i];
+          if (w.state != kParked) continue;
+          w.state = kWaking;
+          g.active_threads++;
+          result_.wake_ups++;
+          push(time + params_.wake_up_ns, kWake, g.first_worker + i);
+          return;
+        }
+      }
+
+      bool popReady(Group &g, uint32_t *t) {
+        if (!g.deadline_tasks.empty()) {
+          // earliest deadline first
+          auto it = std::min_element(g.deadline_tasks.begin(), g.deadline_tasks.end(),
+            [this](uint32_t a, uint32_t b) { return tasks_[a].deadline_ns < tasks_[b].deadline_ns; });
+          *t = *it;
+          g.deadline_tasks.erase(it);
+          shares_[tasks_[*t].share_group].running++;
+          return true;
+        }
+        uint16_t best = SchedulingPolicy::pickShareGroup(sched_, 0,
+            [&g](uint16_t sg) { return !g.ready[sg].empty(); },
+            [this](uint16_t sg) { return shares_[sg].running; },
+            [this](uint16_t sg) { return shares_[sg].vtime; });
+        if (best == sched_.num_share_groups) return false;
+        *t = g.ready[best].front();
+        g.ready[best].pop_front();
+        shares_[best].running++;
+        vtime_floor_ = std::max(vtime_floor_, shares_[best].vtime);
+        return true;
+      }
+
+      void poll(uint64_t time, uint32_t w) {
+        Worker &worker = workers_[w];
+        Group &g = groups_[worker.group];
+        uint32_t t;
+        if (popReady(g, &t)) {
+          const uint64_t popped = lock(time, worker.group);
+          worker.task = t;
+          if (free_cores_) {
+            free_cores_--;
+            start(popped, w);
+          } else {
+            worker.state = kWaitingCore;
+            core_waiters_.push_back(w);
+          }
+          return;
+        }
+        if (--worker.tries) {
+          worker.state = kLooking;
+          push(time + std::max<uint64_t>(1, uint64_t(sched_.thread_sleep_on_idle_in_microseconds)*1000), kPoll, w);
+          return;
+        }
+        worker.state = kParked;
+        g.active_threads--;
+      }
+
+      void start(uint64_t time, uint32_t w) {
+        Worker &worker = workers_[w];
+        const uint64_t latency = time - ready_time_[worker.task];
+        result_.ready_latency_ns += latency;
+        result_.max_ready_latency_ns = std::max(result_.max_ready_latency_ns, latency);
+        worker.state = kRunning;
+        push(time + tasks_[worker.task].cost_ns + params_.task_overhead_ns, kEnd, w);
+      }
+
+      void end(uint64_t time, uint32_t w) {
+        Worker &worker = workers_[w];
+        const Simulator::Task &task = tasks_[worker.task];
+        result_.tasks_executed++;
+        result_.makespan_ns = std::max(result_.makespan_ns, time);
+        if (task.deadline_ns && time > task.deadline_ns) result_.deadline_misses++;
+        worker.busy_ns += task.cost_ns + params_.task_overhead_ns;
+        Share &share = shares_[task.share_group];
+        share.running--;
+        share.vtime += SchedulingPolicy::shareVTime(task.cost_ns, sched_.share_groups[task.share_group].weight);
+        if (core_waiters_.empty()) {
+          free_cores_++;
+        } else {
+          uint32_t next = core_waiters_.front();
+          core_waiters_.pop_front();
+          start(time, next);
+        }
+        for(uint32_t s : succs_[worker.task]) {
+          if (--pending_[s] == 0) push(std::max(time, tasks_[s].release_ns), kRelease, s);
+        }
+        worker.state = kLooking;
+        worker.tries = tries();
+        push(time, kPoll, w);
+      }
+
+      const std::vector<Simulator::Task> &tasks_;
+      const Simulator::Params &params_;
+      SchedulerParams sched_;
+      std::vector<Group> groups_;
+      std::vector<Worker> workers_;
+      Share shares_[PX_SCHED_MAX_SHARE_GROUPS];
+      uint64_t vtime_floor_ = 0;
+      uint16_t cores_ = 0;
+      uint16_t free_cores_ = 0;
+      std::deque<uint32_t> core_waiters_;
+      std::vector<uint32_t> pending_;
+      std::vector<uint64_t> ready_time_;
+      std::vector<std::vector<uint32_t>> succs_;
+      std::set<Event, Earlier> events_; // by time, then by order of creation
+      uint64_t seq_ = 0;
+      Simulator::Result result_;
+    };
+  } // Simulator_Imp namespace
+
+  uint32_t Simulator::addTask(const Task &task) {
+    tasks_.push_back(task);
+    return static_cast<uint32_t>(tasks_.size() - 1);
+  }
+
+#ifdef PX_SCHED_TRACE
+  void Simulator::addTrace(const TraceAnalysis &analysis) {
+    const std::vector<TraceAnalysis::Task> &traced = analysis.tasks();
+    std::vector<uint32_t> index(traced.size(), UINT32_MAX);
+    uint64_t first = UINT64_MAX;
+    for(const TraceAnalysis::Task &t : traced) {
+      if (t.executed) first = std::min(first, t.ready);
+    }
+    uint32_t next = numTasks();
+    for(uint32_t i = 0; i < traced.size(); ++i) {
+      if (traced[i].executed) index[i] = next++;
+    }
+    for(uint32_t i = 0; i < traced.size(); ++i) {
+      const TraceAnalysis::Task &t = traced[i];
+      if (!t.executed) continue;
+      Task task;
+      task.name = t.name;
+      task.cost_ns = t.duration();
+      for(uint32_t p : t.preds) {
+        if (index[p] != UINT32_MAX) task.preds.push_back(index[p]);
+      }
+      if (task.preds.empty()) task.release_ns = t.ready - first;
+      addTask(task);
+    }
+  }
+#endif
+
+  Simulator::Result Simulator::run(const Params &params) const {
+    Simulator_Imp::State state(tasks_, params);
+    return state.run();
+  }
+
+  void Simulator::printResult(FILE *out, const Result &r) {
+    const double ms = 1000000.0;
+    fprintf(out, "%u/%u tasks on %u cores: makespan %.3fms, utilisation %.1f%%\n",
+        r.tasks_executed, r.num_tasks, r.num_cores,
+        static_cast<double>(r.makespan_ns)/ms, r.utilisation*100.0);
+    fprintf(out, "  ready->start %.3fms avg %.3fms max, queue contention %.3fms, %u wake ups, %u deadline misses\n",
+        r.tasks_executed? static_cast<double>(r.ready_latency_ns)/r.tasks_executed/ms : 0.0,
+        static_cast<double>(r.max_ready_latency_ns)/ms,
+        static_cast<double>(r.queue_contention_ns)/ms, r.wake_ups, r.deadline_misses);
+  }
+
+} // px_sched namespace
+
+#endif // PX_SCHED_SIM_IMPLEMENTATION
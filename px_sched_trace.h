@@ -0,0 +1,542 @@
+/* -----------------------------------------------------------------------------
+Copyright (c) 2017-2019 Jose L. Hidalgo (PpluX)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+----------------------------------------------------------------------------- */
+
+// USAGE
+//
+// Offline analysis of the task events recorded by px_sched (see
+// Scheduler::startTrace): rebuilds the task graph (tasks and the sync
+// objects they wait for) and reports the critical path, the parallelism,
+// why workers were idle (waiting for dependencies or for the scheduler) and
+// the tasks worth optimizing. The graph can be exported to DOT and HTML.
+//
+//   schd.startTrace(1 << 16);
+//   ... one frame ...
+//   schd.stopTrace();
+//   uint32_t num_events;
+//   const px_sched::TraceEvent *events = schd.traceEvents(&num_events);
+//   px_sched::TraceAnalysis analysis;
+//   analysis.analyze(events, num_events);
+//   analysis.printReport(stdout);
+//   analysis.exportHtml("frame.html");
+//
+// Traces can also be saved (TraceAnalysis::save) and analyzed in another
+// process (see px_sched_trace_report in examples).
+//
+// In *ONE* C++ file you need to declare
+// #define PX_SCHED_TRACE_IMPLEMENTATION 1
+// before including the file that contains px_sched_trace.h
+//
+// px_sched_trace must be included *AFTER* px_sched.h
+
+#ifndef PX_SCHED_TRACE
+#define PX_SCHED_TRACE
+
+#ifndef PX_SCHED
+#error px_sched must be included before px_sched_trace (because trace plugin does not include px_sched.h)
+#endif
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace px_sched {
+
+  class TraceAnalysis {
+  public:
+    struct Task {
+      uint32_t id = 0;
+      std::string name;
+      // nanoseconds since the first event of the trace
+      uint64_t create = 0;
+      uint64_t ready = 0;
+      uint64_t start = 0;
+      uint64_t end = 0;
+      uint16_t worker = TraceEvent::kNoWorker;
+      bool executed = false;     //< started and finished inside the trace
+      bool critical = false;     //< on the critical path
+      std::vector<uint32_t> preds; //< tasks it waited for (indices of tasks())
+      uint64_t duration() const { return end - start; }
+    };
+
+    struct Report {
+      uint32_t num_tasks = 0;         //< executed tasks
+      uint32_t num_workers = 0;
+      uint64_t makespan_ns = 0;       //< first start to last end
+      uint64_t work_ns = 0;           //< sum of task durations
+      uint64_t ideal_path_ns = 0;     //< longest chain of task durations
+      double average_parallelism = 0; //< work/makespan
+      double max_parallelism = 0;     //< work/ideal path, with infinite workers
+      // the chain of tasks that finished last (see criticalPath)
+      uint64_t path_execution_ns = 0; //< tasks executing
+      uint64_t path_dependency_ns = 0;//< from the end of the previous task to ready (sync objects held, i.e. decrementSync)
+      uint64_t path_latency_ns = 0;   //< ready but not started (scheduling latency)
+      // idle time of the workers during the makespan
+      uint64_t idle_ns = 0;
+      uint64_t idle_dependencies_ns = 0; //< no task was ready
+      uint64_t idle_scheduling_ns = 0;   //< there were ready tasks not started
+    };
+
+    struct TaskStats {
+      std::string name;
+      uint32_t count = 0;
+      uint64_t total_ns = 0;
+      uint64_t critical_ns = 0; //< time on the critical path
+    };
+
+    void analyze(const TraceEvent *events, uint32_t num_events);
+
+    // text file, one event per line
+    static bool save(const char *path, const TraceEvent *events, uint32_t num_events);
+    // loads and analyzes a trace saved with save
+    bool load(const char *path);
+
+    const Report &report() const { return report_; }
+    const std::vector<Task> &tasks() const { return tasks_; }
+    // chain of tasks that finished last, each one waiting for the previous
+    // one (indices of tasks(), in execution order)
+    const std::vector<uint32_t> &criticalPath() const { return critical_path_; }
+    // names sorted by time on the critical path (then by total time)
+    std::vector<TaskStats> topTasks(uint32_t max_entries) const;
+
+    void printReport(FILE *out, uint32_t max_top_tasks = 10) const;
+    bool exportDot(const char *path) const;
+    bool exportHtml(const char *path) const;
+
+  private:
+    std::vector<Task> tasks_;
+    std::vector<uint32_t> critical_path_;
+    Report report_;
+  };
+
+} // px_sched namespace
+
+#endif // PX_SCHED_TRACE
+
+//----------------------------------------------------------------------------
+#if defined(PX_SCHED_TRACE_IMPLEMENTATION) && !defined(PX_SCHED_TRACE_IMPLEMENTATION_DONE)
+
+#define PX_SCHED_TRACE_IMPLEMENTATION_DONE 1
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace px_sched {
+
+  namespace TraceAnalysis_Imp {
+    struct Event {
+      TraceEvent event;
+      std::string name;
+    };
+
+    inline std::string taskName(const std::string &name, uint32_t id) {
+      if (!name.empty()) return name;
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "task#%u", id);
+      return buffer;
+    }
+
+    inline double ms(uint64_t ns) {
+      return static_cast<double>(ns)/1000000.0;
+    }
+
+    inline std::string escapeHtml(const std::string &text) {
+      std::string result;
+      for(char c : text) {
+        switch(c) {
+          case '<': result += "&lt;"; break;
+          case '>': result += "&gt;"; break;
+          case '&': result += "&amp;"; break;
+          case '"': result += "&quot;"; break;
+          default: result += c; break;
+        }
+      }
+      return result;
+    }
+
+    inline void build(const Event *events, size_t num_events, std::vector<TraceAnalysis::Task> *tasks) {
+      std::unordered_map<uint32_t, uint32_t> index;         // task id -> tasks
+      std::unordered_map<uint32_t, std::vector<uint32_t>> producers; // sync -> tasks
+      std::vector<std::pair<uint32_t, uint32_t>> depends;   // task, sync
+      std::vector<bool> started;
+      uint64_t t0 = UINT64_MAX;
+      for(size_t i = 0; i < num_events; ++i) t0 = std::min(t0, events[i].event.time);
+      for(size_t i = 0; i < num_events; ++i) {
+        const TraceEvent &e = events[i].event;
+        auto it = index.find(e.task);
+        if (it == index.end()) {
+          it = index.insert(std::make_pair(e.task, static_cast<uint32_t>(tasks->size()))).first;
+          tasks->push_back(TraceAnalysis::Task());
+          tasks->back().id = e.task;
+          started.push_back(false);
+        }
+        const uint32_t t = it->second;
+        TraceAnalysis::Task &task = (*tasks)[t];
+        const uint64_t time = e.time - t0;
+        switch (e.type) {
+          case TraceEvent::kCreate:
+            task.create = time;
+            task.name = events[i].name;
+            producers[e.sync].push_back(t);
+            break;
+          case TraceEvent::kDepends:
+            depends.push_back(std::make_pair(t, e.sync));
+            break;
+          case TraceEvent::kReady:
+            // periodic tasks: only the first execution is analyzed
+            if (!started[t]) task.ready = time;
+            break;
+          case TraceEvent::kStart:
+            if (!started[t]) {
+              started[t] = true;
+              task.start = time;
+              task.worker = e.worker;
+            }
+            break;
+          case TraceEvent::kEnd:
+            if (started[t] && !task.executed) {
+              task.end = time;
+              task.executed = true;
+            }
+            break;
+          default:
+            break;
+        }
+      }
+      for(const auto &d : depends) {
+        auto it = producers.find(d.second);
+        if (it == producers.end()) continue;
+        for(uint32_t p : it->second) {
+          if (p != d.first) (*tasks)[d.first].preds.push_back(p);
+        }
+      }
+      for(TraceAnalysis::Task &task : *tasks) {
+        if (task.executed && task.ready > task.start) task.ready = task.start;
+      }
+    }
+
+    struct Point {
+      uint64_t time;
+      int32_t ready;
+      int32_t running;
+    };
+  } // TraceAnalysis_Imp namespace
+
+  void TraceAnalysis::analyze(const TraceEvent *events, uint32_t num_events) {
+    std::vector<TraceAnalysis_Imp::Event> list(num_events);
+    for(uint32_t i = 0; i < num_events; ++i) {
+      list[i].event = events[i];
+      if (events[i].name) list[i].name = events[i].name;
+    }
+    tasks_.clear();
+    critical_path_.clear();
+    report_ = Report();
+    TraceAnalysis_Imp::build(list.data(), list.size(), &tasks_);
+
+    // executed tasks by start time (a valid topological order)
+    std::vector<uint32_t> order;
+    std::vector<bool> workers;
+    uint64_t first_start = UINT64_MAX;
+    uint64_t last_end = 0;
+    for(uint32_t i = 0; i < tasks_.size(); ++i) {
+      const Task &task = tasks_[i];
+      if (!task.executed) continue;
+      order.push_back(i);
+      first_start = std::min(first_start, task.start);
+      last_end = std::max(last_end, task.end);
+      report_.work_ns += task.duration();
+      if (task.worker != TraceEvent::kNoWorker) {
+        if (workers.size() <= task.worker) workers.resize(task.worker + 1u, false);
+        workers[task.worker] = true;
+      }
+    }
+    report_.num_tasks = static_cast<uint32_t>(order.size());
+    if (order.empty()) return;
+    for(bool w : workers) if (w) report_.num_workers++;
+    if (report_.num_workers == 0) report_.num_workers = 1;
+    report_.makespan_ns = last_end - first_start;
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+      return tasks_[a].start < tasks_[b].start;
+    });
+
+    // longest chain of durations
+    std::vector<uint64_t> finish(tasks_.size(), 0);
+    for(uint32_t t : order) {
+      uint64_t earliest = 0;
+      for(uint32_t p : tasks_[t].preds) {
+        if (tasks_[p].executed) earliest = std::max(earliest, finish[p]);
+      }
+      finish[t] = earliest + tasks_[t].duration();
+      report_.ideal_path_ns = std::max(report_.ideal_path_ns, finish[t]);
+    }
+    if (report_.makespan_ns) {
+      report_.average_parallelism = static_cast<double>(report_.work_ns)/static_cast<double>(report_.makespan_ns);
+    }
+    if (report_.ideal_path_ns) {
+      report_.max_parallelism = static_cast<double>(report_.work_ns)/static_cast<double>(report_.ideal_path_ns);
+    }
+
+    // critical path: from the task that finished last, back through the
+    // dependency that finished last
+    uint32_t current = order[0];
+    for(uint32_t t : order) {
+      if (tasks_[t].end > tasks_[current].end) current = t;
+    }
+    for(;;) {
+      Task &task = tasks_[current];
+      task.critical = true;
+      critical_path_.push_back(current);
+      report_.path_execution_ns += task.duration();
+      report_.path_latency_ns += task.start - task.ready;
+      uint32_t pred = UINT32_MAX;
+      for(uint32_t p : task.preds) {
+        if (!tasks_[p].executed || tasks_[p].critical || tasks_[p].end > task.start) continue;
+        if (pred == UINT32_MAX || tasks_[p].end > tasks_[pred].end) pred = p;
+      }
+      if (pred == UINT32_MAX) break;
+      if (task.ready > tasks_[pred].end) report_.path_dependency_ns += task.ready - tasks_[pred].end;
+      current = pred;
+    }
+    std::reverse(critical_path_.begin(), critical_path_.end());
+
+    // idle workers: if tasks were ready the scheduler was late, otherwise
+    // they were waiting for dependencies
+    std::vector<TraceAnalysis_Imp::Point> points;
+    for(uint32_t t : order) {
+      const Task &task = tasks_[t];
+      TraceAnalysis_Imp::Point ready = {task.ready, 1, 0};
+      TraceAnalysis_Imp::Point start = {task.start, -1, 1};
+      TraceAnalysis_Imp::Point end = {task.end, 0, -1};
+      points.push_back(ready);
+      points.push_back(start);
+      points.push_back(end);
+    }
+    std::sort(points.begin(), points.end(), [](const TraceAnalysis_Imp::Point &a, const TraceAnalysis_Imp::Point &b) {
+      return a.time < b.time;
+    });
+    int64_t ready = 0;
+    int64_t running = 0;
+    uint64_t prev = first_start;
+    const int64_t num_workers = report_.num_workers;
+    for(const TraceAnalysis_Imp::Point &p : points) {
+      if (p.time > prev && prev >= first_start) {
+        const uint64_t dt = p.time - prev;
+        const int64_t idle = std::max<int64_t>(0, num_workers - running);
+        const int64_t late = std::min(idle, ready);
+        report_.idle_ns += static_cast<uint64_t>(idle)*dt;
+        report_.idle_scheduling_ns += static_cast<uint64_t>(late)*dt;
+        report_.idle_dependencies_ns += static_cast<uint64_t>(idle - late)*dt;
+      }
+      if (p.time > prev) prev = p.time;
+      ready += p.ready;
+      running += p.running;
+    }
+  }
+
+  std::vector<TraceAnalysis::TaskStats> TraceAnalysis::topTasks(uint32_t max_entries) const {
+    std::vector<TaskStats> stats;
+    std::unordered_map<std::string, size_t> index;
+    for(const Task &task : tasks_) {
+      if (!task.executed) continue;
+      const std::string name = task.name.empty()? std::string("(unnamed)") : task.name;
+      auto it = index.find(name);
+      if (it == index.end()) {
+        it = index.insert(std::make_pair(name, stats.size())).first;
+        stats.push_back(TaskStats());
+        stats.back().name = name;
+      }
+      TaskStats &s = stats[it->second];
+      s.count++;
+      s.total_ns += task.duration();
+      if (task.critical) s.critical_ns += task.duration();
+    }
+    std::sort(stats.begin(), stats.end(), [](const TaskStats &a, const TaskStats &b) {
+      if (a.critical_ns != b.critical_ns) return a.critical_ns > b.critical_ns;
+      return a.total_ns > b.total_ns;
+    });
+    if (stats.size() > max_entries) stats.resize(max_entries);
+    return stats;
+  }
+
+  bool TraceAnalysis::save(const char *path, const TraceEvent *events, uint32_t num_events) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "px_sched_trace 1\n");
+    for(uint32_t i = 0; i < num_events; ++i) {
+      const TraceEvent &e = events[i];
+      fprintf(f, "%u %llu %u %u %u %s\n", e.type, static_cast<unsigned long long>(e.time),
+          e.task, e.sync, e.worker, e.name? e.name : "");
+    }
+    return fclose(f) == 0;
+  }
+
+  bool TraceAnalysis::load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char line[512];
+    unsigned version = 0;
+    if (!fgets(line, sizeof(line), f) || sscanf(line, "px_sched_trace %u", &version) != 1 || version != 1) {
+      fclose(f);
+      return false;
+    }
+    std::vector<TraceAnalysis_Imp::Event> list;
+    while (fgets(line, sizeof(line), f)) {
+      unsigned type, task, sync, worker;
+      unsigned long long time;
+      int name_pos = 0;
+      if (sscanf(line, "%u %llu %u %u %u %n", &type, &time, &task, &sync, &worker, &name_pos) < 5) continue;
+      TraceAnalysis_Imp::Event e;
+      e.event.type = static_cast<uint16_t>(type);
+      e.event.time = time;
+      e.event.task = task;
+      e.event.sync = sync;
+      e.event.worker = static_cast<uint16_t>(worker);
+      e.name = line + name_pos;
+      while (!e.name.empty() && (e.name.back() == '\n' || e.name.back() == '\r')) e.name.pop_back();
+      list.push_back(e);
+    }
+    fclose(f);
+    std::vector<TraceEvent> events(list.size());
+    for(size_t i = 0; i < list.size(); ++i) {
+      events[i] = list[i].event;
+      events[i].name = list[i].name.empty()? nullptr : list[i].name.c_str();
+    }
+    analyze(events.data(), static_cast<uint32_t>(events.size()));
+    return true;
+  }
+
+  void TraceAnalysis::printReport(FILE *out, uint32_t max_top_tasks) const {
+    using TraceAnalysis_Imp::ms;
+    const Report &r = report_;
+    fprintf(out, "Tasks: %u on %u workers, makespan %.3fms, work %.3fms\n",
+        r.num_tasks, r.num_workers, ms(r.makespan_ns), ms(r.work_ns));
+    fprintf(out, "Parallelism: %.2f average, %.2f max (ideal critical path %.3fms)\n",
+        r.average_parallelism, r.max_parallelism, ms(r.ideal_path_ns));
+    fprintf(out, "Critical path: %u tasks, %.3fms executing, %.3fms waiting for sync objects, %.3fms scheduling latency\n",
+        static_cast<uint32_t>(critical_path_.size()), ms(r.path_execution_ns),
+        ms(r.path_dependency_ns), ms(r.path_latency_ns));
+    for(uint32_t t : critical_path_) {
+      const Task &task = tasks_[t];
+      fprintf(out, "  %-32s %9.3fms (ready->start %.3fms)\n",
+          TraceAnalysis_Imp::taskName(task.name, task.id).c_str(),
+          ms(task.duration()), ms(task.start - task.ready));
+    }
+    fprintf(out, "Idle workers: %.3fms, %.3fms waiting for dependencies, %.3fms with tasks ready\n",
+        ms(r.idle_ns), ms(r.idle_dependencies_ns), ms(r.idle_scheduling_ns));
+    fprintf(out, "Top tasks (critical path / total):\n");
+    for(const TaskStats &s : topTasks(max_top_tasks)) {
+      fprintf(out, "  %-32s %9.3fms %9.3fms (%u)\n", s.name.c_str(),
+          ms(s.critical_ns), ms(s.total_ns), s.count);
+    }
+  }
+
+  bool TraceAnalysis::exportDot(const char *path) const {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "digraph px_sched {\n  rankdir=LR;\n  node [shape=box, fontname=\"monospace\"];\n");
+    for(const Task &task : tasks_) {
+      if (!task.executed) continue;
+      std::string name = TraceAnalysis_Imp::taskName(task.name, task.id);
+      for(char &c : name) if (c == '"') c = '\'';
+      if (task.name.empty() && task.duration() == 0) {
+        // sync objects chained (runAfterAll, accesses...)
+        fprintf(f, "  t%u [shape=point%s];\n", task.id, task.critical? ", color=red" : "");
+      } else {
+        fprintf(f, "  t%u [label=\"%s\\n%.3fms\"%s];\n", task.id, name.c_str(),
+            TraceAnalysis_Imp::ms(task.duration()), task.critical? ", color=red, penwidth=2" : "");
+      }
+    }
+    for(const Task &task : tasks_) {
+      if (!task.executed) continue;
+      for(uint32_t p : task.preds) {
+        if (!tasks_[p].executed) continue;
+        const bool critical = task.critical && tasks_[p].critical;
+        fprintf(f, "  t%u -> t%u%s;\n", tasks_[p].id, task.id, critical? " [color=red, penwidth=2]" : "");
+      }
+    }
+    fprintf(f, "}\n");
+    return fclose(f) == 0;
+  }
+
+  bool TraceAnalysis::exportHtml(const char *path) const {
+    using TraceAnalysis_Imp::ms;
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    const Report &r = report_;
+    fprintf(f, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>px_sched trace</title>\n"
+        "<style>body{font-family:sans-serif;font-size:13px} .row{position:relative;height:22px;"
+        "border-bottom:1px solid #ddd} .task{position:absolute;height:18px;top:2px;background:#8ab;"
+        "overflow:hidden;white-space:nowrap;font-size:11px;box-sizing:border-box;border:1px solid #567}"
+        " .critical{background:#e77;border-color:#a33} td{padding:2px 8px}</style></head><body>\n");
+    fprintf(f, "<h2>px_sched trace</h2>\n<table>\n");
+    fprintf(f, "<tr><td>Tasks</td><td>%u on %u workers</td></tr>\n", r.num_tasks, r.num_workers);
+    fprintf(f, "<tr><td>Makespan</td><td>%.3fms (work %.3fms)</td></tr>\n", ms(r.makespan_ns), ms(r.work_ns));
+    fprintf(f, "<tr><td>Parallelism</td><td>%.2f average, %.2f max</td></tr>\n", r.average_parallelism, r.max_parallelism);
+    fprintf(f, "<tr><td>Critical path</td><td>%.3fms executing, %.3fms waiting for sync objects, %.3fms scheduling latency</td></tr>\n",
+        ms(r.path_execution_ns), ms(r.path_dependency_ns), ms(r.path_latency_ns));
+    fprintf(f, "<tr><td>Idle workers</td><td>%.3fms waiting for dependencies, %.3fms with tasks ready</td></tr>\n",
+        ms(r.idle_dependencies_ns), ms(r.idle_scheduling_ns));
+    fprintf(f, "</table>\n<h3>Timeline (critical path in red)</h3>\n");
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    uint32_t max_worker = 0;
+    for(const Task &task : tasks_) {
+      if (!task.executed) continue;
+      first = std::min(first, task.start);
+      last = std::max(last, task.end);
+      if (task.worker != TraceEvent::kNoWorker) max_worker = std::max<uint32_t>(max_worker, task.worker);
+    }
+    const double span = (last > first)? static_cast<double>(last - first) : 1.0;
+    // one row per worker, tasks executed outside of the workers go last
+    for(uint32_t w = 0; w <= max_worker + 1u; ++w) {
+      const uint32_t worker = (w == max_worker + 1u)? TraceEvent::kNoWorker : w;
+      std::string row;
+      for(const Task &task : tasks_) {
+        if (!task.executed || task.worker != worker || task.duration() == 0) continue;
+        const double left = 100.0*static_cast<double>(task.start - first)/span;
+        const double width = 100.0*static_cast<double>(task.duration())/span;
+        const std::string name = TraceAnalysis_Imp::escapeHtml(TraceAnalysis_Imp::taskName(task.name, task.id));
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "<div class=\"task%s\" style=\"left:%.3f%%;width:%.3f%%\" title=\"",
+            task.critical? " critical" : "", left, width);
+        row += buffer;
+        snprintf(buffer, sizeof(buffer), " %.3fms (ready->start %.3fms)\">", ms(task.duration()), ms(task.start - task.ready));
+        row += name + buffer + name + "</div>";
+      }
+      if (row.empty()) continue;
+      if (worker == TraceEvent::kNoWorker) {
+        fprintf(f, "<div>other threads</div>");
+      } else {
+        fprintf(f, "<div>worker %u</div>", worker);
+      }
+      fprintf(f, "<div class=\"row\">%s</div>\n", row.c_str());
+    }
+    fprintf(f, "<h3>Top tasks</h3>\n<table><tr><th>Task</th><th>Critical path</th><th>Total</th><th>Count</th></tr>\n");
+    for(const TaskStats &s : topTasks(20)) {
+      fprintf(f, "<tr><td>%s</td><td>%.3fms</td><td>%.3fms</td><td>%u</td></tr>\n",
+          TraceAnalysis_Imp::escapeHtml(s.name).c_str(), ms(s.critical_ns), ms(s.total_ns), s.count);
+    }
+    fprintf(f, "</table>\n</body></html>\n");
+    return fclose(f) == 0;
+  }
+
+} // px_sched namespace
+
+#endif // PX_SCHED_TRACE_IMPLEMENTATION